@@ -0,0 +1,659 @@
+// Throughput sweep over window size, buffer size, error rate and file size.
+//
+// Runs ./server once per error rate and ./rcopy several times per point, then
+// prints one row per point: throughput at the median completion time, p50/p99
+// completion time and the share of data packets the server had to resend
+// (taken from the server's -t telemetry reports). A run that times out, fails
+// or leaves a different file behind counts as failed and is left out of the
+// times.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "packet.h"
+#include "window.h"
+#include "rtt.h"
+
+#define BENCH_LIST_MAX 16
+#define BENCH_REPEATS_MAX 1000
+#define BENCH_PATH_MAX 100
+#define BENCH_WORK_DIR "/tmp/srejbench.XXXXXX"
+#define BENCH_LINE_MAX 4096
+// Time given to the server to bind before the first rcopy
+#define BENCH_SERVER_START_MS 300
+// Time given to the server to write its report after rcopy exits
+#define BENCH_REPORT_WAIT_MS 1000
+
+typedef struct {
+	uint32_t windows[BENCH_LIST_MAX];
+	uint32_t numWindows;
+	uint32_t buffers[BENCH_LIST_MAX];
+	uint32_t numBuffers;
+	double errors[BENCH_LIST_MAX];
+	uint32_t numErrors;
+	uint64_t sizes[BENCH_LIST_MAX];
+	uint32_t numSizes;
+
+	uint32_t repeats;
+	uint32_t timeoutS;
+	uint16_t port;
+	bool json;
+	const char* outPath;
+}BenchSettings_t;
+
+typedef struct {
+	uint64_t dataPackets;
+	uint64_t resends;
+}Resends_t;
+
+static BenchSettings_t settings;
+
+static char workDir[sizeof(BENCH_WORK_DIR)];
+static char reportPath[BENCH_PATH_MAX];
+static off_t reportOffset = 0;
+
+static pid_t serverPid = -1;
+static volatile pid_t runPid = -1;
+
+static FILE* out;
+
+static void
+onAlarm(
+	int sig
+){
+	if(runPid > 0){
+		kill(runPid, SIGKILL);
+	}
+}
+
+static void
+sleepMs(
+	uint32_t ms
+){
+	usleep(ms * 1000);
+}
+
+static pid_t
+spawn(
+	char* const argv[],
+	bool ownGroup
+){
+	pid_t pid;
+
+	if((pid = fork()) < 0){
+		perror("spawn: fork() error");
+		exit(1);
+	}
+
+	if(pid == 0){
+		if(ownGroup){
+			setpgid(0, 0);
+		}
+
+		// The cpe464 library logs every packet, keep it off the results
+		int devNull = open("/dev/null", O_WRONLY);
+
+		dup2(devNull, STDOUT_FILENO);
+		dup2(devNull, STDERR_FILENO);
+		close(devNull);
+
+		execv(argv[0], argv);
+		perror("spawn: execv() error");
+		_exit(127);
+	}
+
+	return pid;
+}
+
+static void
+startServer(
+	double errorRate
+){
+	char error[32];
+	char port[16];
+
+	snprintf(error, sizeof(error), "%g", errorRate);
+	snprintf(port, sizeof(port), "%u", settings.port);
+
+	char* argv[] = {"./server", "-t", reportPath, error, port, NULL};
+
+	serverPid = spawn(argv, true);
+	sleepMs(BENCH_SERVER_START_MS);
+
+	if(waitpid(serverPid, NULL, WNOHANG) != 0){
+		fprintf(stderr, "Error: ./server exited at startup, is port %u in use?\n", settings.port);
+		exit(1);
+	}
+}
+
+static void
+stopServer(
+	void
+){
+	if(serverPid > 0){
+		// Session children too, one still sending after a timed out run holds the port
+		kill(-serverPid, SIGTERM);
+		waitpid(serverPid, NULL, 0);
+		serverPid = -1;
+	}
+}
+
+static void
+makeFile(
+	const char* path,
+	uint64_t size
+){
+	uint8_t block[65536];
+	FILE* random;
+	FILE* file;
+
+	if((random = fopen("/dev/urandom", "rb")) == NULL || (file = fopen(path, "wb")) == NULL){
+		perror("makeFile: fopen() error");
+		exit(1);
+	}
+
+	for(uint64_t left = size; left > 0; ){
+		size_t chunk = (left < sizeof(block)) ? (size_t) left : sizeof(block);
+
+		if(fread(block, 1, chunk, random) != chunk || fwrite(block, 1, chunk, file) != chunk){
+			perror("makeFile: write error");
+			exit(1);
+		}
+
+		left -= chunk;
+	}
+
+	fclose(random);
+	fclose(file);
+}
+
+static bool
+sameFiles(
+	const char* pathA,
+	const char* pathB
+){
+	uint8_t blockA[65536];
+	uint8_t blockB[65536];
+	FILE* fileA = fopen(pathA, "rb");
+	FILE* fileB = fopen(pathB, "rb");
+	bool same = (fileA != NULL && fileB != NULL);
+
+	while(same){
+		size_t lenA = fread(blockA, 1, sizeof(blockA), fileA);
+		size_t lenB = fread(blockB, 1, sizeof(blockB), fileB);
+
+		if(lenA != lenB || memcmp(blockA, blockB, lenA) != 0){
+			same = false;
+		} else if(lenA == 0){
+			break;
+		}
+	}
+
+	if(fileA != NULL){
+		fclose(fileA);
+	}
+
+	if(fileB != NULL){
+		fclose(fileB);
+	}
+
+	return same;
+}
+
+static uint64_t
+jsonCounter(
+	const char* line,
+	const char* name
+){
+	char key[64];
+	const char* value;
+
+	snprintf(key, sizeof(key), "\"%s\":", name);
+
+	if((value = strstr(line, key)) == NULL){
+		return 0;
+	}
+
+	return strtoull(value + strlen(key), NULL, 10);
+}
+
+// Adds up the server's final reports written since the last call, false if there were none
+static bool
+readResends(
+	Resends_t* resendsPtr
+){
+	char line[BENCH_LINE_MAX];
+	bool found = false;
+	FILE* report;
+
+	if((report = fopen(reportPath, "r")) == NULL){
+		return false;
+	}
+
+	fseeko(report, reportOffset, SEEK_SET);
+
+	while(fgets(line, sizeof(line), report) != NULL){
+		if(line[strlen(line) - 1] != '\n'){
+			// Still being written, pick it up next time
+			break;
+		}
+
+		reportOffset += (off_t) strlen(line);
+
+		if(strstr(line, "\"event\":\"final\"") == NULL){
+			continue;
+		}
+
+		resendsPtr->dataPackets += jsonCounter(line, "data_packets");
+		resendsPtr->resends += jsonCounter(line, "srej_resends") + jsonCounter(line, "timeout_resends");
+		found = true;
+	}
+
+	fclose(report);
+
+	return found;
+}
+
+// Completion time of one transfer in us, 0 if it failed
+static uint64_t
+runOnce(
+	const char* fromPath,
+	const char* toPath,
+	uint32_t windowSize,
+	uint32_t bufferSize,
+	double errorRate,
+	Resends_t* resendsPtr
+){
+	char window[16];
+	char buffer[16];
+	char error[32];
+	char port[16];
+	int status;
+
+	snprintf(window, sizeof(window), "%u", windowSize);
+	snprintf(buffer, sizeof(buffer), "%u", bufferSize);
+	snprintf(error, sizeof(error), "%g", errorRate);
+	snprintf(port, sizeof(port), "%u", settings.port);
+
+	char* argv[] = {"./rcopy", (char*) fromPath, (char*) toPath, window, buffer, error, "localhost", port, NULL};
+
+	unlink(toPath);
+
+	uint64_t startUs = rttNowUs();
+
+	runPid = spawn(argv, false);
+	alarm(settings.timeoutS);
+
+	while(waitpid(runPid, &status, 0) < 0){
+		if(errno != EINTR){
+			perror("runOnce: waitpid() error");
+			exit(1);
+		}
+	}
+
+	alarm(0);
+	runPid = -1;
+
+	uint64_t elapsedUs = rttNowUs() - startUs;
+
+	// The server reports after it sees EOF_ACK, rcopy may already be gone by then
+	for(uint32_t waitedMs = 0; !readResends(resendsPtr) && waitedMs < BENCH_REPORT_WAIT_MS; waitedMs += 10){
+		sleepMs(10);
+	}
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !sameFiles(fromPath, toPath)){
+		return 0;
+	}
+
+	return elapsedUs;
+}
+
+static int
+compareTimes(
+	const void* a,
+	const void* b
+){
+	uint64_t timeA = *(const uint64_t*) a;
+	uint64_t timeB = *(const uint64_t*) b;
+
+	return (timeA > timeB) - (timeA < timeB);
+}
+
+// Nearest rank, times must be sorted
+static uint64_t
+percentile(
+	const uint64_t* times,
+	uint32_t numTimes,
+	uint32_t percent
+){
+	uint32_t rank = (numTimes * percent + 99) / 100;
+
+	return times[(rank > 0) ? rank - 1 : 0];
+}
+
+static void
+printHeader(
+	void
+){
+	if(!settings.json){
+		fprintf(out, "window,buffer,error_rate,file_bytes,runs,failed,throughput_mbps,p50_ms,p99_ms,retransmit_ratio\n");
+	}
+}
+
+static void
+printPoint(
+	uint32_t windowSize,
+	uint32_t bufferSize,
+	double errorRate,
+	uint64_t fileSize,
+	uint64_t* times,
+	uint32_t numTimes,
+	const Resends_t* resendsPtr
+){
+	uint32_t failed = settings.repeats - numTimes;
+	double ratio = (resendsPtr->dataPackets > 0) ? (double) resendsPtr->resends / resendsPtr->dataPackets : 0.0;
+	double mbps = 0.0;
+	double p50Ms = 0.0;
+	double p99Ms = 0.0;
+
+	if(numTimes > 0){
+		qsort(times, numTimes, sizeof(uint64_t), compareTimes);
+
+		p50Ms = percentile(times, numTimes, 50) / 1000.0;
+		p99Ms = percentile(times, numTimes, 99) / 1000.0;
+		mbps = fileSize * 8.0 / (p50Ms * 1000.0);
+	}
+
+	if(settings.json){
+		fprintf(out, "{\"window\":%u,\"buffer\":%u,\"error_rate\":%g,\"file_bytes\":%llu,\"runs\":%u,\"failed\":%u,"
+			"\"throughput_mbps\":%.3f,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"retransmit_ratio\":%.4f}\n",
+			windowSize, bufferSize, errorRate, (unsigned long long) fileSize, settings.repeats, failed,
+			mbps, p50Ms, p99Ms, ratio
+		);
+	} else {
+		fprintf(out, "%u,%u,%g,%llu,%u,%u,%.3f,%.3f,%.3f,%.4f\n",
+			windowSize, bufferSize, errorRate, (unsigned long long) fileSize, settings.repeats, failed,
+			mbps, p50Ms, p99Ms, ratio
+		);
+	}
+
+	fflush(out);
+}
+
+static void
+runSweep(
+	void
+){
+	char fromPath[BENCH_PATH_MAX];
+	char toPath[BENCH_PATH_MAX];
+	uint64_t* times;
+
+	if((times = (uint64_t*) malloc(settings.repeats * sizeof(uint64_t))) == NULL){
+		perror("runSweep: malloc() error");
+		exit(1);
+	}
+
+	snprintf(toPath, sizeof(toPath), "%s/out.bin", workDir);
+
+	for(uint32_t s = 0; s < settings.numSizes; s++){
+		snprintf(fromPath, sizeof(fromPath), "%s/%llu.bin", workDir, (unsigned long long) settings.sizes[s]);
+		makeFile(fromPath, settings.sizes[s]);
+	}
+
+	printHeader();
+
+	for(uint32_t e = 0; e < settings.numErrors; e++){
+		startServer(settings.errors[e]);
+
+		for(uint32_t s = 0; s < settings.numSizes; s++){
+			snprintf(fromPath, sizeof(fromPath), "%s/%llu.bin", workDir, (unsigned long long) settings.sizes[s]);
+
+			for(uint32_t w = 0; w < settings.numWindows; w++){
+				for(uint32_t b = 0; b < settings.numBuffers; b++){
+					Resends_t resends = {0, 0};
+					uint32_t numTimes = 0;
+
+					for(uint32_t r = 0; r < settings.repeats; r++){
+						uint64_t us = runOnce(fromPath, toPath, settings.windows[w], settings.buffers[b], settings.errors[e], &resends);
+
+						if(us > 0){
+							times[numTimes++] = us;
+						}
+					}
+
+					printPoint(settings.windows[w], settings.buffers[b], settings.errors[e], settings.sizes[s], times, numTimes, &resends);
+				}
+			}
+		}
+
+		stopServer();
+	}
+
+	free(times);
+}
+
+static void
+removeWorkDir(
+	void
+){
+	char path[BENCH_PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/out.bin", workDir);
+	unlink(path);
+
+	for(uint32_t s = 0; s < settings.numSizes; s++){
+		snprintf(path, sizeof(path), "%s/%llu.bin", workDir, (unsigned long long) settings.sizes[s]);
+		unlink(path);
+	}
+
+	unlink(reportPath);
+	rmdir(workDir);
+}
+
+// Comma separated list, each value checked against [min, max]
+static int
+parseList(
+	const char* list,
+	double min,
+	double max,
+	double* values,
+	uint32_t* numValues
+){
+	const char* value = list;
+	char* endptr;
+
+	*numValues = 0;
+
+	while(*numValues < BENCH_LIST_MAX){
+		double parsed = strtod(value, &endptr);
+
+		if(endptr == value || parsed < min || parsed > max || (*endptr != ',' && *endptr != '\0')){
+			return -1;
+		}
+
+		values[(*numValues)++] = parsed;
+
+		if(*endptr == '\0'){
+			return 0;
+		}
+
+		value = endptr + 1;
+	}
+
+	return -1;
+}
+
+static int
+checkArgs(
+	int argc,
+	char* argv[],
+	BenchSettings_t* settings
+){
+	double values[BENCH_LIST_MAX];
+	uint32_t numValues;
+	int opt;
+	char* endptr;
+	long value;
+
+	const char* windows = "10,50";
+	const char* buffers = "1000,1400";
+	const char* errors = "0,0.05";
+	const char* sizes = "100000,1000000";
+
+	settings->repeats = 5;
+	settings->timeoutS = 60;
+	settings->port = 46464;
+	settings->json = false;
+	settings->outPath = NULL;
+
+	while((opt = getopt(argc, argv, "w:b:e:s:n:T:p:jo:")) != -1){
+		switch(opt){
+		case 'w':
+			windows = optarg;
+			break;
+		case 'b':
+			buffers = optarg;
+			break;
+		case 'e':
+			errors = optarg;
+			break;
+		case 's':
+			sizes = optarg;
+			break;
+		case 'n':
+			value = strtol(optarg, &endptr, 10);
+			if(*endptr != '\0' || value < 1 || value > BENCH_REPEATS_MAX){
+				fprintf(stderr, "Invalid repeat count: %s\n", optarg);
+				return -1;
+			}
+			settings->repeats = (uint32_t) value;
+			break;
+		case 'T':
+			value = strtol(optarg, &endptr, 10);
+			if(*endptr != '\0' || value < 1){
+				fprintf(stderr, "Invalid timeout: %s\n", optarg);
+				return -1;
+			}
+			settings->timeoutS = (uint32_t) value;
+			break;
+		case 'p':
+			value = strtol(optarg, &endptr, 10);
+			if(*endptr != '\0' || value <= 0 || value > 65535){
+				fprintf(stderr, "Invalid port: %s\n", optarg);
+				return -1;
+			}
+			settings->port = (uint16_t) value;
+			break;
+		case 'j':
+			settings->json = true;
+			break;
+		case 'o':
+			settings->outPath = optarg;
+			break;
+		default:
+			argc = 0;
+			break;
+		}
+	}
+
+	if(argc != optind){
+		fprintf(stderr, "Usage: %s [-w windows] [-b buffers] [-e error-rates] [-s file-bytes] [-n repeats] [-T timeout-s] [-p port] [-j] [-o out-file]\n", argv[0]);
+		fprintf(stderr, "  -w  comma separated window sizes (default %s)\n", windows);
+		fprintf(stderr, "  -b  comma separated buffer sizes (default %s)\n", buffers);
+		fprintf(stderr, "  -e  comma separated error rates (default %s)\n", errors);
+		fprintf(stderr, "  -s  comma separated file sizes in bytes (default %s)\n", sizes);
+		fprintf(stderr, "  -n  runs per point (default 5)\n");
+		fprintf(stderr, "  -T  seconds before a run counts as failed (default 60)\n");
+		fprintf(stderr, "  -p  server port (default 46464)\n");
+		fprintf(stderr, "  -j  JSON lines instead of CSV\n");
+		fprintf(stderr, "  -o  write the results here instead of stdout\n");
+		return -1;
+	}
+
+	if(parseList(windows, 1, WINDOW_SIZE_MAX, values, &numValues) < 0){
+		fprintf(stderr, "Invalid window sizes: %s\n", windows);
+		return -1;
+	}
+	for(uint32_t i = 0; i < numValues; i++){
+		settings->windows[i] = (uint32_t) values[i];
+	}
+	settings->numWindows = numValues;
+
+	if(parseList(buffers, PAYLOAD_MIN, PAYLOAD_MAX, values, &numValues) < 0){
+		fprintf(stderr, "Invalid buffer sizes: %s\n", buffers);
+		return -1;
+	}
+	for(uint32_t i = 0; i < numValues; i++){
+		settings->buffers[i] = (uint32_t) values[i];
+	}
+	settings->numBuffers = numValues;
+
+	if(parseList(errors, 0, 1, settings->errors, &settings->numErrors) < 0){
+		fprintf(stderr, "Invalid error rates: %s\n", errors);
+		return -1;
+	}
+
+	if(parseList(sizes, 1, 1e12, values, &numValues) < 0){
+		fprintf(stderr, "Invalid file sizes: %s\n", sizes);
+		return -1;
+	}
+	for(uint32_t i = 0; i < numValues; i++){
+		settings->sizes[i] = (uint64_t) values[i];
+	}
+	settings->numSizes = numValues;
+
+	return 0;
+}
+
+int
+main(
+	int argc,
+	char* argv[]
+){
+	struct sigaction action;
+
+	if(checkArgs(argc, argv, &settings) < 0){
+		exit(1);
+	}
+
+	if(access("./server", X_OK) < 0 || access("./rcopy", X_OK) < 0){
+		fprintf(stderr, "Error: run from the directory holding ./server and ./rcopy\n");
+		exit(1);
+	}
+
+	out = stdout;
+	if(settings.outPath != NULL && (out = fopen(settings.outPath, "w")) == NULL){
+		perror(settings.outPath);
+		exit(1);
+	}
+
+	// No SA_RESTART, the alarm has to break waitpid()
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onAlarm;
+	sigaction(SIGALRM, &action, NULL);
+
+	snprintf(workDir, sizeof(workDir), "%s", BENCH_WORK_DIR);
+	if(mkdtemp(workDir) == NULL){
+		perror("main: mkdtemp() error");
+		exit(1);
+	}
+	snprintf(reportPath, sizeof(reportPath), "%s/server.json", workDir);
+
+	runSweep();
+	removeWorkDir();
+
+	if(out != stdout){
+		fclose(out);
+	}
+
+	return 0;
+}
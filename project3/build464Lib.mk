@@ -5,7 +5,7 @@ BUILD_MINOR=21
 TEST=test
 
 CC = g++
-CFLAGS = 
+CFLAGS = -O2
 
 LIBPATH=libcpe464
 NETWORK=libcpe464/networks
@@ -19,6 +19,8 @@ HFILE = cpe464
 
 CPE464_VER = libcpe464.$(BUILD_MAJOR).$(BUILD_MINOR)
 CPE464_LIB = $(CPE464_VER).a
+CPE464_PRELOAD = $(CPE464_VER).preload.so
+PRELOAD_OBJS = $(OBJS:.o=.pic.o)
 
 all: header $(OBJS) link combHeader clean
 	@echo "-------------------------------"
@@ -46,6 +48,20 @@ header:
 	@echo "-------------------------------"
 	@echo "Building $(CPE464_LIB) Objects"
 
+# Shared library that hooks unmodified programs through LD_PRELOAD, e.g.
+#   CPE464_OVERRIDE_ERR_RATE=0.1 LD_PRELOAD=./$(CPE464_PRELOAD) ./program
+preload: header $(PRELOAD_OBJS) linkPreload clean
+	@echo "-------------------------------"
+
+%.pic.o: %.cpp
+	@echo "-------------------------------"
+	@echo "  C++ Compiling $@"
+	$(V)$(CC) -c $(CFLAGS) -fPIC -D__LIBCPE464_PRELOAD $< -o $@
+%.pic.o: %.c
+	@echo "-------------------------------"
+	@echo "  C Compiling $@"
+	$(V)$(CC) -c $(CFLAGS) -fPIC -D__LIBCPE464_PRELOAD $< -o $@
+
 .cpp.o:
 	@echo "-------------------------------"
 	@echo "  C++ Compiling $@"
@@ -62,6 +78,11 @@ link:
 	@echo "-------------------------------"
 	@echo "Done creating: $(CPE464_LIB) library"
 
+linkPreload:
+	@echo "-------------------------------"
+	@echo "Linking objects into $(CPE464_PRELOAD)"
+	$(V)$(CC) -shared -o $(CPE464_PRELOAD) $(PRELOAD_OBJS) -ldl -lpthread
+
 combHeader:
 	@echo "-------------------------------"
 	@echo "Creating: cpe464.h"
@@ -75,4 +96,4 @@ clean:
 	-@find libcpe464/ -name "*.o" | xargs rm -f
 
 clean-full: clean
-	-@rm -f ../*libcpe464*.a
+	-@rm -f ../*libcpe464*.a *libcpe464*.so
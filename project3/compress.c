@@ -0,0 +1,145 @@
+#include <string.h>
+
+#include "compress.h"
+
+#define LZ_HASH_LOG 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_LOG)
+#define LZ_HASH(p) (((((uint32_t) (p)[0] << 16) | ((uint32_t) (p)[1] << 8) | (p)[2]) * 2654435761u) >> (32 - LZ_HASH_LOG))
+
+// Stale entries from an earlier block are harmless, every candidate is
+// compared against the current input before it is used.
+static uint32_t hashTable[LZ_HASH_SIZE];
+
+uint16_t
+lzCompress(
+	const uint8_t* in,
+	uint32_t inLen,
+	uint32_t* inUsedPtr,
+	uint8_t* out,
+	uint16_t outMax
+){
+	uint32_t ip = 0;
+	uint32_t op = 0;
+	uint32_t litCtrl = 0;
+	uint32_t lit = 0;
+
+	// Stops as soon as the next token doesn't fit, so the block always covers
+	// exactly the first *inUsedPtr bytes of the input
+	while(ip < inLen){
+		if(ip + LZ_MATCH_MIN <= inLen){
+			uint32_t hash = LZ_HASH(&in[ip]);
+			uint32_t ref = hashTable[hash];
+
+			hashTable[hash] = ip;
+
+			if(ref < ip && ip - ref <= LZ_OFFSET_MAX && memcmp(&in[ref], &in[ip], LZ_MATCH_MIN) == 0){
+				uint32_t maxLen = inLen - ip;
+				uint32_t len = LZ_MATCH_MIN;
+
+				if(maxLen > LZ_MATCH_MAX){
+					maxLen = LZ_MATCH_MAX;
+				}
+
+				while(len < maxLen && in[ref + len] == in[ip + len]){
+					len++;
+				}
+
+				uint32_t off = ip - ref - 1;
+				uint32_t code = len - 2;
+
+				if(op + ((code < 7) ? 2 : 3) > outMax){
+					break;
+				}
+
+				if(code < 7){
+					out[op++] = (uint8_t) ((code << 5) | (off >> 8));
+				} else {
+					out[op++] = (uint8_t) ((7 << 5) | (off >> 8));
+					out[op++] = (uint8_t) (code - 7);
+				}
+				out[op++] = (uint8_t) (off & 0xff);
+
+				lit = 0;
+				ip += len;
+				continue;
+			}
+		}
+
+		if(lit == 0){
+			if(op + 2 > outMax){
+				break;
+			}
+			litCtrl = op++;
+		} else if(op + 1 > outMax){
+			break;
+		}
+
+		out[op++] = in[ip++];
+		out[litCtrl] = (uint8_t) lit++;
+
+		if(lit == LZ_LITERAL_MAX){
+			lit = 0;
+		}
+	}
+
+	*inUsedPtr = ip;
+
+	return (uint16_t) op;
+}
+
+int32_t
+lzDecompress(
+	const uint8_t* in,
+	uint16_t inLen,
+	uint8_t* out,
+	uint32_t outMax
+){
+	uint32_t ip = 0;
+	uint32_t op = 0;
+
+	while(ip < inLen){
+		uint32_t ctrl = in[ip++];
+
+		if(ctrl < LZ_LITERAL_MAX){
+			uint32_t len = ctrl + 1;
+
+			if(ip + len > inLen || op + len > outMax){
+				return -1;
+			}
+
+			memcpy(&out[op], &in[ip], len);
+
+			ip += len;
+			op += len;
+		} else {
+			uint32_t len = ctrl >> 5;
+
+			if(len == 7){
+				if(ip >= inLen){
+					return -1;
+				}
+				len += in[ip++];
+			}
+			len += 2;
+
+			if(ip >= inLen){
+				return -1;
+			}
+
+			uint32_t off = (((ctrl & 0x1f) << 8) | in[ip++]) + 1;
+
+			if(off > op || op + len > outMax){
+				return -1;
+			}
+
+			// Byte by byte, references are allowed to overlap the output
+			for(uint32_t i = 0; i < len; i++){
+				out[op + i] = out[op - off + i];
+			}
+
+			op += len;
+		}
+	}
+
+	return (int32_t) op;
+}
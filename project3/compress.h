@@ -0,0 +1,33 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+
+// LZF style block format: every block decodes on its own, so a block can be
+// written as soon as its packet is in order.
+//   000LLLLL                  -> L + 1 literal bytes follow
+//   LLLooooo oooooooo         -> back reference, length L + 2 (L = 1..6)
+//   111ooooo LLLLLLLL oooooooo -> back reference, length L + 9
+#define LZ_LITERAL_MAX 32
+#define LZ_MATCH_MIN 3
+#define LZ_MATCH_MAX (LZ_MATCH_MIN + 6 + 255)
+#define LZ_OFFSET_MAX (1 << 13)
+
+uint16_t
+lzCompress(
+	const uint8_t* in,
+	uint32_t inLen,
+	uint32_t* inUsedPtr,
+	uint8_t* out,
+	uint16_t outMax
+);
+
+int32_t
+lzDecompress(
+	const uint8_t* in,
+	uint16_t inLen,
+	uint8_t* out,
+	uint32_t outMax
+);
+
+#endif // COMPRESS_H
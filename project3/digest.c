@@ -0,0 +1,218 @@
+#include <string.h>
+
+#include "digest.h"
+
+// 64 bit FNV-1a
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t sha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void
+sha256Init(
+	Sha256_t* shaPtr
+){
+	static const uint32_t initState[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(shaPtr->state, initState, sizeof(initState));
+	shaPtr->length = 0;
+	shaPtr->blockLen = 0;
+}
+
+static void
+sha256Block(
+	Sha256_t* shaPtr,
+	const uint8_t* block
+){
+	uint32_t w[64];
+
+	for(int i = 0; i < 16; i++){
+		w[i] = ((uint32_t) block[i * 4] << 24) | ((uint32_t) block[i * 4 + 1] << 16) | ((uint32_t) block[i * 4 + 2] << 8) | block[i * 4 + 3];
+	}
+
+	for(int i = 16; i < 64; i++){
+		uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = shaPtr->state[0];
+	uint32_t b = shaPtr->state[1];
+	uint32_t c = shaPtr->state[2];
+	uint32_t d = shaPtr->state[3];
+	uint32_t e = shaPtr->state[4];
+	uint32_t f = shaPtr->state[5];
+	uint32_t g = shaPtr->state[6];
+	uint32_t h = shaPtr->state[7];
+
+	for(int i = 0; i < 64; i++){
+		uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+		uint32_t ch = (e & f) ^ (~e & g);
+		uint32_t t1 = h + s1 + ch + sha256K[i] + w[i];
+		uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+		uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t t2 = s0 + maj;
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	shaPtr->state[0] += a;
+	shaPtr->state[1] += b;
+	shaPtr->state[2] += c;
+	shaPtr->state[3] += d;
+	shaPtr->state[4] += e;
+	shaPtr->state[5] += f;
+	shaPtr->state[6] += g;
+	shaPtr->state[7] += h;
+}
+
+static void
+sha256Update(
+	Sha256_t* shaPtr,
+	const uint8_t* data,
+	size_t dataLen
+){
+	shaPtr->length += dataLen;
+
+	while(dataLen > 0){
+		if(shaPtr->blockLen == 0 && dataLen >= sizeof(shaPtr->block)){
+			sha256Block(shaPtr, data);
+
+			data += sizeof(shaPtr->block);
+			dataLen -= sizeof(shaPtr->block);
+			continue;
+		}
+
+		size_t copyLen = sizeof(shaPtr->block) - shaPtr->blockLen;
+
+		if(copyLen > dataLen){
+			copyLen = dataLen;
+		}
+
+		memcpy(shaPtr->block + shaPtr->blockLen, data, copyLen);
+
+		shaPtr->blockLen += copyLen;
+		data += copyLen;
+		dataLen -= copyLen;
+
+		if(shaPtr->blockLen == sizeof(shaPtr->block)){
+			sha256Block(shaPtr, shaPtr->block);
+			shaPtr->blockLen = 0;
+		}
+	}
+}
+
+static void
+sha256Final(
+	Sha256_t* shaPtr,
+	uint8_t* hashPtr
+){
+	uint64_t bitLength = shaPtr->length * 8;
+
+	shaPtr->block[shaPtr->blockLen++] = 0x80;
+
+	if(shaPtr->blockLen > 56){
+		memset(shaPtr->block + shaPtr->blockLen, 0, sizeof(shaPtr->block) - shaPtr->blockLen);
+		sha256Block(shaPtr, shaPtr->block);
+		shaPtr->blockLen = 0;
+	}
+
+	memset(shaPtr->block + shaPtr->blockLen, 0, 56 - shaPtr->blockLen);
+
+	for(int i = 0; i < 8; i++){
+		shaPtr->block[63 - i] = (uint8_t) (bitLength >> (i * 8));
+	}
+
+	sha256Block(shaPtr, shaPtr->block);
+
+	for(int i = 0; i < 8; i++){
+		hashPtr[i * 4] = (uint8_t) (shaPtr->state[i] >> 24);
+		hashPtr[i * 4 + 1] = (uint8_t) (shaPtr->state[i] >> 16);
+		hashPtr[i * 4 + 2] = (uint8_t) (shaPtr->state[i] >> 8);
+		hashPtr[i * 4 + 3] = (uint8_t) shaPtr->state[i];
+	}
+}
+
+void
+digestInit(
+	Digest_t* digestPtr,
+	bool withSha256
+){
+	digestPtr->fastHash = FNV_OFFSET_BASIS;
+	digestPtr->withSha256 = withSha256;
+
+	if(withSha256){
+		sha256Init(&digestPtr->sha256);
+	}
+}
+
+void
+digestUpdate(
+	Digest_t* digestPtr,
+	const uint8_t* data,
+	size_t dataLen
+){
+	uint64_t hash = digestPtr->fastHash;
+
+	for(size_t i = 0; i < dataLen; i++){
+		hash ^= data[i];
+		hash *= FNV_PRIME;
+	}
+
+	digestPtr->fastHash = hash;
+
+	if(digestPtr->withSha256){
+		sha256Update(&digestPtr->sha256, data, dataLen);
+	}
+}
+
+void
+digestFinal(
+	Digest_t* digestPtr,
+	uint64_t* fastHashPtr,
+	uint8_t* sha256Ptr
+){
+	*fastHashPtr = digestPtr->fastHash;
+
+	if(digestPtr->withSha256 && sha256Ptr != NULL){
+		sha256Final(&digestPtr->sha256, sha256Ptr);
+	}
+}
+
+char*
+digestToHex(
+	const uint8_t* bytes,
+	size_t numBytes,
+	char* hexPtr
+){
+	static const char hexDigits[] = "0123456789abcdef";
+
+	for(size_t i = 0; i < numBytes; i++){
+		hexPtr[i * 2] = hexDigits[bytes[i] >> 4];
+		hexPtr[i * 2 + 1] = hexDigits[bytes[i] & 0x0f];
+	}
+	hexPtr[numBytes * 2] = '\0';
+
+	return hexPtr;
+}
@@ -0,0 +1,52 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DIGEST_SHA256_LEN 32
+#define DIGEST_HEX_MAX (DIGEST_SHA256_LEN * 2 + 1)
+
+typedef struct {
+	uint32_t state[8];
+	uint64_t length;
+	uint8_t block[64];
+	uint32_t blockLen;
+} Sha256_t;
+
+// Streaming file digest, fed in file order on both ends of a transfer
+typedef struct {
+	uint64_t fastHash;
+	bool withSha256;
+	Sha256_t sha256;
+} Digest_t;
+
+void
+digestInit(
+	Digest_t* digestPtr,
+	bool withSha256
+);
+
+void
+digestUpdate(
+	Digest_t* digestPtr,
+	const uint8_t* data,
+	size_t dataLen
+);
+
+void
+digestFinal(
+	Digest_t* digestPtr,
+	uint64_t* fastHashPtr,
+	uint8_t* sha256Ptr
+);
+
+char*
+digestToHex(
+	const uint8_t* bytes,
+	size_t numBytes,
+	char* hexPtr
+);
+
+#endif // DIGEST_H
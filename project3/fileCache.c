@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fileCache.h"
+#include "packet.h"
+
+typedef struct {
+	bool valid;
+	char path[FILENAME_MAX_LEN + 1];
+
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+
+	uint8_t* map;
+	uint64_t lastUsed;
+} FileCacheEntry_t;
+
+static FileCacheEntry_t entries[FILE_CACHE_ENTRIES_MAX];
+static FileCacheStats_t stats = {0};
+static uint64_t useTick = 0;
+
+// Set only for the length of a fileCacheCopy()
+static sigjmp_buf copyJump;
+static volatile sig_atomic_t copyActive = 0;
+
+static void
+busError(
+	int sig
+){
+	if(copyActive){
+		siglongjmp(copyJump, 1);
+	}
+
+	// Not ours, die of it as we would have
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void
+evictEntry(
+	FileCacheEntry_t* entryPtr
+){
+	munmap(entryPtr->map, entryPtr->size);
+
+	stats.bytesCached -= entryPtr->size;
+	stats.evictions++;
+
+	entryPtr->valid = false;
+	entryPtr->map = NULL;
+}
+
+static FileCacheEntry_t*
+leastRecentlyUsed(
+	void
+){
+	FileCacheEntry_t* lruPtr = NULL;
+
+	for(uint32_t i = 0; i < FILE_CACHE_ENTRIES_MAX; i++){
+		if(entries[i].valid && (lruPtr == NULL || entries[i].lastUsed < lruPtr->lastUsed)){
+			lruPtr = &entries[i];
+		}
+	}
+
+	return lruPtr;
+}
+
+static FileCacheEntry_t*
+freeEntry(
+	size_t size
+){
+	while(stats.bytesCached + size > stats.capacity){
+		evictEntry(leastRecentlyUsed());
+	}
+
+	for(uint32_t i = 0; i < FILE_CACHE_ENTRIES_MAX; i++){
+		if(!entries[i].valid){
+			return &entries[i];
+		}
+	}
+
+	FileCacheEntry_t* lruPtr = leastRecentlyUsed();
+	evictEntry(lruPtr);
+
+	return lruPtr;
+}
+
+void
+fileCacheInit(
+	size_t capacity
+){
+	memset(entries, 0, sizeof(entries));
+	memset(&stats, 0, sizeof(stats));
+
+	stats.capacity = capacity;
+
+	if(capacity > 0){
+		struct sigaction action;
+
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = busError;
+		sigemptyset(&action.sa_mask);
+
+		if(sigaction(SIGBUS, &action, NULL) < 0){
+			perror("fileCacheInit: sigaction() error");
+		}
+	}
+}
+
+const uint8_t*
+fileCacheAcquire(
+	const char* path,
+	size_t* sizePtr
+){
+	struct stat fileStat;
+
+	if(stats.capacity == 0 || strlen(path) > FILENAME_MAX_LEN || stat(path, &fileStat) < 0 || !S_ISREG(fileStat.st_mode)){
+		stats.bypassed++;
+		return NULL;
+	}
+
+	for(uint32_t i = 0; i < FILE_CACHE_ENTRIES_MAX; i++){
+		FileCacheEntry_t* entryPtr = &entries[i];
+
+		if(!entryPtr->valid || strcmp(entryPtr->path, path) != 0){
+			continue;
+		}
+
+		if(
+			entryPtr->dev == fileStat.st_dev &&
+			entryPtr->ino == fileStat.st_ino &&
+			entryPtr->size == fileStat.st_size &&
+			entryPtr->mtime.tv_sec == fileStat.st_mtim.tv_sec &&
+			entryPtr->mtime.tv_nsec == fileStat.st_mtim.tv_nsec
+		){
+			stats.hits++;
+			entryPtr->lastUsed = ++useTick;
+
+			*sizePtr = entryPtr->size;
+			return entryPtr->map;
+		}
+
+		// File changed since it was mapped
+		evictEntry(entryPtr);
+		break;
+	}
+
+	stats.misses++;
+
+	if(fileStat.st_size == 0 || (size_t) fileStat.st_size > stats.capacity){
+		stats.bypassed++;
+		return NULL;
+	}
+
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0){
+		stats.bypassed++;
+		return NULL;
+	}
+
+	uint8_t* map = (uint8_t*) mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(map == MAP_FAILED){
+		perror("fileCacheAcquire: mmap() error");
+		stats.bypassed++;
+		return NULL;
+	}
+
+	// Start the one disk read now, sessions will find the pages resident
+	madvise(map, fileStat.st_size, MADV_WILLNEED);
+
+	FileCacheEntry_t* entryPtr = freeEntry(fileStat.st_size);
+
+	entryPtr->valid = true;
+	strcpy(entryPtr->path, path);
+	entryPtr->dev = fileStat.st_dev;
+	entryPtr->ino = fileStat.st_ino;
+	entryPtr->size = fileStat.st_size;
+	entryPtr->mtime = fileStat.st_mtim;
+	entryPtr->map = map;
+	entryPtr->lastUsed = ++useTick;
+
+	stats.bytesCached += entryPtr->size;
+
+	*sizePtr = entryPtr->size;
+	return entryPtr->map;
+}
+
+bool
+fileCacheCopy(
+	uint8_t* dest,
+	const uint8_t* src,
+	size_t len
+){
+	if(sigsetjmp(copyJump, 1) != 0){
+		copyActive = 0;
+		return false;
+	}
+
+	copyActive = 1;
+	memcpy(dest, src, len);
+	copyActive = 0;
+
+	return true;
+}
+
+FileCacheStats_t
+fileCacheStats(
+	void
+){
+	return stats;
+}
+
+void
+fileCachePrintStats(
+	FILE* stream
+){
+	fprintf(stream, "File cache: hits %llu misses %llu bypassed %llu evictions %llu bytes %zu/%zu\n",
+		(unsigned long long) stats.hits,
+		(unsigned long long) stats.misses,
+		(unsigned long long) stats.bypassed,
+		(unsigned long long) stats.evictions,
+		stats.bytesCached,
+		stats.capacity
+	);
+}
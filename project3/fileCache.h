@@ -0,0 +1,62 @@
+// Server side cache of recently requested files.
+//
+// Files are mapped read-only and shared. Forking per transfer, the parent maps
+// a file once and every session child inherits the mapping; prefork workers
+// (-p) each keep a table of their own, sharing only the page cache behind it.
+// Entries are keyed by path and checked against the file's mtime, size and
+// inode on every lookup, and the least recently used entries are unmapped to
+// stay under the byte cap.
+//
+// A file truncated while mapped raises SIGBUS on the missing pages, so copies
+// out of a mapping go through fileCacheCopy().
+
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define FILE_CACHE_ENTRIES_MAX 32
+#define FILE_CACHE_DEFAULT_MB 64
+
+typedef struct {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t bypassed;
+	uint64_t evictions;
+	size_t bytesCached;
+	size_t capacity;
+} FileCacheStats_t;
+
+void
+fileCacheInit(
+	size_t capacity
+);
+
+const uint8_t*
+fileCacheAcquire(
+	const char* path,
+	size_t* sizePtr
+);
+
+// False if the pages went away under the copy (the file shrank), read it with stdio then
+bool
+fileCacheCopy(
+	uint8_t* dest,
+	const uint8_t* src,
+	size_t len
+);
+
+FileCacheStats_t
+fileCacheStats(
+	void
+);
+
+void
+fileCachePrintStats(
+	FILE* stream
+);
+
+#endif // FILECACHE_H
@@ -0,0 +1,436 @@
+// ============================================================================
+#include "LinkEmulator.h"
+#include "RandStream.h"
+#include "RealCalls.h"
+
+#include "utils/dbg_print.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+// ============================================================================
+// The one instance lives in PacketManager, the fork handlers need to find it
+static LinkEmulator* s_pLink = NULL;
+// ============================================================================
+LinkEmulator::LinkEmulator() :
+    m_DelayUs(0), m_JitterUs(0), m_RateBps(0), m_QueueLimit(LINK_QUEUE_DEFAULT),
+    m_LinkFreeUs(0), m_Order(0), m_NumHeld(0), m_ThreadPid(0), m_Stopping(false)
+{
+    initSync();
+
+    s_pLink = this;
+    pthread_atfork(forkPrepare, forkParent, forkChild);
+}
+// ============================================================================
+LinkEmulator::~LinkEmulator()
+{
+    if (m_ThreadPid == getpid())
+    {
+        // Packets already on the wire still arrive, let the worker drain them
+        pthread_mutex_lock(&m_Lock);
+        m_Stopping = true;
+        pthread_cond_signal(&m_Wake);
+        pthread_mutex_unlock(&m_Lock);
+
+        pthread_join(m_Thread, NULL);
+    }
+
+    s_pLink = NULL;
+
+    while (!m_Queue.empty())
+    {
+        delete m_Queue.top();
+        m_Queue.pop();
+    }
+
+    for (size_t i = 0; i < m_Held.size(); ++i)
+    {
+        delete m_Held[i];
+    }
+    m_Held.clear();
+
+    pthread_cond_destroy(&m_Wake);
+    pthread_mutex_destroy(&m_Lock);
+}
+// ============================================================================
+void LinkEmulator::initSync(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&m_Lock, NULL);
+
+    // Release times are monotonic, so are the timed waits
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_Wake, &attr);
+    pthread_condattr_destroy(&attr);
+}
+// ============================================================================
+uint64_t LinkEmulator::nowUs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+// ============================================================================
+int LinkEmulator::setDelay(long delayMs)
+{
+    if (delayMs < 0)
+    {
+        return -1;
+    }
+
+    m_DelayUs = (uint64_t)delayMs * 1000;
+
+    return 0;
+}
+// ============================================================================
+int LinkEmulator::setJitter(long jitterMs)
+{
+    if (jitterMs < 0)
+    {
+        return -1;
+    }
+
+    m_JitterUs = (uint64_t)jitterMs * 1000;
+
+    return 0;
+}
+// ============================================================================
+int LinkEmulator::setRate(long rateKbps)
+{
+    if (rateKbps < 0)
+    {
+        return -1;
+    }
+
+    m_RateBps = (uint64_t)rateKbps * 1000;
+
+    return 0;
+}
+// ============================================================================
+int LinkEmulator::setQueueLimit(long packets)
+{
+    if (packets < 1)
+    {
+        return -1;
+    }
+
+    m_QueueLimit = packets;
+
+    return 0;
+}
+// ============================================================================
+bool LinkEmulator::isEnabled(void)
+{
+    return (m_DelayUs > 0) || (m_JitterUs > 0) || (m_RateBps > 0);
+}
+// ============================================================================
+LinkEmulator::Packet* LinkEmulator::makePacket(int s, const void* buf, size_t len, int flags,
+                                               const struct sockaddr* to, socklen_t tolen)
+{
+    Packet* pkt = new Packet();
+    pkt->releaseUs = 0;
+    pkt->order = m_Order++;
+    pkt->socket = s;
+    pkt->flags = flags;
+    pkt->toLen = (to != NULL) ? tolen : 0;
+    if (to != NULL)
+    {
+        memcpy(&pkt->to, to, tolen);
+    }
+    pkt->data.assign((const uint8_t*)buf, (const uint8_t*)buf + len);
+    pkt->holdSends = 0;
+    pkt->holdUntilUs = 0;
+    pkt->holdFloorUs = 0;
+
+    return pkt;
+}
+// ============================================================================
+int LinkEmulator::schedule(Packet* pkt, uint64_t now)
+{
+    uint64_t departUs = now;
+
+    while (!m_Departures.empty() && (m_Departures.front() <= now))
+    {
+        m_Departures.pop_front();
+    }
+
+    if (m_RateBps > 0)
+    {
+        if (m_Departures.size() >= m_QueueLimit)
+        {
+            delete pkt;
+
+            INFO_PRINT(" - LINK QUEUE FULL ");
+            return 2;
+        }
+
+        // Serialized behind whatever is still queued at the bottleneck
+        departUs = (m_LinkFreeUs > now) ? m_LinkFreeUs : now;
+        departUs += (uint64_t)pkt->data.size() * 8 * 1000000 / m_RateBps;
+
+        m_LinkFreeUs = departUs;
+        m_Departures.push_back(departUs);
+    }
+
+    pkt->releaseUs = departUs + m_DelayUs;
+
+    if (m_JitterUs > 0)
+    {
+        // Uniform in [-jitter, +jitter], never before the packet left
+        int64_t jitterUs = (int64_t)((RandStream::next() * 2.0 - 1.0) * m_JitterUs);
+
+        if ((jitterUs < 0) && ((uint64_t)(-jitterUs) > m_DelayUs))
+        {
+            pkt->releaseUs = departUs;
+        }
+        else
+        {
+            pkt->releaseUs += jitterUs;
+        }
+    }
+
+    m_Queue.push(pkt);
+    pthread_cond_signal(&m_Wake);
+
+    return 0;
+}
+// ============================================================================
+int LinkEmulator::enqueue(int s, const void* buf, size_t len, int flags,
+                          const struct sockaddr* to, socklen_t tolen)
+{
+    pthread_mutex_lock(&m_Lock);
+
+    if ((m_ThreadPid != getpid()) && (startThread() < 0))
+    {
+        pthread_mutex_unlock(&m_Lock);
+        exit(1);
+    }
+
+    int nResult = schedule(makePacket(s, buf, len, flags, to, tolen), nowUs());
+
+    pthread_mutex_unlock(&m_Lock);
+
+    return nResult;
+}
+// ============================================================================
+int LinkEmulator::hold(int s, const void* buf, size_t len, int flags,
+                       const struct sockaddr* to, socklen_t tolen,
+                       uint32_t laterSends, uint64_t laterUs, uint64_t notBeforeUs)
+{
+    pthread_mutex_lock(&m_Lock);
+
+    if ((m_ThreadPid != getpid()) && (startThread() < 0))
+    {
+        pthread_mutex_unlock(&m_Lock);
+        exit(1);
+    }
+
+    uint64_t now = nowUs();
+    Packet* pkt = makePacket(s, buf, len, flags, to, tolen);
+    pkt->holdSends = laterSends;
+    pkt->holdUntilUs = now + ((laterUs > 0) ? laterUs : (uint64_t)LINK_HOLD_MAX_MS * 1000);
+    pkt->holdFloorUs = now + notBeforeUs;
+
+    m_Held.push_back(pkt);
+    __atomic_store_n(&m_NumHeld, (uint32_t)m_Held.size(), __ATOMIC_RELAXED);
+
+    // The worker may need to wake sooner for this deadline
+    pthread_cond_signal(&m_Wake);
+    pthread_mutex_unlock(&m_Lock);
+
+    return 0;
+}
+// ============================================================================
+void LinkEmulator::packetSent(void)
+{
+    if (__atomic_load_n(&m_NumHeld, __ATOMIC_RELAXED) == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&m_Lock);
+
+    for (size_t i = 0; i < m_Held.size(); ++i)
+    {
+        if ((m_Held[i]->holdSends > 0) && (--m_Held[i]->holdSends == 0))
+        {
+            // Due now, releaseHeld() below takes it
+            m_Held[i]->holdUntilUs = 0;
+        }
+    }
+
+    releaseHeld(nowUs());
+
+    pthread_mutex_unlock(&m_Lock);
+}
+// ============================================================================
+void LinkEmulator::releaseHeld(uint64_t now)
+{
+    size_t kept = 0;
+
+    // In hold order, so packets released together keep their order
+    for (size_t i = 0; i < m_Held.size(); ++i)
+    {
+        if ((m_Held[i]->holdUntilUs <= now) && (m_Held[i]->holdFloorUs <= now))
+        {
+            m_Held[i]->order = m_Order++;
+            schedule(m_Held[i], now);
+        }
+        else
+        {
+            m_Held[kept++] = m_Held[i];
+        }
+    }
+
+    m_Held.resize(kept);
+    __atomic_store_n(&m_NumHeld, (uint32_t)m_Held.size(), __ATOMIC_RELAXED);
+}
+// ============================================================================
+int LinkEmulator::startThread(void)
+{
+    int nResult = pthread_create(&m_Thread, NULL, threadMain, this);
+    if (nResult != 0)
+    {
+        ERR_PRINT("pthread_create: %s\n", strerror(nResult));
+        return -1;
+    }
+
+    m_ThreadPid = getpid();
+
+    return 0;
+}
+// ============================================================================
+void* LinkEmulator::threadMain(void* arg)
+{
+    ((LinkEmulator*)arg)->run();
+
+    return NULL;
+}
+// ============================================================================
+void LinkEmulator::run(void)
+{
+    pthread_mutex_lock(&m_Lock);
+
+    while (true)
+    {
+        uint64_t now = nowUs();
+        uint64_t wakeUs = UINT64_MAX;
+
+        releaseHeld(now);
+
+        for (size_t i = 0; i < m_Held.size(); ++i)
+        {
+            uint64_t dueUs = (m_Held[i]->holdUntilUs > m_Held[i]->holdFloorUs)
+                             ? m_Held[i]->holdUntilUs : m_Held[i]->holdFloorUs;
+            wakeUs = (dueUs < wakeUs) ? dueUs : wakeUs;
+        }
+
+        if (m_Queue.empty() && m_Held.empty())
+        {
+            if (m_Stopping)
+            {
+                break;
+            }
+
+            pthread_cond_wait(&m_Wake, &m_Lock);
+            continue;
+        }
+
+        Packet* pkt = m_Queue.empty() ? NULL : m_Queue.top();
+
+        if ((pkt == NULL) || (pkt->releaseUs > now))
+        {
+            if ((pkt != NULL) && (pkt->releaseUs < wakeUs))
+            {
+                wakeUs = pkt->releaseUs;
+            }
+
+            struct timespec until;
+            until.tv_sec = wakeUs / 1000000;
+            until.tv_nsec = (wakeUs % 1000000) * 1000;
+
+            // Woken early when a packet due sooner is queued or held
+            pthread_cond_timedwait(&m_Wake, &m_Lock, &until);
+            continue;
+        }
+
+        m_Queue.pop();
+
+        pthread_mutex_unlock(&m_Lock);
+        deliver(pkt);
+        pthread_mutex_lock(&m_Lock);
+    }
+
+    pthread_mutex_unlock(&m_Lock);
+}
+// ============================================================================
+void LinkEmulator::deliver(Packet* pkt)
+{
+    // Like the wire, nobody hears about a failure this late
+    if (pkt->toLen > 0)
+    {
+        REAL(sendto)(pkt->socket, pkt->data.data(), pkt->data.size(), pkt->flags,
+               (struct sockaddr*)&pkt->to, pkt->toLen);
+    }
+    else
+    {
+        REAL(send)(pkt->socket, pkt->data.data(), pkt->data.size(), pkt->flags);
+    }
+
+    delete pkt;
+}
+// ============================================================================
+void LinkEmulator::forkPrepare(void)
+{
+    // Keeps the worker from forking us a half-updated queue
+    if (s_pLink != NULL)
+    {
+        pthread_mutex_lock(&s_pLink->m_Lock);
+    }
+}
+// ============================================================================
+void LinkEmulator::forkParent(void)
+{
+    if (s_pLink != NULL)
+    {
+        pthread_mutex_unlock(&s_pLink->m_Lock);
+    }
+}
+// ============================================================================
+void LinkEmulator::forkChild(void)
+{
+    if (s_pLink == NULL)
+    {
+        return;
+    }
+
+    // The parent's worker did not come along, and its packets are its own to send
+    s_pLink->initSync();
+
+    while (!s_pLink->m_Queue.empty())
+    {
+        delete s_pLink->m_Queue.top();
+        s_pLink->m_Queue.pop();
+    }
+
+    for (size_t i = 0; i < s_pLink->m_Held.size(); ++i)
+    {
+        delete s_pLink->m_Held[i];
+    }
+    s_pLink->m_Held.clear();
+    s_pLink->m_NumHeld = 0;
+
+    s_pLink->m_Departures.clear();
+    s_pLink->m_LinkFreeUs = 0;
+    s_pLink->m_ThreadPid = 0;
+    s_pLink->m_Stopping = false;
+}
+// ============================================================================
+// ============================================================================
@@ -0,0 +1,141 @@
+/**
+ * LinkEmulator - Holds sent packets and releases them like a real link would
+ *
+ * A packet that survives the MsgEvents first waits its turn at a bottleneck of
+ * the configured rate (queue bounded in packets, tail-drop when full), then
+ * spends the propagation delay plus a random jitter on the wire. Packets wait
+ * in a queue ordered by release time, so jitter larger than the gap between
+ * two packets reorders them. A worker thread does the real send(to) when a
+ * packet is due.
+ *
+ * A packet can also be held back before it enters the link (errorDelay), until
+ * a number of later packets were sent or a time passed, whichever comes first.
+ *
+ * Off (packets go out immediately) until a delay, jitter or rate is set or a
+ * packet is held. Each process gets its own worker, a forked child starts with
+ * an empty queue.
+ */
+
+#ifndef __LINKEMULATOR_H
+#define __LINKEMULATOR_H
+
+// ============================================================================
+#include <stdint.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <deque>
+#include <queue>
+#include <vector>
+// ============================================================================
+#define LINK_QUEUE_DEFAULT 100
+// A packet held for later sends alone goes out after this long regardless
+#define LINK_HOLD_MAX_MS 1000
+// ============================================================================
+class LinkEmulator
+{
+  public:
+    LinkEmulator();
+    ~LinkEmulator();
+
+    int setDelay(long delayMs);
+    int setJitter(long jitterMs);
+    int setRate(long rateKbps);
+    int setQueueLimit(long packets);
+
+    bool isEnabled(void);
+
+    /**
+     * Queues a packet for a delayed send (to == NULL for send()).
+     *
+     * Return Values:
+     *    0  Queued
+     *    2  Dropped at the bottleneck queue
+     */
+    int enqueue(int s, const void* buf, size_t len, int flags,
+                const struct sockaddr* to, socklen_t tolen);
+
+    /**
+     * Holds a packet back until laterSends more packets were sent or laterUs
+     * passed (0 for either leaves it to the other), then it enters the link.
+     * Either way it stays at least notBeforeUs.
+     */
+    int hold(int s, const void* buf, size_t len, int flags,
+             const struct sockaddr* to, socklen_t tolen,
+             uint32_t laterSends, uint64_t laterUs, uint64_t notBeforeUs = 0);
+
+    // Counts a packet sent (or dropped) by the program against the held ones
+    void packetSent(void);
+
+  private:
+    struct Packet
+    {
+        uint64_t releaseUs;
+        uint64_t order;
+        int      socket;
+        int      flags;
+        socklen_t toLen;
+        struct sockaddr_storage to;
+        std::vector<uint8_t> data;
+
+        // Only while held
+        uint32_t holdSends;
+        uint64_t holdUntilUs;
+        uint64_t holdFloorUs;
+    };
+
+    struct LaterRelease
+    {
+        bool operator()(const Packet* a, const Packet* b) const
+        {
+            if (a->releaseUs != b->releaseUs)
+            {
+                return a->releaseUs > b->releaseUs;
+            }
+            return a->order > b->order;
+        }
+    };
+
+    typedef std::priority_queue<Packet*, std::vector<Packet*>, LaterRelease> PacketQueue_t;
+
+    uint64_t m_DelayUs;
+    uint64_t m_JitterUs;
+    uint64_t m_RateBps;
+    size_t   m_QueueLimit;
+
+    // Bottleneck state, departures of the packets still waiting on it
+    uint64_t m_LinkFreeUs;
+    std::deque<uint64_t> m_Departures;
+
+    PacketQueue_t   m_Queue;
+    uint64_t        m_Order;
+
+    std::vector<Packet*> m_Held;
+    // Read without the lock so sends skip it when nothing is held
+    uint32_t        m_NumHeld;
+
+    pthread_mutex_t m_Lock;
+    pthread_cond_t  m_Wake;
+    pthread_t       m_Thread;
+    pid_t           m_ThreadPid;
+    bool            m_Stopping;
+
+    static uint64_t nowUs(void);
+    static void* threadMain(void* arg);
+    static void forkPrepare(void);
+    static void forkParent(void);
+    static void forkChild(void);
+
+    int startThread(void);
+    Packet* makePacket(int s, const void* buf, size_t len, int flags,
+                       const struct sockaddr* to, socklen_t tolen);
+    int schedule(Packet* pkt, uint64_t now);
+    void releaseHeld(uint64_t now);
+    void run(void);
+    void deliver(Packet* pkt);
+    void initSync(void);
+};
+
+#endif
@@ -3,6 +3,10 @@
  *
  * Within the interface, there are three functions:
  *   run     - takes in a buffer and can modify it. (<0 Err, 0 No-Chg, >0 Chg)
+ *   runSend - run for a packet sent on a socket (defaults to run)
+ *   isReadOnly - true if run never writes to the buffer (defaults to false)
+ *   getDelay - how long to hold a packet back, for events whose run returns 4
+ *   cancelSend - a later event dropped the packet runSend just passed
  *   report  - provides a summary of the events
  *   getName - returns a string of the object name
  */
@@ -36,9 +40,33 @@ class IMsgEvent
      *    0  No change
      *    1  Change
      *    2  Drop Completely
+     *    3  Duplicate (send twice)
+     *    4  Delay (see getDelay)
      */
     virtual int run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend = true) = 0;
 
+    // What PacketManager calls on a send, events with per-socket state override it
+    virtual int runSend(int s, void** pBuf, size_t* pLen, uint32_t msgNo)
+    {
+        return run(pBuf, pLen, msgNo, true);
+    }
+
+    // PacketManager only copies the caller's buffer ahead of events that write to it
+    virtual bool isReadOnly(void) { return false; }
+
+    /**
+     * Later packets (or us, whichever comes first) a delayed packet waits for.
+     * Only events that delay need to override it.
+     */
+    virtual int getDelay(uint32_t* pPackets, uint64_t* pUs) { return -1; }
+
+    /**
+     * Called on the same thread, right after runSend, when a later event
+     * dropped the packet. Events that charge a packet for something (tokens,
+     * a queue slot) give it back here.
+     */
+    virtual void cancelSend(int s) {}
+
     virtual int report(void) = 0;
 
     virtual const char* getName(void) = 0;
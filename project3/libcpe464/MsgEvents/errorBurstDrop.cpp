@@ -0,0 +1,101 @@
+// ============================================================================
+#include "errorBurstDrop.h"
+#include "../RandStream.h"
+
+#include <stdio.h>
+#include <arpa/inet.h>
+// ============================================================================
+static const char * __classname = "errorBurstDrop";
+// ============================================================================
+errorBurstDrop::errorBurstDrop(float pGoodToBad, float pBadToGood,
+                               float lossBad, float lossGood) :
+    m_GoodToBad(pGoodToBad), m_BadToGood(pBadToGood),
+    m_LossBad(lossBad), m_LossGood(lossGood),
+    m_Msgs(0), m_Drops(0), m_Bursts(0), m_LongestBurst(0)
+{
+    pthread_mutex_init(&m_Lock, NULL);
+}
+// ============================================================================
+errorBurstDrop::~errorBurstDrop()
+{
+    this->report();
+
+    pthread_mutex_destroy(&m_Lock);
+}
+// ============================================================================
+int errorBurstDrop::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
+{
+    // No socket to go by, everything shares one link
+    return runSend(-1, pBuf, pLen, msgNo);
+}
+// ============================================================================
+int errorBurstDrop::runSend(int s, void** pBuf, size_t* pLen, uint32_t msgNo)
+{
+    if ((pBuf == NULL) || (*pBuf == NULL))
+    {
+        ERR_PRINT("NULL Pointer\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&m_Lock);
+
+    // A new socket starts out Good
+    Link& link = m_Links[s];
+
+    ++m_Msgs;
+
+    bool toDrop = (RandStream::next() < (link.isBad ? m_LossBad : m_LossGood));
+
+    // Move to the state the next packet sees
+    if (link.isBad)
+    {
+        link.isBad = (RandStream::next() >= m_BadToGood);
+    }
+    else
+    {
+        link.isBad = (RandStream::next() < m_GoodToBad);
+    }
+
+    if (!toDrop)
+    {
+        link.lastDropped = false;
+
+        pthread_mutex_unlock(&m_Lock);
+        return 0;
+    }
+
+    // Consecutive drops make one burst
+    link.currentBurst = link.lastDropped ? link.currentBurst + 1 : 1;
+    m_Bursts += link.lastDropped ? 0 : 1;
+    m_LongestBurst = (link.currentBurst > m_LongestBurst) ? link.currentBurst : m_LongestBurst;
+    link.lastDropped = true;
+
+    ++m_Drops;
+
+    pthread_mutex_unlock(&m_Lock);
+
+    MSG_PRINT(" - BURST DROPPED ")
+
+    return 2;
+}
+// ============================================================================
+int errorBurstDrop::report(void)
+{
+    fprintf(stderr, "======== Burst Loss Report ========\n");
+    fprintf(stderr, "  Model (p, r, h, k) : %.3f %.3f %.3f %.3f\n",
+            m_GoodToBad, m_BadToGood, m_LossBad, m_LossGood);
+    fprintf(stderr, "  Msgs (Total)       : %5u\n", m_Msgs);
+    fprintf(stderr, "  Msgs (Dropped)     : %5u\n", m_Drops);
+    fprintf(stderr, "  Bursts             : %5u (mean %.2f, longest %u)\n", m_Bursts,
+            (m_Bursts > 0) ? (double)m_Drops / m_Bursts : 0.0, m_LongestBurst);
+    fprintf(stderr, "===================================\n");
+
+    return 0;
+}
+// ============================================================================
+const char* errorBurstDrop::getName(void)
+{
+    return __classname;
+}
+// ============================================================================
+// ============================================================================
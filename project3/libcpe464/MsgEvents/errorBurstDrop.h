@@ -0,0 +1,75 @@
+/**
+ * errorBurstDrop - Drops packets in bursts (Gilbert-Elliott loss model)
+ *
+ * The link is either Good or Bad. Each packet is lost with the loss
+ * probability of the current state, then the state may change: Good to Bad
+ * with probability p, Bad to Good with probability r. With h = 1 the mean burst
+ * is 1/r packets, and the long-run share of time spent Bad is p/(p+r).
+ *
+ * Every socket is a link of its own, in its own state.
+ *
+ * Runs on every packet (a "Standard" event), independent of the error rate.
+ * Upon destruction, this class will call its own report function.
+ */
+
+#ifndef __MSGERROR_BURSTDROP_H
+#define __MSGERROR_BURSTDROP_H
+
+// ============================================================================
+#include "IMsgEvent.h"
+
+#include <stdint.h>
+#include <pthread.h>
+#include <map>
+// ============================================================================
+class errorBurstDrop : public IMsgEvent
+{
+	public:
+    errorBurstDrop(float pGoodToBad, float pBadToGood,
+                   float lossBad = 1.0f, float lossGood = 0.0f);
+    virtual ~errorBurstDrop();
+
+    /**
+     * Function to be called when running the event case.
+     *
+     * Return Values:
+     *   <0  Error
+     *    0  No change
+     *    2  Drop Completely
+     */
+    virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend);
+
+    virtual int runSend(int s, void** pBuf, size_t* pLen, uint32_t msgNo);
+
+    virtual bool isReadOnly(void) { return true; }
+
+    virtual int report(void);
+
+    virtual const char* getName(void);
+
+  private:
+    struct Link
+    {
+        bool     isBad;
+        bool     lastDropped;
+        uint32_t currentBurst;
+    };
+
+    float    m_GoodToBad;
+    float    m_BadToGood;
+    float    m_LossBad;
+    float    m_LossGood;
+
+    std::map<int, Link> m_Links;
+
+    // Totals over all sockets
+    uint32_t m_Msgs;
+    uint32_t m_Drops;
+    uint32_t m_Bursts;
+    uint32_t m_LongestBurst;
+
+    pthread_mutex_t m_Lock;
+};
+// ============================================================================
+
+#endif
@@ -0,0 +1,44 @@
+// ============================================================================
+#include "errorDelay.h"
+
+#include <stdio.h>
+// ============================================================================
+static const char * __classname = "errorDelay";
+// ============================================================================
+errorDelay::errorDelay(uint32_t packets, uint32_t ms) :
+    m_Packets(packets), m_Ms(ms)
+{
+}
+// ============================================================================
+int errorDelay::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
+{
+    if ((pBuf == NULL) || (*pBuf == NULL))
+    {
+        ERR_PRINT("NULL Pointer\n");
+        return -1;
+    }
+
+    MSG_PRINT(" - DELAYED ")
+
+    return 4;
+}
+// ============================================================================
+int errorDelay::getDelay(uint32_t* pPackets, uint64_t* pUs)
+{
+    *pPackets = m_Packets;
+    *pUs = (uint64_t)m_Ms * 1000;
+
+    return 0;
+}
+// ============================================================================
+int errorDelay::report(void)
+{
+    return 0;
+}
+// ============================================================================
+const char* errorDelay::getName(void)
+{
+    return __classname;
+}
+// ============================================================================
+// ============================================================================
@@ -0,0 +1,45 @@
+/**
+ * errorDelay - Holds packets back so later ones overtake them
+ *
+ * A delayed packet goes out after the given number of later packets were sent
+ * or the given time passed, whichever comes first (0 leaves it to the other).
+ * The LinkEmulator does the holding.
+ */
+
+#ifndef __MSGERROR_DELAY_H
+#define __MSGERROR_DELAY_H
+
+// ============================================================================
+#include "IMsgEvent.h"
+
+#include <stdint.h>
+// ============================================================================
+class errorDelay : public IMsgEvent
+{
+	public:
+    errorDelay(uint32_t packets, uint32_t ms);
+    virtual ~errorDelay() {};
+
+    /**
+     * Function to be called when running the event case.
+     *
+     * Return Values:
+     *   <0  Error
+     *    4  Delay
+     */
+    virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend);
+
+    virtual int getDelay(uint32_t* pPackets, uint64_t* pUs);
+
+    virtual bool isReadOnly(void) { return true; }
+
+    virtual int report(void);
+
+    virtual const char* getName(void);
+
+  private:
+    uint32_t m_Packets;
+    uint32_t m_Ms;
+};
+
+#endif
@@ -42,6 +42,8 @@ class errorDrop : public IMsgEvent
      */
     virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend);
 
+    virtual bool isReadOnly(void) { return true; }
+
     virtual int report(void);
 
     virtual const char* getName(void);
@@ -0,0 +1,64 @@
+// ============================================================================
+#include "errorDuplicate.h"
+
+#include <stdio.h>
+// ============================================================================
+static const char * __classname = "errorDuplicate";
+// ============================================================================
+errorDuplicate::errorDuplicate() :
+    m_DupAll(true)
+{
+}
+// ============================================================================
+int errorDuplicate::setDupSpecific(DupList_t& dupList)
+{
+    m_DupAll = false;
+    m_DupList = dupList;
+
+    return 0;
+}
+// ============================================================================
+int errorDuplicate::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
+{
+    if ((pBuf == NULL) || (*pBuf == NULL))
+    {
+        ERR_PRINT("NULL Pointer\n");
+        return -1;
+    }
+
+    bool toDup = m_DupAll;
+
+    DupList_t::iterator it = m_DupList.begin();
+    while (it != m_DupList.end())
+    {
+        if (*it == msgNo)
+        {
+            toDup = true;
+            break;
+        }
+        ++it;
+    }
+
+    if (toDup)
+    {
+        MSG_PRINT(" - DUPLICATED ")
+
+        return 3;
+    }
+    else
+    {
+        return 0;
+    }
+}
+// ============================================================================
+int errorDuplicate::report(void)
+{
+    return 0;
+}
+// ============================================================================
+const char* errorDuplicate::getName(void)
+{
+    return __classname;
+}
+// ============================================================================
+// ============================================================================
@@ -0,0 +1,48 @@
+/**
+ * errorDuplicate - Sends specific (or all) packets passed in twice
+ *
+ * Like errorDrop, a DupAll instance serves the random cases and a dup list
+ * duplicates a specific sequence of messages using the standard list.
+ */
+
+#ifndef __MSGERROR_DUPLICATE_H
+#define __MSGERROR_DUPLICATE_H
+
+// ============================================================================
+#include "IMsgEvent.h"
+
+#include <stdint.h>
+#include <list>
+// ============================================================================
+class errorDuplicate : public IMsgEvent
+{
+	public:
+    typedef std::list<uint32_t> DupList_t;
+
+    errorDuplicate();
+    virtual ~errorDuplicate() {};
+
+    int setDupSpecific(DupList_t& dupList);
+
+    /**
+     * Function to be called when running the event case.
+     *
+     * Return Values:
+     *   <0  Error
+     *    0  No change
+     *    3  Duplicate
+     */
+    virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend);
+
+    virtual bool isReadOnly(void) { return true; }
+
+    virtual int report(void);
+
+    virtual const char* getName(void);
+
+  private:
+    bool      m_DupAll;
+    DupList_t m_DupList;
+};
+
+#endif
@@ -1,5 +1,6 @@
 // ============================================================================
 #include "errorFlipBits.h"
+#include "../RandStream.h"
 
 #include <stdio.h>
 #include <arpa/inet.h>
@@ -19,7 +20,7 @@ int errorFlipBits::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
     MSG_PRINT(" - FLIPPED BITS ");
     
     double d_len = *pLen;
-    int byte_to_flip = (int)(d_len * drand48());
+    int byte_to_flip = (int)(d_len * RandStream::next());
 
     ((uint8_t*)*pBuf)[byte_to_flip] ^= 0xFF;
 
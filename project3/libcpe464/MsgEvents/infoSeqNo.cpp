@@ -2,18 +2,30 @@
 #include "infoSeqNo.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <arpa/inet.h>
 // ============================================================================
 static const char * __classname = "infoSeqNo";
 // ============================================================================
 infoSeqNo::infoSeqNo() :
-    m_ValidEndian(true)
+    m_ValidEndian(true), m_Total(0), m_Unique(0)
 {
+    m_Seen = (uint64_t*)calloc(INFO_SEQNO_DENSE_MAX / 64, sizeof(uint64_t));
+    if (m_Seen == NULL)
+    {
+        perror("calloc");
+        exit(1);
+    }
+
+    pthread_mutex_init(&m_SparseLock, NULL);
 }
 // ============================================================================
 infoSeqNo::~infoSeqNo()
 {
     this->report();
+
+    free(m_Seen);
+    pthread_mutex_destroy(&m_SparseLock);
 }
 // ============================================================================
 int infoSeqNo::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
@@ -30,9 +42,28 @@ int infoSeqNo::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
     
     //MSG_PRINT("MSG# %u SEQ# %u\n", msgNo, seqNo); 
 
-    m_History.push_back(seqNo);
+    __atomic_add_fetch(&m_Total, 1, __ATOMIC_RELAXED);
+
+    if (seqNo >= INFO_SEQNO_DENSE_MAX)
+    {
+        pthread_mutex_lock(&m_SparseLock);
+        bool isNew = m_SeenSparse.insert(seqNo).second;
+        pthread_mutex_unlock(&m_SparseLock);
 
-    ++m_Count[seqNo];
+        if (isNew)
+        {
+            __atomic_add_fetch(&m_Unique, 1, __ATOMIC_RELAXED);
+        }
+        return 0;
+    }
+
+    uint64_t bit = (uint64_t)1 << (seqNo % 64);
+
+    // Whoever sets the bit first counts it
+    if ((__atomic_fetch_or(&m_Seen[seqNo / 64], bit, __ATOMIC_RELAXED) & bit) == 0)
+    {
+        __atomic_add_fetch(&m_Unique, 1, __ATOMIC_RELAXED);
+    }
 
     return 0;
 }
@@ -40,8 +71,8 @@ int infoSeqNo::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
 int infoSeqNo::report(void)
 {
     fprintf(stderr, "======== SeqNo Report ========\n");
-    fprintf(stderr, "  Msgs (Total)       : %5lu\n", m_History.size());
-    fprintf(stderr, "  Msgs (Unique SeqNo): %5lu\n", m_Count.size());
+    fprintf(stderr, "  Msgs (Total)       : %5lu\n", (unsigned long)m_Total);
+    fprintf(stderr, "  Msgs (Unique SeqNo): %5u\n", m_Unique);
     fprintf(stderr, "==============================\n");
 
     return 0;
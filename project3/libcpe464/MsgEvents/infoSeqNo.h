@@ -5,6 +5,11 @@
  * the sequence numbers (which are assumed to be in the first 4-bytes of each
  * packet in network order.)
  *
+ * Sequence numbers are dense, so a bitmap tracks which were seen, and only the
+ * odd corrupted one far beyond it goes into a set. The bitmap is allocated
+ * zeroed up front (the OS only backs the pages touched) and updated atomically,
+ * so sends from several threads need no lock.
+ *
  * Upon destruction, this class will call it's own report function in order.
  *
  * TODO: Report better details about the history instead of unique + count
@@ -16,15 +21,15 @@
 // ============================================================================
 #include "IMsgEvent.h"
 
-#include <vector>
-#include <map>
+#include <pthread.h>
+#include <set>
+// ============================================================================
+// Seen-bitmap size, 16M sequence numbers in 2MB
+#define INFO_SEQNO_DENSE_MAX (1u << 24)
 // ============================================================================
 class infoSeqNo : public IMsgEvent
 {
 	public:
-    typedef std::map<uint32_t, uint32_t> No2Count_t;
-    typedef std::vector<uint32_t> NoJournal_t;
-
     infoSeqNo();
 		virtual ~infoSeqNo();
 
@@ -43,6 +48,8 @@ class infoSeqNo : public IMsgEvent
      */
     virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend);
 
+    virtual bool isReadOnly(void) { return true; }
+
     virtual int report(void);
 
     virtual const char* getName(void);
@@ -50,8 +57,12 @@ class infoSeqNo : public IMsgEvent
   private:
     bool        m_ValidEndian;
 
-    No2Count_t  m_Count;
-    NoJournal_t m_History;
+    uint64_t    m_Total;
+    uint32_t    m_Unique;
+
+    uint64_t*          m_Seen;
+    std::set<uint32_t> m_SeenSparse;
+    pthread_mutex_t    m_SparseLock;
 };
 // ============================================================================
 
@@ -0,0 +1,210 @@
+// ============================================================================
+#include "rateTokenBucket.h"
+
+#include <stdio.h>
+#include <time.h>
+// ============================================================================
+static const char * __classname = "rateTokenBucket";
+
+// Read back by getDelay() and cancelSend() on the thread that just ran the packet
+static thread_local uint64_t t_LastDelayUs = 0;
+static thread_local uint64_t t_LastDepartureUs = 0;
+static thread_local size_t   t_LastCharged = 0;
+// ============================================================================
+rateTokenBucket::rateTokenBucket(uint32_t rateKbps, uint32_t burstBytes, uint32_t queuePackets) :
+    m_RateBytesPerUs((double)rateKbps * 1000 / 8 / 1000000), m_Burst(burstBytes),
+    m_QueueLimit(queuePackets)
+{
+    pthread_mutex_init(&m_Lock, NULL);
+}
+// ============================================================================
+rateTokenBucket::~rateTokenBucket()
+{
+    this->report();
+
+    pthread_mutex_destroy(&m_Lock);
+}
+// ============================================================================
+uint64_t rateTokenBucket::nowUs(void)
+{
+    struct timespec ts;
+
+    // Same clock the LinkEmulator releases held packets on
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+// ============================================================================
+int rateTokenBucket::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
+{
+    // No socket to go by, everything shares one bucket
+    return runSend(-1, pBuf, pLen, msgNo);
+}
+// ============================================================================
+int rateTokenBucket::runSend(int s, void** pBuf, size_t* pLen, uint32_t msgNo)
+{
+    if ((pBuf == NULL) || (*pBuf == NULL) || (pLen == NULL))
+    {
+        ERR_PRINT("NULL Pointer\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&m_Lock);
+
+    int nResult = admit(s, *pLen);
+
+    pthread_mutex_unlock(&m_Lock);
+
+    if (nResult == 2)
+    {
+        MSG_PRINT(" - TOKEN BUCKET DROPPED ")
+    }
+    else if (nResult == 4)
+    {
+        MSG_PRINT(" - TOKEN BUCKET QUEUED %lu us ", (unsigned long)t_LastDelayUs)
+    }
+
+    return nResult;
+}
+// ============================================================================
+int rateTokenBucket::admit(int s, size_t len)
+{
+    uint64_t now = nowUs();
+    bool isNew = (m_Buckets.find(s) == m_Buckets.end());
+    Bucket& bucket = m_Buckets[s];
+
+    if (isNew)
+    {
+        // A new socket starts with a full bucket
+        bucket.tokens = m_Burst;
+        bucket.lastUs = now;
+        bucket.msgs = bucket.queued = bucket.dropped = 0;
+        bucket.delaySumUs = bucket.delayMaxUs = 0;
+    }
+
+    ++bucket.msgs;
+    t_LastCharged = 0;
+    t_LastDelayUs = 0;
+
+    bucket.tokens += (double)(now - bucket.lastUs) * m_RateBytesPerUs;
+    bucket.tokens = (bucket.tokens > m_Burst) ? m_Burst : bucket.tokens;
+    bucket.lastUs = now;
+
+    while (!bucket.departures.empty() && (bucket.departures.front() <= now))
+    {
+        bucket.departures.pop_front();
+    }
+
+    if (bucket.tokens >= (double)len)
+    {
+        bucket.tokens -= len;
+        t_LastCharged = len;
+        return 0;
+    }
+
+    if (bucket.departures.size() >= m_QueueLimit)
+    {
+        ++bucket.dropped;
+        return 2;
+    }
+
+    // Leaves once the bucket has refilled what everything ahead of it used
+    bucket.tokens -= len;
+    t_LastCharged = len;
+
+    // Rounded up, so the tokens really are there when it leaves
+    double waitUs = -bucket.tokens / m_RateBytesPerUs;
+    t_LastDelayUs = (uint64_t)waitUs;
+    t_LastDelayUs += ((double)t_LastDelayUs < waitUs) ? 1 : 0;
+
+    t_LastDepartureUs = now + t_LastDelayUs;
+    bucket.departures.push_back(t_LastDepartureUs);
+
+    ++bucket.queued;
+    bucket.delaySumUs += t_LastDelayUs;
+    bucket.delayMaxUs = (t_LastDelayUs > bucket.delayMaxUs) ? t_LastDelayUs : bucket.delayMaxUs;
+
+    return 4;
+}
+// ============================================================================
+int rateTokenBucket::getDelay(uint32_t* pPackets, uint64_t* pUs)
+{
+    *pPackets = 0;
+    *pUs = t_LastDelayUs;
+
+    return 0;
+}
+// ============================================================================
+void rateTokenBucket::cancelSend(int s)
+{
+    if (t_LastCharged == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&m_Lock);
+
+    std::map<int, Bucket>::iterator it = m_Buckets.find(s);
+    if (it != m_Buckets.end())
+    {
+        Bucket& bucket = it->second;
+
+        bucket.tokens += t_LastCharged;
+        bucket.tokens = (bucket.tokens > m_Burst) ? m_Burst : bucket.tokens;
+
+        // Never went out, so it isn't one of the report's messages either
+        --bucket.msgs;
+
+        if (t_LastDelayUs > 0)
+        {
+            // Other threads may have queued behind it since, find its own slot
+            for (std::deque<uint64_t>::iterator dep = bucket.departures.begin();
+                 dep != bucket.departures.end(); ++dep)
+            {
+                if (*dep == t_LastDepartureUs)
+                {
+                    bucket.departures.erase(dep);
+                    break;
+                }
+            }
+
+            --bucket.queued;
+            bucket.delaySumUs -= t_LastDelayUs;
+        }
+    }
+
+    pthread_mutex_unlock(&m_Lock);
+
+    t_LastCharged = 0;
+}
+// ============================================================================
+int rateTokenBucket::report(void)
+{
+    fprintf(stderr, "======== Token Bucket Report ========\n");
+    fprintf(stderr, "  Rate, Burst, Queue  : %.0f kbit/s %.0f bytes %lu pkts\n",
+            m_RateBytesPerUs * 8 * 1000, m_Burst, (unsigned long)m_QueueLimit);
+
+    for (std::map<int, Bucket>::iterator it = m_Buckets.begin(); it != m_Buckets.end(); ++it)
+    {
+        Bucket& bucket = it->second;
+
+        fprintf(stderr, "  Socket %d\n", it->first);
+        fprintf(stderr, "    Msgs (Total)      : %5u\n", bucket.msgs);
+        fprintf(stderr, "    Msgs (Queued)     : %5u\n", bucket.queued);
+        fprintf(stderr, "    Msgs (Dropped)    : %5u\n", bucket.dropped);
+        fprintf(stderr, "    Queue Delay (us)  : mean %.1f max %lu\n",
+                (bucket.queued > 0) ? (double)bucket.delaySumUs / bucket.queued : 0.0,
+                (unsigned long)bucket.delayMaxUs);
+    }
+
+    fprintf(stderr, "=====================================\n");
+
+    return 0;
+}
+// ============================================================================
+const char* rateTokenBucket::getName(void)
+{
+    return __classname;
+}
+// ============================================================================
+// ============================================================================
@@ -0,0 +1,84 @@
+/**
+ * rateTokenBucket - Limits each socket's send rate with a token bucket
+ *
+ * Tokens (bytes) fill at the configured rate up to the burst size. A packet
+ * with enough tokens goes out immediately, otherwise it waits in a FIFO until
+ * its tokens accumulate. Once the queue holds its limit in packets, further
+ * packets over the rate are dropped. Every socket has its own bucket.
+ *
+ * Runs on every packet (a "Standard" event), the waiting is done by holding
+ * the packet in the LinkEmulator. Upon destruction, this class will call its
+ * own report function.
+ */
+
+#ifndef __MSGRATE_TOKENBUCKET_H
+#define __MSGRATE_TOKENBUCKET_H
+
+// ============================================================================
+#include "IMsgEvent.h"
+
+#include <stdint.h>
+#include <pthread.h>
+#include <deque>
+#include <map>
+// ============================================================================
+class rateTokenBucket : public IMsgEvent
+{
+	public:
+    rateTokenBucket(uint32_t rateKbps, uint32_t burstBytes, uint32_t queuePackets);
+    virtual ~rateTokenBucket();
+
+    /**
+     * Function to be called when running the event case.
+     *
+     * Return Values:
+     *   <0  Error
+     *    0  Within the rate, no change
+     *    2  Drop Completely (queue full)
+     *    4  Delay (see getDelay)
+     */
+    virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend);
+
+    virtual int runSend(int s, void** pBuf, size_t* pLen, uint32_t msgNo);
+
+    virtual int getDelay(uint32_t* pPackets, uint64_t* pUs);
+
+    // Gives back the tokens (and queue slot) of a packet a later event dropped
+    virtual void cancelSend(int s);
+
+    virtual bool isReadOnly(void) { return true; }
+
+    virtual int report(void);
+
+    virtual const char* getName(void);
+
+  private:
+    struct Bucket
+    {
+        // Negative while packets wait, the debt the queue still has to pay
+        double   tokens;
+        uint64_t lastUs;
+        std::deque<uint64_t> departures;
+
+        uint32_t msgs;
+        uint32_t queued;
+        uint32_t dropped;
+        uint64_t delaySumUs;
+        uint64_t delayMaxUs;
+    };
+
+    double   m_RateBytesPerUs;
+    double   m_Burst;
+    size_t   m_QueueLimit;
+
+    std::map<int, Bucket> m_Buckets;
+    pthread_mutex_t       m_Lock;
+
+    static uint64_t nowUs(void);
+
+    // Takes the packet's tokens or queues it, m_Lock held
+    int admit(int s, size_t len);
+};
+// ============================================================================
+
+#endif
@@ -1,4 +1,6 @@
 #include "PacketManager.h"
+#include "RandStream.h"
+#include "RealCalls.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -32,14 +34,30 @@ extern "C" {
 
 #include <arpa/inet.h>
 // ============================================================================
+// Copy of the packet being sent, made once an event writes to it. Per thread,
+// like the delay below, so concurrent sends can't clobber each other's
+static thread_local std::vector<uint8_t> t_Scratch;
+
+// Hold asked for by the events that delayed the packet being sent, the later
+// of them all: a release on later sends (or a time) and a time it must wait out
+static thread_local uint32_t t_DelayPackets = 0;
+static thread_local uint64_t t_DelayUs = 0;
+static thread_local uint64_t t_DelayFloorUs = 0;
+
+// Set once g_PktMgr is being torn down at exit, its members may already be gone
+static bool s_IsDestroying = false;
+// ============================================================================
 PacketManager::PacketManager() :
     m_ErrorRate(0.0f), m_MsgNo(0)
 {
     srand48(time(NULL));
+    RandStream::setSeed(time(NULL));
 }
 // ============================================================================
 PacketManager::~PacketManager()
 {
+    __atomic_store_n(&s_IsDestroying, true, __ATOMIC_RELEASE);
+
     clearMsgEvents(m_ErrorCase_Constant);
     clearMsgEvents(m_ErrorCase_Chance);
 }
@@ -62,6 +80,7 @@ int PacketManager::clearMsgEvents(listMsgEvents_t& ErrVec)
 int PacketManager::setRandSeed(long seed)
 {
     srand48(seed);
+    RandStream::setSeed(seed);
 
     return 0;
 }
@@ -73,6 +92,44 @@ int PacketManager::setErrorRate(float rate)
     return 0;
 }
 // ============================================================================
+int PacketManager::setLinkDelay(long delayMs)
+{
+    return m_Link.setDelay(delayMs);
+}
+// ============================================================================
+int PacketManager::setLinkJitter(long jitterMs)
+{
+    return m_Link.setJitter(jitterMs);
+}
+// ============================================================================
+int PacketManager::setLinkRate(long rateKbps)
+{
+    return m_Link.setRate(rateKbps);
+}
+// ============================================================================
+int PacketManager::setLinkQueue(long packets)
+{
+    return m_Link.setQueueLimit(packets);
+}
+// ============================================================================
+int PacketManager::setCapture(const char* path)
+{
+    return m_Capture.open(path);
+}
+// ============================================================================
+void PacketManager::socketChanged(int s)
+{
+    if (__atomic_load_n(&s_IsDestroying, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    if (m_Capture.isEnabled())
+    {
+        m_Capture.forget(s);
+    }
+}
+// ============================================================================
 int PacketManager::addMsgEvent_Standard(IMsgEvent* msgErr)
 {
     if (msgErr == NULL)
@@ -97,7 +154,56 @@ int PacketManager::addMsgEvent_Random(IMsgEvent* msgErr)
     return 0;
 }
 // ============================================================================
-int PacketManager::runMsgEvents(listMsgEvents_t& ErrVec, void** pBuf, size_t* pLen, uint32_t msgNo)
+int PacketManager::mergeResult(int nResult, int nNext)
+{
+    // Drop beats delay beats duplicate beats a plain change
+    static const int rank[] = {0, 1, 4, 2, 3};
+
+    if ((nNext <= 0) || (nNext > 4))
+    {
+        return nResult;
+    }
+
+    return (rank[nNext] > rank[nResult]) ? nNext : nResult;
+}
+// ============================================================================
+int PacketManager::runMsgEvent(IMsgEvent* pEvent, int s, void** pBuf, size_t* pLen, uint32_t msgNo)
+{
+    // The caller's buffer is only read, the first event writing to it gets a copy
+    if (!pEvent->isReadOnly() && (*pBuf != t_Scratch.data()))
+    {
+        t_Scratch.assign((uint8_t*)*pBuf, (uint8_t*)*pBuf + *pLen);
+        *pBuf = t_Scratch.data();
+    }
+
+    int nResult = pEvent->runSend(s, pBuf, pLen, msgNo);
+
+    if (nResult == 4)
+    {
+        uint32_t packets = 0;
+        uint64_t us = 0;
+
+        if (pEvent->getDelay(&packets, &us) < 0)
+        {
+            ERR_PRINT("ErrorCase '%s' delayed without a delay", pEvent->getName());
+            return -1;
+        }
+
+        if (packets == 0)
+        {
+            t_DelayFloorUs = (us > t_DelayFloorUs) ? us : t_DelayFloorUs;
+        }
+        else
+        {
+            t_DelayPackets = (packets > t_DelayPackets) ? packets : t_DelayPackets;
+            t_DelayUs = (us > t_DelayUs) ? us : t_DelayUs;
+        }
+    }
+
+    return nResult;
+}
+// ============================================================================
+int PacketManager::runMsgEvents(listMsgEvents_t& ErrVec, int s, void** pBuf, size_t* pLen, uint32_t msgNo)
 {
     if ((pBuf == NULL) || (*pBuf == NULL))
     {
@@ -106,30 +212,37 @@ int PacketManager::runMsgEvents(listMsgEvents_t& ErrVec, void** pBuf, size_t* pL
     }
 
     int nResult;
-    bool hasChanged = false;
+    int nMerged = 0;
 
     for (uint i = 0; i < ErrVec.size(); ++i)
     {
-        nResult = ErrVec[i]->run(pBuf, pLen, msgNo);
+        nResult = runMsgEvent(ErrVec[i], s, pBuf, pLen, msgNo);
         if (nResult < 0)
         {
             ERR_PRINT("ErrorCase Run '%s' Failed", ErrVec[i]->getName());
             return -1;
         }
-        else if (nResult == 1)
-        {
-            hasChanged = true;
-        }
         else if (nResult == 2)
         {
+            cancelMsgEvents(ErrVec, i, s);
             return 2;
         }
+
+        nMerged = mergeResult(nMerged, nResult);
     }
 
-    return hasChanged;
+    return nMerged;
 }
 // ============================================================================
-int PacketManager::processEvents(void** pBuf, size_t* pLen, uint32_t msgNo)
+void PacketManager::cancelMsgEvents(listMsgEvents_t& ErrVec, size_t count, int s)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        ErrVec[i]->cancelSend(s);
+    }
+}
+// ============================================================================
+int PacketManager::processEvents(int s, void** pBuf, size_t* pLen, uint32_t msgNo)
 {
     if ((pBuf == NULL) || (*pBuf == NULL))
     {
@@ -138,54 +251,98 @@ int PacketManager::processEvents(void** pBuf, size_t* pLen, uint32_t msgNo)
     }
 
     int nResult = 0;
-    bool hasChanged = false;
-    bool hasDropped = false;
+    int nMerged = 0;
 
-    nResult = runMsgEvents(m_ErrorCase_Constant, pBuf, pLen, msgNo);
-    if (nResult < 0)
+    t_DelayPackets = 0;
+    t_DelayUs = 0;
+    t_DelayFloorUs = 0;
+
+    nResult = runMsgEvents(m_ErrorCase_Constant, s, pBuf, pLen, msgNo);
+    if ((nResult < 0) || (nResult == 2))
     {
+        // A drop there already rolled back the events before it
         return nResult;
     }
-    else if (nResult == 2)
-    {
-        hasDropped = true;
-    }
-    else if (nResult == 1)
-    {
-        hasChanged = true;
-    }
+
+    nMerged = mergeResult(nMerged, nResult);
 
  
   // Decide (based on error rate) if we should produce an error
-  float randNum = drand48();
-  if ((m_ErrorCase_Chance.size() > 0) && (randNum <= m_ErrorRate))
+  if ((m_ErrorCase_Chance.size() > 0) && (m_ErrorRate > 0.0f) && (RandStream::next() <= m_ErrorRate))
   {
 	  // Chose which one to run
-	  int randCase = (int)((float)m_ErrorCase_Chance.size() * drand48());
-	  nResult = m_ErrorCase_Chance[randCase]->run(pBuf, pLen, msgNo);
+	  int randCase = (int)((float)m_ErrorCase_Chance.size() * RandStream::next());
+	  nResult = runMsgEvent(m_ErrorCase_Chance[randCase], s, pBuf, pLen, msgNo);
 	  if (nResult < 0)
 	  {
 		  return nResult;
 	  }
 	  else if (nResult == 2)
 	  {
-		  hasDropped = true;
-	  }
-	  else
-	  {
-		  hasChanged = nResult;
+		  // Never sent, the constant events charged for nothing
+		  cancelMsgEvents(m_ErrorCase_Constant, m_ErrorCase_Constant.size(), s);
+		  return 2;
 	  }
+
+	  nMerged = mergeResult(nMerged, nResult);
   }
 
 
-    if (hasDropped)
+    return nMerged;
+}
+// ============================================================================
+ssize_t PacketManager::transmit(int s, void* buf, size_t len, int flags,
+                                const struct sockaddr* to, socklen_t tolen)
+{
+    ssize_t lenSent;
+
+    if (m_Link.isEnabled())
+    {
+        // Queued or tail-dropped, either way it looks sent
+        m_Link.enqueue(s, buf, len, flags, to, tolen);
+        return len;
+    }
+
+    if (to != NULL)
     {
-        return 2;
+        lenSent = REAL(sendto)(s, buf, len, flags, to, tolen);
     }
     else
     {
-        return hasChanged;
+        lenSent = REAL(send)(s, buf, len, flags);
+    }
+
+    return lenSent;
+}
+// ============================================================================
+ssize_t PacketManager::deliverResult(int nResult, int s, void* buf, size_t len,
+                                     size_t origLen, int flags,
+                                     const struct sockaddr* to, socklen_t tolen)
+{
+    ssize_t lenSent = (ssize_t)len;
+
+    if ((nResult == 0) || (nResult == 1) || (nResult == 3))
+    {
+        lenSent = transmit(s, buf, len, flags, to, tolen);
+
+        if ((nResult == 3) && (lenSent == (ssize_t)len))
+        {
+            lenSent = transmit(s, buf, len, flags, to, tolen);
+        }
+    }
+
+    // Every packet the program sends (or loses) counts against the held ones
+    m_Link.packetSent();
+
+    if (nResult == 4)
+    {
+        // With nothing waiting on later sends, the time to wait out is all there is
+        uint64_t us = (t_DelayPackets > 0) ? t_DelayUs : t_DelayFloorUs;
+
+        m_Link.hold(s, buf, len, flags, to, tolen, t_DelayPackets, us, t_DelayFloorUs);
     }
+
+    return (lenSent == (ssize_t)len) ? (ssize_t)origLen : lenSent;
 }
 // ============================================================================
 ssize_t PacketManager::send_Err(int s, void *buf, size_t len, int flags)
@@ -204,44 +361,45 @@ ssize_t PacketManager::send_Err(int s, void *buf, size_t len, int flags)
         exit(1);
     }
 
-    ++m_MsgNo;
+    uint32_t msgNo = __atomic_add_fetch(&m_MsgNo, 1, __ATOMIC_RELAXED);
     
-    uint32_t seqNo = ntohl(*(uint32_t*)(buf));
-    uint8_t packetFlags = ((char *) buf)[6];
-    MSG_PRINT("MSG# %3u SEQ# %3u LEN %4u FLAG %2d ", m_MsgNo, seqNo, len, packetFlags); 
-    printType(packetFlags, (char *)buf);
+    bool isLogging = dbg_enabled(MSG_PRINT_LEVEL);
+    if (isLogging)
+    {
+        uint32_t seqNo = ntohl(*(uint32_t*)(buf));
+        uint8_t packetFlags = ((char *) buf)[6];
+        MSG_PRINT("MSG# %3u SEQ# %3u LEN %4u FLAG %2d ", msgNo, seqNo, len, packetFlags); 
+        printType(packetFlags, (char *)buf);
+    }
 	
     size_t lenTmp = len;
-    unsigned char bufTmp[len];
-    memcpy(bufTmp, buf, lenTmp);
-    void* pBuf = bufTmp;
+    void* pBuf = buf;
 
-    nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo);
+    RandStream::select(s);
+    nResult = processEvents(s, (void**)&pBuf, &lenTmp, msgNo);
     // Error Case
     if (nResult < 0)
     {
         // Do nothing. Will return nResult
     }
-    // (Non-)changed Cases
-    else if ((nResult == 0) || (nResult == 1))
+    // Sent, duplicated, held or dropped
+    else
     {
-        ssize_t lenSent = send(s, bufTmp, lenTmp, flags);
-        if (lenSent == (ssize_t)lenTmp)
-        {
-            nResult = len;
-        }
-        else
+        int nEvents = nResult;
+
+        nResult = deliverResult(nEvents, s, pBuf, lenTmp, len, flags, NULL, 0);
+
+        // After the send, a socket's first one is what binds it to a port
+        if (m_Capture.isEnabled())
         {
-            nResult = lenSent;
+            m_Capture.capture(s, true, NULL, pBuf, lenTmp, buf, nEvents);
         }
     }
-    // Drop Case
-    else
+	
+    if (isLogging)
     {
-        nResult = len;
+        MSG_PRINT("\n");
     }
-	
-    MSG_PRINT("\n");
     
     return nResult;
 }
@@ -327,19 +485,10 @@ void PacketManager::printType(int flag, char * buf)
 // ============================================================================
 ssize_t PacketManager::recv_Mod(int s, void *buf, size_t len, int flags)
 {
-    ssize_t ret = ::recv(s, buf, len, flags);
-    
-    uint32_t seqNo = ntohl(*(uint32_t*)(buf));
-    uint8_t packetFlags = ((char *) buf)[6];
-    MSG_PRINT("RECV         SEQ# %3u LEN %4u FLAGS %2d ", seqNo, ret, packetFlags);
-	printType(packetFlags, (char *) buf);
-	
-	if (in_cksum((unsigned short *) buf, ret) != 0)
-	{
-		MSG_PRINT("  - RECV Corrupted packet");
-	}
-	
-	MSG_PRINT("\n");
+    ssize_t ret = REAL(recv)(s, buf, len, flags);
+
+    received(s, buf, ret, NULL);
+
     return ret;
 }
 // ============================================================================
@@ -366,51 +515,67 @@ ssize_t PacketManager::sendto_Err(int s, void *buf, size_t len, int flags,
         exit(1);
     }
 
-    ++m_MsgNo;
+    uint32_t msgNo = __atomic_add_fetch(&m_MsgNo, 1, __ATOMIC_RELAXED);
 
-    uint32_t seqNo = ntohl(*(uint32_t*)(buf));
-    uint8_t packetFlags = ((char *) buf)[6];
-    MSG_PRINT("SEND MSG# %3u SEQ# %3u LEN %4u FLAGS %2d ", m_MsgNo, seqNo, len, packetFlags); 
- 	printType(packetFlags, (char *)buf);  
+    bool isLogging = dbg_enabled(MSG_PRINT_LEVEL);
+    if (isLogging)
+    {
+        uint32_t seqNo = ntohl(*(uint32_t*)(buf));
+        uint8_t packetFlags = ((char *) buf)[6];
+        MSG_PRINT("SEND MSG# %3u SEQ# %3u LEN %4u FLAGS %2d ", msgNo, seqNo, len, packetFlags); 
+        printType(packetFlags, (char *)buf);  
+    }
 	
     size_t lenTmp = len;
-    unsigned char bufTmp[len];
-    memcpy(bufTmp, buf, lenTmp);
-    void* pBuf = bufTmp;
+    void* pBuf = buf;
 
-    nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo);
+    RandStream::select(s);
+    nResult = processEvents(s, (void**)&pBuf, &lenTmp, msgNo);
     		
 
-	MSG_PRINT("\n");
+    if (isLogging)
+    {
+        MSG_PRINT("\n");
+    }
     if (nResult < 0)
     {
         ERR_PRINT("prcoessEvents\n");
         return nResult;
     }
-    else if ((nResult == 0) || (nResult == 1))
-    {
-        ssize_t lenSent = sendto(s, pBuf, lenTmp, flags, to, tolen);
-        if (lenSent == (ssize_t)lenTmp)
-        {
-            return len;
-        }
-        else
-        {
-            return lenSent;
-        }
-    }
-    else
+
+    ssize_t lenSent = deliverResult(nResult, s, pBuf, lenTmp, len, flags, to, tolen);
+
+    // After the send, a socket's first one is what binds it to a port
+    if (m_Capture.isEnabled())
     {
-        return len;
+        m_Capture.capture(s, true, to, pBuf, lenTmp, buf, nResult);
     }
 
-    return -1;
+    return lenSent;
 }
 // ============================================================================
 ssize_t PacketManager::recvfrom_Mod(int s, void *buf, size_t len, int flags,
                    struct sockaddr *from, socklen_t *fromlen)
 {
-    ssize_t ret = ::recvfrom(s, buf, len, flags, from, fromlen);
+    ssize_t ret = REAL(recvfrom)(s, buf, len, flags, from, fromlen);
+
+    received(s, buf, ret, from);
+
+    return ret;
+}
+// ============================================================================
+void PacketManager::received(int s, const void* buf, ssize_t ret, const struct sockaddr* from)
+{
+    if (m_Capture.isEnabled() && (ret > 0))
+    {
+        m_Capture.capture(s, false, from, buf, ret, NULL, 0);
+    }
+
+    // Only the log looks at what came in
+    if (!dbg_enabled(MSG_PRINT_LEVEL))
+    {
+        return;
+    }
 
     uint32_t seqNo = ntohl(*(uint32_t*)(buf));
     uint8_t packetFlags = ((char *) buf)[6];
@@ -424,8 +589,6 @@ ssize_t PacketManager::recvfrom_Mod(int s, void *buf, size_t len, int flags,
 	
 
 	MSG_PRINT("\n");
-
-    return ret;
 }
 // ============================================================================
 // ============================================================================
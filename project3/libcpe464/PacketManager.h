@@ -10,12 +10,29 @@
  * processed through this class. Currently MsgEvents have no affect on the
  * receive functions (however, this may be added later to provide info event
  * processing.)
+ *
+ * Nothing is copied or formatted unless it can matter: the packet is only
+ * copied ahead of an event that writes to it, and the log lines (plus the
+ * receive checksum) are skipped when the debug level hides them.
+ *
+ * With a capture file set, every send (with what the events did to it) and
+ * every receive is also written to it in pcap format.
+ *
+ * Random events draw from the sending socket's own stream (see RandStream), so
+ * with a fixed seed each socket sees the same errors however threads interleave.
+ *
+ * Packets that are sent go through the LinkEmulator, which holds them for the
+ * configured delay and bottleneck rate (immediate when none is set). Events can
+ * also have a packet sent twice, or held back until later sends or a timer
+ * release it (reordering it behind them).
  */
 
 #ifndef __PACKETMANAGER_H
 #define __PACKETMANAGER_H
 
 #include "MsgEvents/IMsgEvent.h"
+#include "LinkEmulator.h"
+#include "PcapWriter.h"
 
 #include <sys/socket.h>
 #include <vector>
@@ -31,10 +48,17 @@ class PacketManager
     int setRandSeed(long seed);
     int setErrorRate(float rate);
 
+    int setLinkDelay(long delayMs);
+    int setLinkJitter(long jitterMs);
+    int setLinkRate(long rateKbps);
+    int setLinkQueue(long packets);
+
+    int setCapture(const char* path);
+
     int addMsgEvent_Standard(IMsgEvent* errorCase);
     int addMsgEvent_Random(IMsgEvent* errorCase);
 
-    int processEvents(void** pBuf, size_t* pLen, uint32_t msgNo);
+    int processEvents(int s, void** pBuf, size_t* pLen, uint32_t msgNo);
 	
 	void printType(int flag, char * buf);
 	
@@ -48,14 +72,34 @@ class PacketManager
     ssize_t recvfrom_Mod(int s, void *buf, size_t len, int flags,
                     struct sockaddr *from, socklen_t *fromlen);
 
+    // Logs and captures a packet that came in some other way (recvmsg, ...)
+    void received(int s, const void* buf, ssize_t ret, const struct sockaddr* from);
+
+    // The socket was created, bound, connected or closed
+    void socketChanged(int s);
+
   private:
     float      m_ErrorRate;
+    // Counted atomically, sends may come from several threads
     uint32_t   m_MsgNo;
 
     listMsgEvents_t m_ErrorCase_Constant;
     listMsgEvents_t m_ErrorCase_Chance;
+
+    LinkEmulator m_Link;
+    PcapWriter   m_Capture;
   
-    int runMsgEvents(listMsgEvents_t& ErrVec, void** pBuf, size_t* pLen, uint32_t msgNo);
+    static int mergeResult(int nResult, int nNext);
+
+    int runMsgEvent(IMsgEvent* pEvent, int s, void** pBuf, size_t* pLen, uint32_t msgNo);
+    int runMsgEvents(listMsgEvents_t& ErrVec, int s, void** pBuf, size_t* pLen, uint32_t msgNo);
+    // The first count events ran on a packet a later one dropped
+    void cancelMsgEvents(listMsgEvents_t& ErrVec, size_t count, int s);
+
+    ssize_t transmit(int s, void* buf, size_t len, int flags,
+                     const struct sockaddr* to, socklen_t tolen);
+    ssize_t deliverResult(int nResult, int s, void* buf, size_t len, size_t origLen,
+                          int flags, const struct sockaddr* to, socklen_t tolen);
 
     int clearMsgEvents(listMsgEvents_t& ErrVec);
 };
@@ -0,0 +1,476 @@
+// ============================================================================
+#include "PcapWriter.h"
+#include "RealCalls.h"
+
+#include "utils/dbg_print.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+// ============================================================================
+#define PCAP_MAGIC_NS   0xa1b23c4d
+#define PCAP_LINK_ETH   1
+#define PCAP_SNAPLEN    65535
+
+#define ETH_HDR_LEN     14
+#define IPV4_HDR_LEN    20
+#define IPV6_HDR_LEN    40
+#define UDP_HDR_LEN     8
+// ============================================================================
+// The one instance lives in PacketManager, the fork handlers need to find it
+static PcapWriter* s_pWriter = NULL;
+
+// Locally administered, only there so analyzers see which way a packet went
+static const uint8_t s_LocalMac[6]  = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const uint8_t s_RemoteMac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+// ============================================================================
+struct Endpoint
+{
+    bool     isV4;
+    bool     isAny;
+    uint8_t  addr[16];
+    uint16_t port;
+};
+// ============================================================================
+static void toEndpoint(const struct sockaddr_storage* pAddr, Endpoint* pEnd)
+{
+    memset(pEnd, 0, sizeof(*pEnd));
+    pEnd->isV4 = true;
+
+    if (pAddr->ss_family == AF_INET)
+    {
+        const struct sockaddr_in* pIn = (const struct sockaddr_in*)pAddr;
+
+        memcpy(pEnd->addr, &pIn->sin_addr, 4);
+        pEnd->port = pIn->sin_port;
+        pEnd->isAny = (pIn->sin_addr.s_addr == INADDR_ANY);
+    }
+    else if (pAddr->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6* pIn6 = (const struct sockaddr_in6*)pAddr;
+
+        pEnd->isV4 = IN6_IS_ADDR_V4MAPPED(&pIn6->sin6_addr);
+        memcpy(pEnd->addr, pEnd->isV4 ? &pIn6->sin6_addr.s6_addr[12] : pIn6->sin6_addr.s6_addr,
+               pEnd->isV4 ? 4 : 16);
+        pEnd->port = pIn6->sin6_port;
+        pEnd->isAny = IN6_IS_ADDR_UNSPECIFIED(&pIn6->sin6_addr);
+    }
+    else
+    {
+        pEnd->isAny = true;
+    }
+}
+// ============================================================================
+static void toIpv6(Endpoint* pEnd)
+{
+    if (!pEnd->isV4)
+    {
+        return;
+    }
+
+    // ::ffff:a.b.c.d, or :: for an unbound one
+    uint8_t v4[4];
+    memcpy(v4, pEnd->addr, 4);
+    memset(pEnd->addr, 0, 16);
+
+    if (!pEnd->isAny)
+    {
+        pEnd->addr[10] = 0xff;
+        pEnd->addr[11] = 0xff;
+        memcpy(&pEnd->addr[12], v4, 4);
+    }
+
+    pEnd->isV4 = false;
+}
+// ============================================================================
+static uint8_t* put16(uint8_t* p, uint16_t val)
+{
+    p[0] = val >> 8;
+    p[1] = val & 0xff;
+    return p + 2;
+}
+// ============================================================================
+static uint32_t sumWords(const uint8_t* p, size_t len, uint32_t sum)
+{
+    while (len > 1)
+    {
+        sum += ((uint32_t)p[0] << 8) | p[1];
+        p += 2;
+        len -= 2;
+    }
+
+    if (len > 0)
+    {
+        sum += (uint32_t)p[0] << 8;
+    }
+
+    return sum;
+}
+// ============================================================================
+static uint16_t foldSum(uint32_t sum)
+{
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return ~sum & 0xffff;
+}
+// ============================================================================
+PcapWriter::PcapWriter() :
+    m_IsEnabled(false), m_Fd(-1), m_Used(0), m_ThreadPid(0), m_Stopping(false)
+{
+    pthread_mutex_init(&m_Lock, NULL);
+    pthread_cond_init(&m_Wake, NULL);
+
+    s_pWriter = this;
+    pthread_atfork(forkPrepare, forkParent, forkChild);
+}
+// ============================================================================
+PcapWriter::~PcapWriter()
+{
+    if (m_ThreadPid == getpid())
+    {
+        pthread_mutex_lock(&m_Lock);
+        m_Stopping = true;
+        pthread_cond_signal(&m_Wake);
+        pthread_mutex_unlock(&m_Lock);
+
+        pthread_join(m_Thread, NULL);
+    }
+
+    pthread_mutex_lock(&m_Lock);
+
+    s_pWriter = NULL;
+
+    if (m_Fd >= 0)
+    {
+        flush();
+
+        // Not through the preload's close(), it would come back for m_Lock
+        REAL(close)(m_Fd);
+        m_Fd = -1;
+    }
+
+    pthread_mutex_unlock(&m_Lock);
+    pthread_cond_destroy(&m_Wake);
+    pthread_mutex_destroy(&m_Lock);
+}
+// ============================================================================
+int PcapWriter::open(const char* path)
+{
+    if ((path == NULL) || (*path == '\0'))
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&m_Lock);
+
+    m_Path = path;
+    m_Buf.resize(PCAP_BUFFER_SIZE);
+
+    int nResult = openFile(m_Path.c_str());
+
+    m_IsEnabled = (nResult == 0);
+
+    pthread_mutex_unlock(&m_Lock);
+
+    return nResult;
+}
+// ============================================================================
+int PcapWriter::openFile(const char* path)
+{
+    m_Fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_Fd < 0)
+    {
+        ERR_PRINT("open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    uint32_t hdr32[2] = {PCAP_MAGIC_NS, 0};
+    uint16_t version[2] = {2, 4};
+    uint32_t rest[4] = {0, 0, PCAP_SNAPLEN, PCAP_LINK_ETH};
+
+    // Host order throughout, readers go by the magic
+    m_Used = 0;
+    memcpy(&m_Buf[m_Used], &hdr32[0], 4);
+    m_Used += 4;
+    memcpy(&m_Buf[m_Used], version, 4);
+    m_Used += 4;
+    memcpy(&m_Buf[m_Used], rest, 16);
+    m_Used += 16;
+
+    return 0;
+}
+// ============================================================================
+void PcapWriter::flush(void)
+{
+    size_t done = 0;
+
+    while (done < m_Used)
+    {
+        ssize_t nWritten = write(m_Fd, &m_Buf[done], m_Used - done);
+        if ((nWritten < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        if (nWritten < 0)
+        {
+            ERR_PRINT("pcap write: %s, capture stopped\n", strerror(errno));
+            m_IsEnabled = false;
+            break;
+        }
+        done += nWritten;
+    }
+
+    m_Used = 0;
+}
+// ============================================================================
+void* PcapWriter::threadMain(void* arg)
+{
+    ((PcapWriter*)arg)->run();
+
+    return NULL;
+}
+// ============================================================================
+void PcapWriter::run(void)
+{
+    pthread_mutex_lock(&m_Lock);
+
+    while (!m_Stopping)
+    {
+        struct timespec until;
+
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += PCAP_FLUSH_NS / 1000000000ULL;
+
+        pthread_cond_timedwait(&m_Wake, &m_Lock, &until);
+
+        if ((m_Used > 0) && (m_Fd >= 0) && m_IsEnabled)
+        {
+            flush();
+        }
+    }
+
+    pthread_mutex_unlock(&m_Lock);
+}
+// ============================================================================
+void PcapWriter::forget(int s)
+{
+    pthread_mutex_lock(&m_Lock);
+    m_Addrs.erase(s);
+    pthread_mutex_unlock(&m_Lock);
+}
+// ============================================================================
+const PcapWriter::SockAddrs& PcapWriter::lookupAddrs(int s, bool needPeer, uint64_t nowNs)
+{
+    std::map<int, SockAddrs>::iterator it = m_Addrs.find(s);
+
+    if ((it != m_Addrs.end()) && (nowNs - it->second.readNs < PCAP_FLUSH_NS)
+            && (it->second.hasPeer || !needPeer))
+    {
+        return it->second;
+    }
+
+    SockAddrs& addrs = m_Addrs[s];
+    socklen_t addrLen = sizeof(addrs.local);
+
+    if (getsockname(s, (struct sockaddr*)&addrs.local, &addrLen) < 0)
+    {
+        addrs.local.ss_family = AF_UNSPEC;
+    }
+
+    addrLen = sizeof(addrs.peer);
+    addrs.hasPeer = needPeer;
+    if (needPeer && (getpeername(s, (struct sockaddr*)&addrs.peer, &addrLen) < 0))
+    {
+        addrs.peer.ss_family = AF_UNSPEC;
+    }
+
+    // Unbound until the first send, look again on the next packet
+    bool isBound = ((addrs.local.ss_family == AF_INET) && (((struct sockaddr_in*)&addrs.local)->sin_port != 0))
+                   || ((addrs.local.ss_family == AF_INET6) && (((struct sockaddr_in6*)&addrs.local)->sin6_port != 0));
+    addrs.readNs = isBound ? nowNs : 0;
+
+    return addrs;
+}
+// ============================================================================
+void PcapWriter::capture(int s, bool isSend, const struct sockaddr* peer,
+                         const void* buf, size_t len, const void* origBuf, int status)
+{
+    struct sockaddr_storage peerAddr;
+    Endpoint local;
+    Endpoint remote;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t nowNs = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    pthread_mutex_lock(&m_Lock);
+
+    if (!m_IsEnabled || ((m_Fd < 0) && (openFile(m_Path.c_str()) < 0)))
+    {
+        m_IsEnabled = false;
+        pthread_mutex_unlock(&m_Lock);
+        return;
+    }
+
+    if ((m_ThreadPid != getpid())
+            && (pthread_create(&m_Thread, NULL, threadMain, this) == 0))
+    {
+        m_ThreadPid = getpid();
+    }
+
+    const SockAddrs& addrs = lookupAddrs(s, peer == NULL, nowNs);
+
+    if (peer != NULL)
+    {
+        memcpy(&peerAddr, peer, (peer->sa_family == AF_INET) ?
+               sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+    }
+
+    toEndpoint(&addrs.local, &local);
+    toEndpoint((peer != NULL) ? &peerAddr : &addrs.peer, &remote);
+
+    // An unbound end goes with whatever family the other one has
+    bool isV4 = (local.isV4 || local.isAny) && (remote.isV4 || remote.isAny);
+    if (!isV4)
+    {
+        toIpv6(&local);
+        toIpv6(&remote);
+    }
+
+    Endpoint* pSrc = isSend ? &local : &remote;
+    Endpoint* pDst = isSend ? &remote : &local;
+
+    if (len > PCAP_SNAPLEN - ETH_HDR_LEN - IPV6_HDR_LEN - UDP_HDR_LEN)
+    {
+        len = PCAP_SNAPLEN - ETH_HDR_LEN - IPV6_HDR_LEN - UDP_HDR_LEN;
+    }
+
+    size_t ipLen = isV4 ? IPV4_HDR_LEN : IPV6_HDR_LEN;
+    size_t udpLen = UDP_HDR_LEN + len;
+    size_t frameLen = ETH_HDR_LEN + ipLen + udpLen;
+    uint8_t dscp = (status > 0) ? (uint8_t)(status << 2) : 0;
+
+    if (m_Used + 16 + frameLen > m_Buf.size())
+    {
+        flush();
+    }
+
+    uint8_t* p = &m_Buf[m_Used];
+    uint32_t rec[4] = {(uint32_t)ts.tv_sec, (uint32_t)ts.tv_nsec,
+                       (uint32_t)frameLen, (uint32_t)frameLen};
+
+    memcpy(p, rec, sizeof(rec));
+    p += sizeof(rec);
+
+    memcpy(p, isSend ? s_RemoteMac : s_LocalMac, 6);
+    memcpy(p + 6, isSend ? s_LocalMac : s_RemoteMac, 6);
+    p = put16(p + 12, isV4 ? 0x0800 : 0x86dd);
+
+    uint8_t* ip = p;
+    uint32_t pseudo = 0;
+
+    if (isV4)
+    {
+        ip[0] = 0x45;
+        ip[1] = dscp;
+        put16(ip + 2, ipLen + udpLen);
+        put16(ip + 4, 0);
+        put16(ip + 6, 0x4000);
+        ip[8] = 64;
+        ip[9] = IPPROTO_UDP;
+        put16(ip + 10, 0);
+        memcpy(ip + 12, pSrc->addr, 4);
+        memcpy(ip + 16, pDst->addr, 4);
+        put16(ip + 10, foldSum(sumWords(ip, IPV4_HDR_LEN, 0)));
+
+        pseudo = sumWords(ip + 12, 8, 0);
+    }
+    else
+    {
+        ip[0] = 0x60 | (dscp >> 4);
+        ip[1] = (uint8_t)(dscp << 4);
+        put16(ip + 2, 0);
+        put16(ip + 4, udpLen);
+        ip[6] = IPPROTO_UDP;
+        ip[7] = 64;
+        memcpy(ip + 8, pSrc->addr, 16);
+        memcpy(ip + 24, pDst->addr, 16);
+
+        pseudo = sumWords(ip + 8, 32, 0);
+    }
+    p += ipLen;
+
+    uint8_t* udp = p;
+    memcpy(udp, &pSrc->port, 2);
+    memcpy(udp + 2, &pDst->port, 2);
+    put16(udp + 4, udpLen);
+    put16(udp + 6, 0);
+    memcpy(udp + UDP_HDR_LEN, buf, len);
+
+    // Over the untouched payload, so a corrupted packet's checksum is off
+    pseudo += IPPROTO_UDP + udpLen;
+    pseudo = sumWords(udp, UDP_HDR_LEN, pseudo);
+    uint16_t udpSum = foldSum(sumWords((const uint8_t*)((origBuf != NULL) ? origBuf : buf), len, pseudo));
+    put16(udp + 6, (udpSum == 0) ? 0xffff : udpSum);
+
+    m_Used += 16 + frameLen;
+
+    pthread_mutex_unlock(&m_Lock);
+}
+// ============================================================================
+void PcapWriter::forkPrepare(void)
+{
+    // Keeps the child from inheriting a half-written record
+    if (s_pWriter != NULL)
+    {
+        pthread_mutex_lock(&s_pWriter->m_Lock);
+    }
+}
+// ============================================================================
+void PcapWriter::forkParent(void)
+{
+    if (s_pWriter != NULL)
+    {
+        pthread_mutex_unlock(&s_pWriter->m_Lock);
+    }
+}
+// ============================================================================
+void PcapWriter::forkChild(void)
+{
+    if (s_pWriter == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_unlock(&s_pWriter->m_Lock);
+
+    // The flusher did not come along, the first capture starts the child's own
+    pthread_cond_init(&s_pWriter->m_Wake, NULL);
+    s_pWriter->m_ThreadPid = 0;
+    s_pWriter->m_Stopping = false;
+
+    if (!s_pWriter->m_IsEnabled)
+    {
+        return;
+    }
+
+    // The parent writes out what it buffered, the child opens its own file on first use
+    REAL(close)(s_pWriter->m_Fd);
+    s_pWriter->m_Fd = -1;
+    s_pWriter->m_Used = 0;
+
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%d", (int)getpid());
+    s_pWriter->m_Path += suffix;
+}
+// ============================================================================
+// ============================================================================
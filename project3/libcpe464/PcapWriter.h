@@ -0,0 +1,96 @@
+/**
+ * PcapWriter - Captures hooked traffic into a pcap file
+ *
+ * Every packet is written with a made-up Ethernet, IP and UDP header around
+ * the payload, addressed from the socket's local address and its peer. Both
+ * ends IPv4 (or IPv4-mapped) give IPv4, anything else IPv6. Timestamps are in
+ * nanoseconds (the 0xa1b23c4d pcap flavour).
+ *
+ * What the library did to a sent packet is in the IP DSCP field:
+ *   0 sent, 1 corrupted, 2 dropped, 3 duplicated, 4 delayed
+ * The UDP checksum covers the payload as the program handed it over, so a
+ * corrupted packet also shows a bad checksum.
+ *
+ * Records are appended to a buffer that is written out when full, at exit and
+ * once a second by a flusher thread, so an idle process does not sit on them. A
+ * forked child drops what the parent had buffered and captures into
+ * "<path>.<pid>" instead.
+ *
+ * A socket's local and peer address are looked up once and kept. They are
+ * read again after forget() (the socket was created, bound or connected) and
+ * at most once a second otherwise, for a connect() the hooks did not see.
+ */
+
+#ifndef __PCAPWRITER_H
+#define __PCAPWRITER_H
+
+// ============================================================================
+#include <stdint.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <string>
+#include <vector>
+// ============================================================================
+#define PCAP_BUFFER_SIZE   (256 * 1024)
+#define PCAP_FLUSH_NS      1000000000ULL
+// ============================================================================
+class PcapWriter
+{
+  public:
+    PcapWriter();
+    ~PcapWriter();
+
+    int open(const char* path);
+
+    bool isEnabled(void) { return m_IsEnabled; }
+
+    /**
+     * Records one packet. peer may be NULL (connected socket), origBuf is the
+     * payload before any MsgEvent changed it and status goes into the DSCP.
+     */
+    void capture(int s, bool isSend, const struct sockaddr* peer,
+                 const void* buf, size_t len, const void* origBuf, int status);
+
+    // The socket's addresses may have changed, look them up again
+    void forget(int s);
+
+  private:
+    struct SockAddrs
+    {
+        struct sockaddr_storage local;
+        struct sockaddr_storage peer;
+        bool     hasPeer;
+        uint64_t readNs;
+    };
+
+    bool            m_IsEnabled;
+    std::string     m_Path;
+    int             m_Fd;
+
+    std::vector<uint8_t> m_Buf;
+    size_t          m_Used;
+
+    std::map<int, SockAddrs> m_Addrs;
+
+    pthread_mutex_t m_Lock;
+    pthread_cond_t  m_Wake;
+    pthread_t       m_Thread;
+    pid_t           m_ThreadPid;
+    bool            m_Stopping;
+
+    static void* threadMain(void* arg);
+    static void forkPrepare(void);
+    static void forkParent(void);
+    static void forkChild(void);
+
+    int openFile(const char* path);
+    void flush(void);
+    void run(void);
+    const SockAddrs& lookupAddrs(int s, bool needPeer, uint64_t nowNs);
+};
+
+#endif
@@ -0,0 +1,56 @@
+// ============================================================================
+#include "RandStream.h"
+
+#include <stdlib.h>
+// ============================================================================
+long     RandStream::s_Seed = 0;
+// Streams start at generation 0, so they all seed on first use
+uint32_t RandStream::s_Gen = 1;
+RandStream::Stream RandStream::s_Streams[RAND_STREAM_SOCKETS];
+
+thread_local int                RandStream::t_Socket = -1;
+thread_local RandStream::Stream RandStream::t_Own;
+// ============================================================================
+void RandStream::setSeed(long seed)
+{
+    __atomic_store_n(&s_Seed, seed, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s_Gen, 1, __ATOMIC_RELEASE);
+}
+// ============================================================================
+void RandStream::select(int s)
+{
+    t_Socket = s;
+}
+// ============================================================================
+double RandStream::next(void)
+{
+    int s = t_Socket;
+    Stream* pStream = ((s >= 0) && (s < RAND_STREAM_SOCKETS)) ? &s_Streams[s] : &t_Own;
+    uint32_t gen = __atomic_load_n(&s_Gen, __ATOMIC_ACQUIRE);
+
+    if (pStream->gen != gen)
+    {
+        reseed(pStream, (pStream == &t_Own) ? -1 : s, gen);
+    }
+
+    return erand48(pStream->xsubi);
+}
+// ============================================================================
+void RandStream::reseed(Stream* pStream, int s, uint32_t gen)
+{
+    // splitmix64 of seed and socket, so neighbouring sockets get unrelated streams
+    uint64_t x = (uint64_t)__atomic_load_n(&s_Seed, __ATOMIC_RELAXED) * 0x9E3779B97F4A7C15ULL;
+    x ^= (uint64_t)(s + 1) * 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+
+    pStream->xsubi[0] = (unsigned short)x;
+    pStream->xsubi[1] = (unsigned short)(x >> 16);
+    pStream->xsubi[2] = (unsigned short)(x >> 32);
+    pStream->gen = gen;
+}
+// ============================================================================
+// ============================================================================
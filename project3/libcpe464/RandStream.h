@@ -0,0 +1,53 @@
+/**
+ * RandStream - Per-socket random number streams for the MsgEvents
+ *
+ * Every socket draws from its own erand48 stream, seeded from the library seed
+ * and the socket number, so the errors one socket sees do not depend on what
+ * other sockets or threads send in between. PacketManager selects the stream
+ * of the socket a packet goes out on, then the events (and the LinkEmulator)
+ * call next(). The selection is per thread, draws outside a send use a stream
+ * of the thread's own.
+ *
+ * Nothing is locked. A socket shared by several sending threads shares its
+ * stream as well, as racy as the order of its packets already is.
+ */
+
+#ifndef __RANDSTREAM_H
+#define __RANDSTREAM_H
+
+// ============================================================================
+#include <stdint.h>
+// ============================================================================
+// Sockets numbered past this share one stream per thread
+#define RAND_STREAM_SOCKETS 1024
+// ============================================================================
+class RandStream
+{
+  public:
+    // Reseeds every stream (lazily, on its next draw)
+    static void setSeed(long seed);
+
+    static void select(int s);
+
+    // Uniform in [0.0, 1.0)
+    static double next(void);
+
+  private:
+    struct Stream
+    {
+        unsigned short xsubi[3];
+        uint32_t       gen;
+    };
+
+    static long     s_Seed;
+    static uint32_t s_Gen;
+    static Stream   s_Streams[RAND_STREAM_SOCKETS];
+
+    static thread_local int    t_Socket;
+    static thread_local Stream t_Own;
+
+    static void reseed(Stream* pStream, int s, uint32_t gen);
+};
+// ============================================================================
+
+#endif
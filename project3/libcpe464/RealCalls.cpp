@@ -0,0 +1,73 @@
+// ============================================================================
+#include "RealCalls.h"
+
+#ifdef __LIBCPE464_PRELOAD
+
+#include "utils/dbg_print.h"
+
+#include <dlfcn.h>
+#include <stdlib.h>
+// ============================================================================
+static RealCalls_t s_Real;
+static bool        s_IsResolved = false;
+// ============================================================================
+template <typename T>
+static void resolve(T* pFn, const char* name)
+{
+    *pFn = (T)dlsym(RTLD_NEXT, name);
+    if (*pFn == NULL)
+    {
+        ERR_PRINT("dlsym %s: %s\n", name, dlerror());
+        exit(1);
+    }
+}
+// ============================================================================
+// Ahead of the C++ globals, whose constructors may already send or log
+__attribute__((constructor(101)))
+static void resolveAll(void)
+{
+    if (s_IsResolved)
+    {
+        return;
+    }
+
+    resolve(&s_Real.socket,   "socket");
+    resolve(&s_Real.close,    "close");
+    resolve(&s_Real.accept,   "accept");
+    resolve(&s_Real.accept4,  "accept4");
+    resolve(&s_Real.dup,      "dup");
+    resolve(&s_Real.dup2,     "dup2");
+    resolve(&s_Real.dup3,     "dup3");
+    resolve(&s_Real.fcntl,    "fcntl");
+    resolve(&s_Real.bind,     "bind");
+    resolve(&s_Real.connect,  "connect");
+    resolve(&s_Real.select,   "select");
+    resolve(&s_Real.poll,     "poll");
+    resolve(&s_Real.fork,     "fork");
+
+    resolve(&s_Real.send,     "send");
+    resolve(&s_Real.sendto,   "sendto");
+    resolve(&s_Real.sendmsg,  "sendmsg");
+    resolve(&s_Real.sendmmsg, "sendmmsg");
+
+    resolve(&s_Real.recv,     "recv");
+    resolve(&s_Real.recvfrom, "recvfrom");
+    resolve(&s_Real.recvmsg,  "recvmsg");
+    resolve(&s_Real.recvmmsg, "recvmmsg");
+
+    __atomic_store_n(&s_IsResolved, true, __ATOMIC_RELEASE);
+}
+// ============================================================================
+const RealCalls_t& realCalls(void)
+{
+    // Another library's constructor may call in before ours ran
+    if (!__atomic_load_n(&s_IsResolved, __ATOMIC_ACQUIRE))
+    {
+        resolveAll();
+    }
+
+    return s_Real;
+}
+// ============================================================================
+
+#endif
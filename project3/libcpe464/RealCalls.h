@@ -0,0 +1,61 @@
+/**
+ * RealCalls - The socket calls the hooks wrap, for the library's own use
+ *
+ * Linked into a program, the library calls libc directly: REAL(sendto) is
+ * plain sendto. In the LD_PRELOAD build (__LIBCPE464_PRELOAD) the library's
+ * own sendto() and friends are the hooks, so the libc ones are looked up once
+ * with dlsym(RTLD_NEXT) and called through these pointers.
+ */
+
+#ifndef __REALCALLS_H
+#define __REALCALLS_H
+
+// ============================================================================
+#include <poll.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+// ============================================================================
+#ifdef __LIBCPE464_PRELOAD
+
+struct RealCalls_t
+{
+    int     (*socket)(int, int, int);
+    int     (*close)(int);
+    int     (*accept)(int, struct sockaddr*, socklen_t*);
+    int     (*accept4)(int, struct sockaddr*, socklen_t*, int);
+    int     (*dup)(int);
+    int     (*dup2)(int, int);
+    int     (*dup3)(int, int, int);
+    int     (*fcntl)(int, int, ...);
+    int     (*bind)(int, const struct sockaddr*, socklen_t);
+    int     (*connect)(int, const struct sockaddr*, socklen_t);
+    int     (*select)(int, fd_set*, fd_set*, fd_set*, struct timeval*);
+    int     (*poll)(struct pollfd*, nfds_t, int);
+    pid_t   (*fork)(void);
+
+    ssize_t (*send)(int, const void*, size_t, int);
+    ssize_t (*sendto)(int, const void*, size_t, int, const struct sockaddr*, socklen_t);
+    ssize_t (*sendmsg)(int, const struct msghdr*, int);
+    int     (*sendmmsg)(int, struct mmsghdr*, unsigned int, int);
+
+    ssize_t (*recv)(int, void*, size_t, int);
+    ssize_t (*recvfrom)(int, void*, size_t, int, struct sockaddr*, socklen_t*);
+    ssize_t (*recvmsg)(int, struct msghdr*, int);
+    int     (*recvmmsg)(int, struct mmsghdr*, unsigned int, int, struct timespec*);
+};
+
+const RealCalls_t& realCalls(void);
+
+#define REAL(FN) (realCalls().FN)
+
+#else
+
+#define REAL(FN) (::FN)
+
+#endif
+// ============================================================================
+
+#endif
@@ -4,6 +4,10 @@
 #include "utils/dbg_print.h"
 #include "MsgEvents/errorDrop.h"
 #include "MsgEvents/errorFlipBits.h"
+#include "MsgEvents/errorBurstDrop.h"
+#include "MsgEvents/errorDuplicate.h"
+#include "MsgEvents/errorDelay.h"
+#include "MsgEvents/rateTokenBucket.h"
 
 #include <errno.h>
 #include <stdlib.h>
@@ -16,7 +20,17 @@ static sEnvKeyInfo_t g_EnvKeys[] = {
     {EDK_OVERRIDE_SEEDRAND, "CPE464_OVERRIDE_SEEDRAND", EDT_LONG},
     {EDK_OVERRIDE_ERR_RATE, "CPE464_OVERRIDE_ERR_RATE", EDT_FLOAT},
     {EDK_OVERRIDE_ERR_DROP, "CPE464_OVERRIDE_ERR_DROP", EDT_LIST_LONG},
-    {EDK_OVERRIDE_ERR_FLIP, "CPE464_OVERRIDE_ERR_FLIP", EDT_LIST_LONG}
+    {EDK_OVERRIDE_ERR_FLIP, "CPE464_OVERRIDE_ERR_FLIP", EDT_LIST_LONG},
+    {EDK_OVERRIDE_ERR_BURST, "CPE464_OVERRIDE_ERR_BURST", EDT_LIST_FLOAT},
+    {EDK_OVERRIDE_ERR_DUP,  "CPE464_OVERRIDE_ERR_DUP",  EDT_LIST_LONG},
+    {EDK_OVERRIDE_ERR_DELAY, "CPE464_OVERRIDE_ERR_DELAY", EDT_LIST_LONG},
+    {EDK_OVERRIDE_DELAY_MS, "CPE464_OVERRIDE_DELAY_MS", EDT_LONG},
+    {EDK_OVERRIDE_JITTER_MS, "CPE464_OVERRIDE_JITTER_MS", EDT_LONG},
+    {EDK_OVERRIDE_RATE_KBPS, "CPE464_OVERRIDE_RATE_KBPS", EDT_LONG},
+    {EDK_OVERRIDE_QUEUE,    "CPE464_OVERRIDE_QUEUE",    EDT_LONG},
+    {EDK_OVERRIDE_TOKEN_BUCKET, "CPE464_OVERRIDE_TOKEN_BUCKET", EDT_LIST_LONG},
+    {EDK_CAPTURE,           "CPE464_CAPTURE",           EDT_CHARPTR},
+    {EDK_LOG,               "CPE464_LOG",               EDT_CHARPTR}
 };
 // ============================================================================
 SettingsManager::SettingsManager(PacketManager& pktMgr) :
@@ -27,6 +41,8 @@ SettingsManager::SettingsManager(PacketManager& pktMgr) :
     // load env settings
     loadEnvData();
 
+    // First, so the settings below already print through it
+    loadEnvData_Log();
     loadEnvData_Port();
     loadEnvData_Autograder();
     loadEnvData_Debug();
@@ -34,6 +50,12 @@ SettingsManager::SettingsManager(PacketManager& pktMgr) :
     loadEnvData_ErrRate();
     loadEnvData_ErrDrop();
     loadEnvData_ErrFlip();
+    loadEnvData_ErrBurst();
+    loadEnvData_ErrDup();
+    loadEnvData_ErrDelay();
+    loadEnvData_Link();
+    loadEnvData_TokenBucket();
+    loadEnvData_Capture();
 
 }
 // ============================================================================
@@ -96,7 +118,7 @@ int SettingsManager::loadEnvData(void)
                 }
                 case EDT_CHARPTR:
                 {
-                    entry.data.vCharPtr = (char*)malloc(strlen(tmpStr));
+                    entry.data.vCharPtr = (char*)malloc(strlen(tmpStr) + 1);
                     if (entry.data.vCharPtr == NULL)
                     {
                         entry.isSet = false;
@@ -104,7 +126,7 @@ int SettingsManager::loadEnvData(void)
                         continue;
                     }
 
-                    memcpy(entry.data.vCharPtr, tmpStr, strlen(tmpStr));
+                    memcpy(entry.data.vCharPtr, tmpStr, strlen(tmpStr) + 1);
                     break;
                 }
                 case EDT_LIST_LONG:
@@ -117,6 +139,16 @@ int SettingsManager::loadEnvData(void)
                     }
                     break;
                 }
+                case EDT_LIST_FLOAT:
+                {
+                    entry.data.vLong = parser2ListFloat(entry.lFloat, tmpStr);
+                    if (entry.data.vLong < 0)
+                    {
+                        entry.isSet = false;
+                        continue;
+                    }
+                    break;
+                }
                 default:
                 {
                     continue;
@@ -246,6 +278,223 @@ int SettingsManager::loadEnvData_ErrFlip(void)
     return 0;
 }
 // ============================================================================
+int SettingsManager::loadEnvData_ErrBurst(void)
+{
+    sEnvDataEntry_t& entry = m_EnvData[EDK_OVERRIDE_ERR_BURST];
+    if (!entry.isSet)
+    {
+        return 0;
+    }
+
+    // p, r, then the optional loss probabilities in Bad and Good
+    float model[4] = {0.0f, 0.0f, 1.0f, 0.0f};
+    uint count = 0;
+
+    for (ListFloat_t::iterator it = entry.lFloat.begin(); it != entry.lFloat.end(); ++it)
+    {
+        if ((count == 4) || (*it < 0.0f) || (*it > 1.0f))
+        {
+            ERR_PRINT("CPE464_OVERRIDE_ERR_BURST takes 2 to 4 probabilities\n");
+            return -1;
+        }
+        model[count++] = *it;
+    }
+
+    if (count < 2)
+    {
+        ERR_PRINT("CPE464_OVERRIDE_ERR_BURST takes 2 to 4 probabilities\n");
+        return -1;
+    }
+
+    DBG_PRINT(DBG_LEVEL_WARN, "** ENV - OVERRIDE ERROR BURST: p %.3f r %.3f h %.3f k %.3f **\n",
+            model[0], model[1], model[2], model[3]);
+
+    m_pPktMgr->addMsgEvent_Standard(new errorBurstDrop(model[0], model[1], model[2], model[3]));
+
+    return 0;
+}
+// ============================================================================
+int SettingsManager::loadEnvData_ErrDup(void)
+{
+    sEnvDataEntry_t& entry = m_EnvData[EDK_OVERRIDE_ERR_DUP];
+    if (entry.isSet)
+    {
+        errorDuplicate* errClass = new errorDuplicate();
+        std::list<uint32_t> lUint32;
+        parserLong2Uint32(entry.lLong, lUint32);
+
+        if (lUint32.size() == 0)
+        {
+            DBG_PRINT(DBG_LEVEL_WARN, "** ENV - OVERRIDE ERROR DUP: ENABLED **\n");
+
+            m_pPktMgr->addMsgEvent_Random(errClass);
+        }
+        else
+        {
+            DBG_PRINT(DBG_LEVEL_WARN, "** ENV - OVERRIDE ERROR DUP: __List__ **\n");
+            for (std::list<uint32_t>::iterator it = lUint32.begin(); it != lUint32.end(); ++it)
+            {
+                DBG_PRINT(DBG_LEVEL_WARN, "%u\n", *it);
+            }
+
+            errClass->setDupSpecific(lUint32);
+            m_pPktMgr->addMsgEvent_Standard(errClass);
+        }
+    }
+
+    return 0;
+}
+// ============================================================================
+int SettingsManager::loadEnvData_ErrDelay(void)
+{
+    sEnvDataEntry_t& entry = m_EnvData[EDK_OVERRIDE_ERR_DELAY];
+    if (!entry.isSet)
+    {
+        return 0;
+    }
+
+    if ((entry.lLong.size() != 2) || (entry.lLong.front() < 0) || (entry.lLong.back() < 0) ||
+        ((entry.lLong.front() == 0) && (entry.lLong.back() == 0)))
+    {
+        ERR_PRINT("CPE464_OVERRIDE_ERR_DELAY takes packets,ms (not both 0)\n");
+        return -1;
+    }
+
+    DBG_PRINT(DBG_LEVEL_WARN, "** ENV - OVERRIDE ERROR DELAY: %li packets, %li ms **\n",
+            entry.lLong.front(), entry.lLong.back());
+
+    m_pPktMgr->addMsgEvent_Random(new errorDelay(entry.lLong.front(), entry.lLong.back()));
+
+    return 0;
+}
+// ============================================================================
+int SettingsManager::loadEnvData_Link(void)
+{
+    if (m_EnvData[EDK_OVERRIDE_DELAY_MS].isSet)
+    {
+        DBG_PRINT(DBG_LEVEL_WARN, "** ENV - OVERRIDE DELAY: %li ms **\n",
+                m_EnvData[EDK_OVERRIDE_DELAY_MS].data.vLong);
+
+        m_pPktMgr->setLinkDelay(m_EnvData[EDK_OVERRIDE_DELAY_MS].data.vLong);
+    }
+
+    if (m_EnvData[EDK_OVERRIDE_JITTER_MS].isSet)
+    {
+        DBG_PRINT(DBG_LEVEL_WARN, "** ENV - OVERRIDE JITTER: %li ms **\n",
+                m_EnvData[EDK_OVERRIDE_JITTER_MS].data.vLong);
+
+        m_pPktMgr->setLinkJitter(m_EnvData[EDK_OVERRIDE_JITTER_MS].data.vLong);
+    }
+
+    if (m_EnvData[EDK_OVERRIDE_RATE_KBPS].isSet)
+    {
+        DBG_PRINT(DBG_LEVEL_WARN, "** ENV - OVERRIDE RATE: %li kbit/s **\n",
+                m_EnvData[EDK_OVERRIDE_RATE_KBPS].data.vLong);
+
+        m_pPktMgr->setLinkRate(m_EnvData[EDK_OVERRIDE_RATE_KBPS].data.vLong);
+    }
+
+    if (m_EnvData[EDK_OVERRIDE_QUEUE].isSet)
+    {
+        DBG_PRINT(DBG_LEVEL_WARN, "** ENV - OVERRIDE QUEUE: %li packets **\n",
+                m_EnvData[EDK_OVERRIDE_QUEUE].data.vLong);
+
+        m_pPktMgr->setLinkQueue(m_EnvData[EDK_OVERRIDE_QUEUE].data.vLong);
+    }
+
+    return 0;
+}
+// ============================================================================
+int SettingsManager::loadEnvData_TokenBucket(void)
+{
+    sEnvDataEntry_t& entry = m_EnvData[EDK_OVERRIDE_TOKEN_BUCKET];
+    if (!entry.isSet)
+    {
+        return 0;
+    }
+
+    // Rate, burst, then the optional queue limit
+    long params[3] = {0, 0, LINK_QUEUE_DEFAULT};
+    uint count = 0;
+
+    for (ListLong_t::iterator it = entry.lLong.begin(); it != entry.lLong.end(); ++it)
+    {
+        if ((count == 3) || (*it < 1))
+        {
+            ERR_PRINT("CPE464_OVERRIDE_TOKEN_BUCKET takes kbps,burst[,queue] (all > 0)\n");
+            return -1;
+        }
+        params[count++] = *it;
+    }
+
+    if (count < 2)
+    {
+        ERR_PRINT("CPE464_OVERRIDE_TOKEN_BUCKET takes kbps,burst[,queue] (all > 0)\n");
+        return -1;
+    }
+
+    DBG_PRINT(DBG_LEVEL_WARN, "** ENV - OVERRIDE TOKEN BUCKET: %li kbit/s, %li bytes, %li packets **\n",
+            params[0], params[1], params[2]);
+
+    m_pPktMgr->addMsgEvent_Standard(new rateTokenBucket(params[0], params[1], params[2]));
+
+    return 0;
+}
+// ============================================================================
+int SettingsManager::loadEnvData_Capture(void)
+{
+    if (m_EnvData[EDK_CAPTURE].isSet)
+    {
+        DBG_PRINT(DBG_LEVEL_WARN, "** ENV - CAPTURE: %s **\n",
+                m_EnvData[EDK_CAPTURE].data.vCharPtr);
+
+        return m_pPktMgr->setCapture(m_EnvData[EDK_CAPTURE].data.vCharPtr);
+    }
+
+    return 0;
+}
+// ============================================================================
+int SettingsManager::loadEnvData_Log(void)
+{
+    if (!m_EnvData[EDK_LOG].isSet)
+    {
+        return 0;
+    }
+
+    char* modeStr = m_EnvData[EDK_LOG].data.vCharPtr;
+    char* path = strchr(modeStr, ',');
+    int mode;
+
+    if (path != NULL)
+    {
+        *path++ = '\0';
+    }
+
+    if (strcmp(modeStr, "async") == 0)
+    {
+        mode = DBG_MODE_ASYNC;
+    }
+    else if (strcmp(modeStr, "binary") == 0)
+    {
+        mode = DBG_MODE_BINARY;
+    }
+    else
+    {
+        ERR_PRINT("CPE464_LOG: unknown mode %s (async or binary)\n", modeStr);
+        return -1;
+    }
+
+    if (dbg_setmode(mode, path) < 0)
+    {
+        return -1;
+    }
+
+    DBG_PRINT(DBG_LEVEL_WARN, "** ENV - LOG: %s%s%s **\n", modeStr,
+            (path != NULL) ? " to " : "", (path != NULL) ? path : "");
+
+    return 0;
+}
+// ============================================================================
 int SettingsManager::parserLong2Uint32(ListLong_t& lLong, std::list<uint32_t>& lUint32)
 {
     ListLong_t::iterator it = lLong.begin();
@@ -263,31 +512,51 @@ int SettingsManager::parserLong2Uint32(ListLong_t& lLong, std::list<uint32_t>& l
 // ============================================================================
 int SettingsManager::parser2ListLong(ListLong_t& lLong, const char* str)
 {
-    char* strTmp = (char*)str;
-    char* pSave;
-
+    // Walked in place, not strtok'd: str is the environment's own copy, which an exec() passes on
+    const char* token = str;
     int count = 0;
 
-    char* token = strtok_r(strTmp, ",", &pSave);
-    while (token != NULL)
+    while (*token != '\0')
     {
         char* strEnd = NULL;
         long val = strtol(token, &strEnd, 10);
-        if (token != strEnd)
+        if ((token == strEnd) || ((*strEnd != ',') && (*strEnd != '\0')))
         {
-            ++count;
+            ERR_PRINT("Invalid Value in String\n");
+            break;
+        }
 
-            // Save Value
-            lLong.push_back(val);
+        ++count;
 
-            // Get next value
-            token = strtok_r(NULL, ",", &pSave);
-        }
-        else
+        // Save Value
+        lLong.push_back(val);
+
+        // Get next value
+        token = (*strEnd == ',') ? strEnd + 1 : strEnd;
+    }
+
+    return count;
+}
+// ============================================================================
+int SettingsManager::parser2ListFloat(ListFloat_t& lFloat, const char* str)
+{
+    const char* token = str;
+    int count = 0;
+
+    while (*token != '\0')
+    {
+        char* strEnd = NULL;
+        float val = strtof(token, &strEnd);
+        if ((token == strEnd) || ((*strEnd != ',') && (*strEnd != '\0')))
         {
             ERR_PRINT("Invalid Value in String\n");
-            break;
-        }       
+            return -1;
+        }
+
+        ++count;
+        lFloat.push_back(val);
+
+        token = (*strEnd == ',') ? strEnd + 1 : strEnd;
     }
 
     return count;
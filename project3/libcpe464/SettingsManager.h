@@ -9,10 +9,34 @@
  *   CPE464_AUTOGRADER          Current Unused
  *   CPE464_OVERRIDE_PORT       [0-65535] Override the port of first "bind(x)"
  *   CPE464_OVERRIDE_DEBUG      [-1 to 3] Sets debug level (ERR-VERBOSE)
- *   CPE464_OVERRIDE_SEEDRAND   [0-...]   Sets the seed value for random ops
+ *   CPE464_OVERRIDE_SEEDRAND   [0-...]   Sets the seed value for random ops (each
+ *                                        socket draws its own stream from it)
  *   CPE464_OVERRIDE_ERR_RATE   [0.0-1.0] Percent error rate for random events
  *   CPE464_OVERRIDE_ERR_DROP   (see list detail below)
  *   CPE464_OVERRIDE_ERR_FLIP   (see list detail below)
+ *   CPE464_OVERRIDE_ERR_DUP    (see list detail below) Send the packet twice
+ *   CPE464_OVERRIDE_ERR_DELAY  n,ms      Random event holding a packet back
+ *                                        until n later sends or ms passed,
+ *                                        whichever comes first (0 for none)
+ *   CPE464_OVERRIDE_ERR_BURST  p,r[,h[,k]] Gilbert-Elliott burst loss on every
+ *                                        packet: Good->Bad and Bad->Good
+ *                                        probabilities, loss when Bad (default
+ *                                        1.0) and when Good (default 0.0)
+ *   CPE464_OVERRIDE_DELAY_MS   [0-...]   One-way delay added to every sent packet
+ *   CPE464_OVERRIDE_JITTER_MS  [0-...]   Random +/- spread on the delay (reorders)
+ *   CPE464_OVERRIDE_RATE_KBPS  [0-...]   Bottleneck rate in kbit/s, 0 for none
+ *   CPE464_OVERRIDE_QUEUE      [1-...]   Packets the bottleneck queues before
+ *                                        tail-dropping (default 100)
+ *   CPE464_OVERRIDE_TOKEN_BUCKET kbps,burst[,queue] Per-socket token bucket:
+ *                                        rate in kbit/s, burst in bytes, and
+ *                                        packets queued before dropping
+ *                                        (default 100)
+ *   CPE464_CAPTURE             path      Write all sends and receives to a pcap
+ *                                        file (forked children: path.<pid>)
+ *   CPE464_LOG                 mode[,path] Debug output: async (buffered, a
+ *                                        writer thread prints it) or binary
+ *                                        (unformatted, read with logdump;
+ *                                        default path cpe464log.<pid>)
  *
  * List Options:
  *   Provide a comma-separated list of MsgEvents to perform an event. Since no
@@ -37,7 +61,8 @@ enum eEnvData_t
     EDT_FLOAT,
     EDT_BOOL,
     EDT_CHARPTR,
-    EDT_LIST_LONG
+    EDT_LIST_LONG,
+    EDT_LIST_FLOAT
 };
 
 enum eEnvDataKey_t
@@ -49,10 +74,21 @@ enum eEnvDataKey_t
     EDK_OVERRIDE_SEEDRAND,
     EDK_OVERRIDE_ERR_RATE,
     EDK_OVERRIDE_ERR_DROP,
-    EDK_OVERRIDE_ERR_FLIP
+    EDK_OVERRIDE_ERR_FLIP,
+    EDK_OVERRIDE_ERR_BURST,
+    EDK_OVERRIDE_ERR_DUP,
+    EDK_OVERRIDE_ERR_DELAY,
+    EDK_OVERRIDE_DELAY_MS,
+    EDK_OVERRIDE_JITTER_MS,
+    EDK_OVERRIDE_RATE_KBPS,
+    EDK_OVERRIDE_QUEUE,
+    EDK_OVERRIDE_TOKEN_BUCKET,
+    EDK_CAPTURE,
+    EDK_LOG
 };
 
 typedef std::list<long> ListLong_t;
+typedef std::list<float> ListFloat_t;
 
 typedef struct _EnvDataEntry
 {
@@ -67,6 +103,7 @@ typedef struct _EnvDataEntry
         char* vCharPtr;
     } data;
     ListLong_t lLong;
+    ListFloat_t lFloat;
 
     _EnvDataEntry() {
         isSet = false;
@@ -99,6 +136,7 @@ class SettingsManager
     private:
         // ===== Helper Functions =============================================
         int parser2ListLong(ListLong_t& lLong, const char* str);
+        int parser2ListFloat(ListFloat_t& lFloat, const char* str);
         int parserLong2Uint32(ListLong_t& lLong, std::list<uint32_t>& lUint32);
 
         // ====================================================================
@@ -110,6 +148,13 @@ class SettingsManager
         int loadEnvData_ErrRate(void);
         int loadEnvData_ErrDrop(void);
         int loadEnvData_ErrFlip(void);
+        int loadEnvData_ErrBurst(void);
+        int loadEnvData_ErrDup(void);
+        int loadEnvData_ErrDelay(void);
+        int loadEnvData_Link(void);
+        int loadEnvData_TokenBucket(void);
+        int loadEnvData_Capture(void);
+        int loadEnvData_Log(void);
 
         // ====================================================================
         typedef std::map<eEnvDataKey_t, sEnvDataEntry_t> sEnvDataMap_t;
@@ -8,7 +8,7 @@ BUILD_MINOR=b
 TEST=test
 
 CC = g++
-CFLAGS = -g -Wall
+CFLAGS = -g -Wall -O2
 
 PACKAGES = sendtoErr sendErr checksum
 HDRS = $(shell cd networks && ls *.hpp *.h 2> /dev/null)
@@ -18,6 +18,8 @@ HFILE = cpe464
 
 CPE464_VER = libcpe464.$(BUILD_MAJOR).$(BUILD_MINOR)
 CPE464_LIB = $(CPE464_VER).a
+CPE464_PRELOAD = $(CPE464_VER).preload.so
+PRELOAD_OBJS = $(OBJS:.o=.pic.o)
 CPE464_TAR = libcpe464.$(BUILD_MAJOR).$(BUILD_MINOR).tar
 
 all: header $(OBJS) link combHeader clean
@@ -48,6 +50,20 @@ header:
 	@echo "-------------------------------"
 	@echo "Building $(CPE464_LIB) Objects"
 
+# Shared library that hooks unmodified programs through LD_PRELOAD, e.g.
+#   CPE464_OVERRIDE_ERR_RATE=0.1 LD_PRELOAD=./$(CPE464_PRELOAD) ./program
+preload: header $(PRELOAD_OBJS) linkPreload clean
+	@echo "-------------------------------"
+
+%.pic.o: %.cpp
+	@echo "-------------------------------"
+	@echo "  C++ Compiling $@"
+	$(V)$(CC) -c $(CFLAGS) -fPIC -D__LIBCPE464_PRELOAD $< -o $@
+%.pic.o: %.c
+	@echo "-------------------------------"
+	@echo "  C Compiling $@"
+	$(V)$(CC) -c $(CFLAGS) -fPIC -D__LIBCPE464_PRELOAD $< -o $@
+
 .cpp.o:
 	@echo "-------------------------------"
 	@echo "  C++ Compiling $@"
@@ -62,6 +78,11 @@ link:
 	@echo "Loading objects into $(CPE464_LIB) library"
 	$(V)ar -rcv ../$(CPE464_LIB) $(OBJS)
 
+linkPreload:
+	@echo "-------------------------------"
+	@echo "Linking objects into ../$(CPE464_PRELOAD)"
+	$(V)$(CC) -shared -o ../$(CPE464_PRELOAD) $(PRELOAD_OBJS) -ldl -lpthread
+
 combHeader:
 	@echo "-------------------------------"
 	@echo "Creating Master, Unified Header"
@@ -72,4 +93,4 @@ clean:
 	-@find $(CURDIR) -name "*.o" | xargs rm -f
 
 clean-full: clean
-	-@rm -f ../*libcpe464*.a
+	-@rm -f ../*libcpe464*.a ../*libcpe464*.so
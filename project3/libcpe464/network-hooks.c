@@ -8,6 +8,7 @@
 
 #include "PacketManager.h"
 #include "SettingsManager.h"
+#include "RealCalls.h"
 
 #include "MsgEvents/errorDrop.h"
 #include "MsgEvents/errorFlipBits.h"
@@ -59,7 +60,7 @@ int forkMod(void)
 	
 	nextSeed++;
 	
-	if ((returnValue = fork()) == 0)
+	if ((returnValue = REAL(fork)()) == 0)
 	{
 		// in child process - set a next random seed for child process
 		g_SetsMgr.setUserMode_SeedRand(tempNextSeed);
@@ -73,7 +74,12 @@ int socketMod(int domain, int type, int protocol)
 {
 	socketType = type;
 	
-	return(socket(domain, type, protocol));	
+	int fd = REAL(socket)(domain, type, protocol);
+
+	// The number may have been a closed socket's
+	g_PktMgr.socketChanged(fd);
+
+	return fd;
 	
 }
 
@@ -103,12 +109,14 @@ int bindMod(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
 		}
     }
 
-    int nResult = bind(sockfd, addr, addrlen);
+    int nResult = REAL(bind)(sockfd, addr, addrlen);
+
+    g_PktMgr.socketChanged(sockfd);
 
 	if (socketType == AF_INET6)
 	{
 		struct sockaddr_in6 addr_in6;
-		socklen_t addr_in6_len;
+		socklen_t addr_in6_len = sizeof(addr_in6);
 
 		getsockname(sockfd, (sockaddr*)&addr_in6, &addr_in6_len);
 		port = ntohs(addr_in6.sin6_port);
@@ -116,7 +124,7 @@ int bindMod(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
 	else
 	{
 		struct sockaddr_in addr_in;
-		socklen_t addr_in_len;
+		socklen_t addr_in_len = sizeof(addr_in);
 
 		getsockname(sockfd, (sockaddr*)&addr_in, &addr_in_len);
 		port = ntohs(addr_in.sin_port);
@@ -159,7 +167,7 @@ int selectMod(int nfds,
 		DBG_PRINT(DBG_LEVEL_INFO, "Secs %2li, uSecs %2li\n", timeout->tv_sec, timeout->tv_usec);
 	}
 	*/
-	int nResult = select(nfds, readfds, writefds, exceptfds, timeout);
+	int nResult = REAL(select)(nfds, readfds, writefds, exceptfds, timeout);
 	// IF the select time was NULL it was a block on select() until data came in
 	// Otherwise see if the user set a timeout value - only print message if the time
 	// value was greater than 0 (meaning a timeout occured)
@@ -0,0 +1,407 @@
+/*
+ * CPE464 Library - LD_PRELOAD interposer
+ *
+ * Built into a shared library with __LIBCPE464_PRELOAD (make -f
+ * build464Lib.mk preload), the hooks also apply to programs that were never
+ * rebuilt against cpe464.h, optimized release builds and third-party ones
+ * included:
+ *
+ *     CPE464_OVERRIDE_ERR_RATE=0.1 CPE464_OVERRIDE_ERR_DROP=-1 \
+ *         LD_PRELOAD=./libcpe464.2.21.preload.so ./program
+ *
+ * With no sendErr_init() call, everything is set by the CPE464_* environment
+ * variables. Only IPv4/IPv6 UDP sockets are hooked, every other fd goes
+ * straight to libc (so do read() and write(), on any fd). sendmsg/sendmmsg
+ * payloads are gathered into one buffer and sent without ancillary data;
+ * recvmsg/recvmmsg are only logged and captured, like every receive.
+ *
+ * Whether an fd is a hooked socket is cached by its number. Every call that
+ * creates or replaces an fd resets its entry (socket, accept, dup, fcntl
+ * F_DUPFD, ...), so a number closed behind the cache's back (fclose,
+ * close_range) is set right again when one of them reuses it.
+ */
+
+// ============================================================================
+#include "RealCalls.h"
+
+#ifdef __LIBCPE464_PRELOAD
+
+#include "networks/network-hooks.h"
+#undef fork
+#undef socket
+#undef bind
+#undef select
+#undef send
+#undef sendto
+
+#ifdef CPE464_OVERRIDE_RECV
+    #undef recv
+    #undef recvfrom
+#endif
+
+#include "PacketManager.h"
+
+#include "utils/dbg_print.h"
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+// ============================================================================
+// Sockets classified by fd number, higher ones are looked up on every call
+#define PRELOAD_FD_MAX 4096
+
+enum { FD_UNKNOWN = 0, FD_HOOKED, FD_OTHER };
+// ============================================================================
+extern PacketManager g_PktMgr;
+
+static uint8_t s_FdKind[PRELOAD_FD_MAX];
+
+// The iovecs of a sendmsg/recvmsg with several of them, made one buffer
+static thread_local std::vector<uint8_t> t_Gather;
+// ============================================================================
+static bool isUdp(int domain, int type)
+{
+    type &= ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    return ((domain == AF_INET) || (domain == AF_INET6)) && (type == SOCK_DGRAM);
+}
+// ============================================================================
+static bool isHooked(int s)
+{
+    if ((s >= 0) && (s < PRELOAD_FD_MAX) && (s_FdKind[s] != FD_UNKNOWN))
+    {
+        return s_FdKind[s] == FD_HOOKED;
+    }
+
+    int domain;
+    int type;
+    socklen_t len = sizeof(int);
+    bool isUdpSocket = (getsockopt(s, SOL_SOCKET, SO_DOMAIN, &domain, &len) == 0)
+                       && (getsockopt(s, SOL_SOCKET, SO_TYPE, &type, &len) == 0)
+                       && isUdp(domain, type);
+
+    if ((s >= 0) && (s < PRELOAD_FD_MAX))
+    {
+        s_FdKind[s] = isUdpSocket ? FD_HOOKED : FD_OTHER;
+    }
+
+    return isUdpSocket;
+}
+// ============================================================================
+// The fd number may come back as something else, look at it again then
+static void forget(int fd)
+{
+    // Only a hooked socket has capture state, and closing a file is no reason to look
+    bool wasHooked = (fd >= 0) && isHooked(fd);
+
+    if ((fd >= 0) && (fd < PRELOAD_FD_MAX))
+    {
+        s_FdKind[fd] = FD_UNKNOWN;
+    }
+
+    if (wasHooked)
+    {
+        g_PktMgr.socketChanged(fd);
+    }
+}
+// ============================================================================
+static const void* gather(const struct msghdr* msg, size_t maxLen, size_t* pLen)
+{
+    if (msg->msg_iovlen == 1)
+    {
+        *pLen = (msg->msg_iov[0].iov_len < maxLen) ? msg->msg_iov[0].iov_len : maxLen;
+        return msg->msg_iov[0].iov_base;
+    }
+
+    size_t len = 0;
+
+    t_Gather.clear();
+    for (size_t i = 0; (i < msg->msg_iovlen) && (len < maxLen); ++i)
+    {
+        size_t part = msg->msg_iov[i].iov_len;
+        part = (part < maxLen - len) ? part : maxLen - len;
+
+        t_Gather.insert(t_Gather.end(), (const uint8_t*)msg->msg_iov[i].iov_base,
+                        (const uint8_t*)msg->msg_iov[i].iov_base + part);
+        len += part;
+    }
+
+    *pLen = len;
+
+    return t_Gather.data();
+}
+// ============================================================================
+static ssize_t sendHooked(int s, const struct msghdr* msg, int flags)
+{
+    size_t len = 0;
+    const void* buf = (msg->msg_iovlen > 0) ? gather(msg, SIZE_MAX, &len) : NULL;
+
+    // The hooks take no empty packets
+    if ((buf == NULL) || (len == 0))
+    {
+        return REAL(sendmsg)(s, msg, flags);
+    }
+
+    if (msg->msg_name == NULL)
+    {
+        return g_PktMgr.send_Err(s, (void*)buf, len, flags);
+    }
+
+    return g_PktMgr.sendto_Err(s, (void*)buf, len, flags,
+                               (const struct sockaddr*)msg->msg_name, msg->msg_namelen);
+}
+// ============================================================================
+static void noteReceived(int s, const struct msghdr* msg, size_t len)
+{
+    const void* buf = gather(msg, len, &len);
+    const struct sockaddr* from = (msg->msg_namelen > 0) ? (const struct sockaddr*)msg->msg_name : NULL;
+
+    g_PktMgr.received(s, buf, len, from);
+}
+// ============================================================================
+int socket(int domain, int type, int protocol) __THROW
+{
+    bool isUdpSocket = isUdp(domain, type);
+    int fd = isUdpSocket ? socketMod(domain, type, protocol) : REAL(socket)(domain, type, protocol);
+
+    // Set either way, a close the cache missed may have left the number marked
+    if ((fd >= 0) && (fd < PRELOAD_FD_MAX))
+    {
+        s_FdKind[fd] = isUdpSocket ? FD_HOOKED : FD_OTHER;
+    }
+
+    return fd;
+}
+// ============================================================================
+int close(int fd)
+{
+    forget(fd);
+
+    return REAL(close)(fd);
+}
+// ============================================================================
+int accept(int s, struct sockaddr* addr, socklen_t* addrlen)
+{
+    int fd = REAL(accept)(s, addr, addrlen);
+
+    forget(fd);
+
+    return fd;
+}
+// ============================================================================
+int accept4(int s, struct sockaddr* addr, socklen_t* addrlen, int flags)
+{
+    int fd = REAL(accept4)(s, addr, addrlen, flags);
+
+    forget(fd);
+
+    return fd;
+}
+// ============================================================================
+int dup(int oldfd) __THROW
+{
+    int fd = REAL(dup)(oldfd);
+
+    forget(fd);
+
+    return fd;
+}
+// ============================================================================
+int dup2(int oldfd, int newfd) __THROW
+{
+    int fd = REAL(dup2)(oldfd, newfd);
+
+    forget(fd);
+
+    return fd;
+}
+// ============================================================================
+int dup3(int oldfd, int newfd, int flags) __THROW
+{
+    int fd = REAL(dup3)(oldfd, newfd, flags);
+
+    forget(fd);
+
+    return fd;
+}
+// ============================================================================
+int fcntl(int fd, int cmd, ...)
+{
+    va_list ap;
+
+    // Every command takes one argument or none, passing it on is harmless either way
+    va_start(ap, cmd);
+    void* arg = va_arg(ap, void*);
+    va_end(ap);
+
+    int nResult = REAL(fcntl)(fd, cmd, arg);
+
+    if ((cmd == F_DUPFD) || (cmd == F_DUPFD_CLOEXEC))
+    {
+        forget(nResult);
+    }
+
+    return nResult;
+}
+// ============================================================================
+int bind(int s, const struct sockaddr* addr, socklen_t addrlen) __THROW
+{
+    // The port override is for the program's own UDP socket
+    if (!isHooked(s))
+    {
+        return REAL(bind)(s, addr, addrlen);
+    }
+
+    return bindMod(s, addr, addrlen);
+}
+// ============================================================================
+int connect(int s, const struct sockaddr* addr, socklen_t addrlen)
+{
+    int nResult = REAL(connect)(s, addr, addrlen);
+
+    // Binds it, and the capture's addresses for it change
+    if ((nResult == 0) && isHooked(s))
+    {
+        g_PktMgr.socketChanged(s);
+    }
+
+    return nResult;
+}
+// ============================================================================
+int select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds,
+           struct timeval* timeout)
+{
+    return selectMod(nfds, readfds, writefds, exceptfds, timeout);
+}
+// ============================================================================
+int poll(struct pollfd* fds, nfds_t nfds, int timeout)
+{
+    int nResult = REAL(poll)(fds, nfds, timeout);
+
+    // Same report selectMod() gives a select() that timed out
+    if ((nResult == 0) && (timeout > 0))
+    {
+        DBG_PRINT(DBG_LEVEL_INFO, "Poll Timed Out - pid: %d msec: %d\n", getpid(), timeout);
+    }
+
+    return nResult;
+}
+// ============================================================================
+pid_t fork(void) __THROWNL
+{
+    return forkMod();
+}
+// ============================================================================
+ssize_t send(int s, const void* buf, size_t len, int flags)
+{
+    if ((buf == NULL) || (len == 0) || !isHooked(s))
+    {
+        return REAL(send)(s, buf, len, flags);
+    }
+
+    return g_PktMgr.send_Err(s, (void*)buf, len, flags);
+}
+// ============================================================================
+ssize_t sendto(int s, const void* buf, size_t len, int flags,
+               const struct sockaddr* to, socklen_t tolen)
+{
+    if ((buf == NULL) || (len == 0) || !isHooked(s))
+    {
+        return REAL(sendto)(s, buf, len, flags, to, tolen);
+    }
+
+    // Connected sockets may leave the address out
+    if (to == NULL)
+    {
+        return g_PktMgr.send_Err(s, (void*)buf, len, flags);
+    }
+
+    return g_PktMgr.sendto_Err(s, (void*)buf, len, flags, to, tolen);
+}
+// ============================================================================
+ssize_t sendmsg(int s, const struct msghdr* msg, int flags)
+{
+    if (!isHooked(s))
+    {
+        return REAL(sendmsg)(s, msg, flags);
+    }
+
+    return sendHooked(s, msg, flags);
+}
+// ============================================================================
+int sendmmsg(int s, struct mmsghdr* msgvec, unsigned int vlen, int flags)
+{
+    if (!isHooked(s))
+    {
+        return REAL(sendmmsg)(s, msgvec, vlen, flags);
+    }
+
+    // One at a time, each gets its own events
+    for (unsigned int i = 0; i < vlen; ++i)
+    {
+        ssize_t nSent = sendHooked(s, &msgvec[i].msg_hdr, flags);
+        if (nSent < 0)
+        {
+            return (i > 0) ? (int)i : -1;
+        }
+
+        msgvec[i].msg_len = nSent;
+    }
+
+    return vlen;
+}
+// ============================================================================
+ssize_t recv(int s, void* buf, size_t len, int flags)
+{
+    if (!isHooked(s))
+    {
+        return REAL(recv)(s, buf, len, flags);
+    }
+
+    return g_PktMgr.recv_Mod(s, buf, len, flags);
+}
+// ============================================================================
+ssize_t recvfrom(int s, void* buf, size_t len, int flags,
+                 struct sockaddr* from, socklen_t* fromlen)
+{
+    if (!isHooked(s))
+    {
+        return REAL(recvfrom)(s, buf, len, flags, from, fromlen);
+    }
+
+    return g_PktMgr.recvfrom_Mod(s, buf, len, flags, from, fromlen);
+}
+// ============================================================================
+ssize_t recvmsg(int s, struct msghdr* msg, int flags)
+{
+    ssize_t ret = REAL(recvmsg)(s, msg, flags);
+
+    if ((ret > 0) && isHooked(s))
+    {
+        noteReceived(s, msg, ret);
+    }
+
+    return ret;
+}
+// ============================================================================
+int recvmmsg(int s, struct mmsghdr* msgvec, unsigned int vlen, int flags,
+             struct timespec* timeout)
+{
+    int ret = REAL(recvmmsg)(s, msgvec, vlen, flags, timeout);
+
+    if ((ret > 0) && isHooked(s))
+    {
+        for (int i = 0; i < ret; ++i)
+        {
+            noteReceived(s, &msgvec[i].msg_hdr, msgvec[i].msg_len);
+        }
+    }
+
+    return ret;
+}
+// ============================================================================
+
+#endif
@@ -0,0 +1,713 @@
+#include "dbg_log.h"
+#include "dbg_print.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Room for a MSG record plus the FMT record that may follow it
+#define DBG_LOG_REC_MAX  (DBG_LOG_MSG_HDR + DBG_LOG_MSG_MAX + DBG_LOG_FMT_HDR + DBG_LOG_MSG_MAX)
+#define DBG_LOG_FORMATS  1024
+
+enum { BUF_FREE = 0, BUF_FILLING, BUF_QUEUED, BUF_WRITING };
+
+typedef struct
+{
+    int      state;
+    uint64_t seq;
+    uint64_t firstMs;
+    size_t   used;
+    // Written out by the writer while the thread still fills the buffer
+    size_t   flushed;
+    bool     isFlushing;
+    char     data[DBG_LOG_BUF_SIZE];
+} LogBuf_t;
+
+static int       s_Mode = DBG_MODE_SYNC;
+static int       s_Fd = -1;
+static uint32_t  s_Pid = 0;
+// No writer (at exit, or it could not start): lines go straight to the fd
+static bool      s_Direct = false;
+
+// Allocated as needed, a slot is never freed
+static LogBuf_t* s_Bufs[DBG_LOG_NUM_BUFS];
+static uint64_t  s_Seq = 0;
+
+static pthread_mutex_t s_Lock   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  s_Queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  s_Freed  = PTHREAD_COND_INITIALIZER;
+static pthread_t       s_Writer;
+static bool            s_WriterUp = false;
+static bool            s_Stopping = false;
+static pthread_key_t   s_ThreadKey;
+
+static __thread int      t_Buf = -1;
+static __thread bool     t_HasKey = false;
+static __thread uint32_t t_Tid = 0;
+
+// Addresses of the formats already written out (binary mode)
+static uintptr_t s_Formats[DBG_LOG_FORMATS];
+
+// Lines the binary format cannot carry go out formatted, under this one
+static const char s_TextFmt[] = "%s";
+
+static const int s_CrashSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGINT, SIGTERM};
+
+static void writeAll(const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t nWritten = write(s_Fd, data, len);
+        if (nWritten < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        data += nWritten;
+        len -= nWritten;
+    }
+}
+
+static uint64_t nowMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int oldestQueued(void)
+{
+    int oldest = -1;
+
+    for (int i = 0; i < DBG_LOG_NUM_BUFS; ++i)
+    {
+        if ((s_Bufs[i] != NULL) && (s_Bufs[i]->state == BUF_QUEUED)
+                && ((oldest < 0) || (s_Bufs[i]->seq < s_Bufs[oldest]->seq)))
+        {
+            oldest = i;
+        }
+    }
+
+    return oldest;
+}
+
+// A buffer of a thread that went quiet, its oldest unwritten line past the handover time
+static int staleFilling(bool* pAnyFilling)
+{
+    uint64_t now = nowMs();
+
+    *pAnyFilling = false;
+
+    for (int i = 0; i < DBG_LOG_NUM_BUFS; ++i)
+    {
+        if ((s_Bufs[i] == NULL) || (s_Bufs[i]->state != BUF_FILLING))
+        {
+            continue;
+        }
+
+        *pAnyFilling = true;
+
+        if ((__atomic_load_n(&s_Bufs[i]->used, __ATOMIC_ACQUIRE) > s_Bufs[i]->flushed)
+                && (now - __atomic_load_n(&s_Bufs[i]->firstMs, __ATOMIC_RELAXED) >= DBG_LOG_FLUSH_MS))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Writes the whole records a thread has put in its buffer so far, it keeps filling it
+static void flushFilling(LogBuf_t* pBuf)
+{
+    size_t from = pBuf->flushed;
+    size_t to = __atomic_load_n(&pBuf->used, __ATOMIC_ACQUIRE);
+
+    pBuf->isFlushing = true;
+    __atomic_store_n(&pBuf->firstMs, nowMs(), __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&s_Lock);
+    writeAll(pBuf->data + from, to - from);
+    pthread_mutex_lock(&s_Lock);
+
+    __atomic_store_n(&pBuf->flushed, to, __ATOMIC_RELEASE);
+    pBuf->isFlushing = false;
+}
+
+static void* writerMain(void* arg)
+{
+    pthread_mutex_lock(&s_Lock);
+
+    while (true)
+    {
+        bool anyFilling = false;
+        int i = oldestQueued();
+
+        if ((i < 0) && ((i = staleFilling(&anyFilling)) >= 0))
+        {
+            flushFilling(s_Bufs[i]);
+            continue;
+        }
+
+        if (i < 0)
+        {
+            if (s_Stopping)
+            {
+                break;
+            }
+
+            if (!anyFilling)
+            {
+                pthread_cond_wait(&s_Queued, &s_Lock);
+                continue;
+            }
+
+            // A thread that logs and then blocks never hands its buffer over, go get it
+            struct timespec until;
+
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += (long)DBG_LOG_FLUSH_MS * 1000000;
+            until.tv_sec += until.tv_nsec / 1000000000;
+            until.tv_nsec %= 1000000000;
+
+            pthread_cond_timedwait(&s_Queued, &s_Lock, &until);
+            continue;
+        }
+
+        LogBuf_t* pBuf = s_Bufs[i];
+        pBuf->state = BUF_WRITING;
+
+        pthread_mutex_unlock(&s_Lock);
+        writeAll(pBuf->data + pBuf->flushed, pBuf->used - pBuf->flushed);
+        pthread_mutex_lock(&s_Lock);
+
+        pBuf->used = 0;
+        pBuf->flushed = 0;
+        pBuf->state = BUF_FREE;
+        pthread_cond_broadcast(&s_Freed);
+    }
+
+    pthread_mutex_unlock(&s_Lock);
+
+    return NULL;
+}
+
+// Returns a buffer for the calling thread, -1 to write the line directly
+static int acquireBuf(void)
+{
+    int idx = -1;
+
+    pthread_mutex_lock(&s_Lock);
+
+    if (!s_WriterUp && !s_Direct)
+    {
+        if (pthread_create(&s_Writer, NULL, writerMain, NULL) == 0)
+        {
+            s_WriterUp = true;
+        }
+        else
+        {
+            s_Direct = true;
+        }
+    }
+
+    while (!s_Direct)
+    {
+        bool inFlight = false;
+
+        for (int i = 0; (i < DBG_LOG_NUM_BUFS) && (idx < 0); ++i)
+        {
+            if (s_Bufs[i] == NULL)
+            {
+                continue;
+            }
+
+            if (s_Bufs[i]->state == BUF_FREE)
+            {
+                idx = i;
+            }
+            inFlight |= (s_Bufs[i]->state == BUF_QUEUED) || (s_Bufs[i]->state == BUF_WRITING);
+        }
+
+        for (int i = 0; (i < DBG_LOG_NUM_BUFS) && (idx < 0); ++i)
+        {
+            if ((s_Bufs[i] == NULL)
+                    && ((s_Bufs[i] = (LogBuf_t*)malloc(sizeof(LogBuf_t))) != NULL))
+            {
+                s_Bufs[i]->state = BUF_FREE;
+                s_Bufs[i]->used = 0;
+                s_Bufs[i]->flushed = 0;
+                s_Bufs[i]->isFlushing = false;
+                idx = i;
+            }
+        }
+
+        // The writer is behind, wait for it rather than lose lines
+        if ((idx >= 0) || !inFlight)
+        {
+            break;
+        }
+        pthread_cond_wait(&s_Freed, &s_Lock);
+    }
+
+    if (idx >= 0)
+    {
+        s_Bufs[idx]->state = BUF_FILLING;
+        s_Bufs[idx]->used = 0;
+        s_Bufs[idx]->flushed = 0;
+    }
+
+    pthread_mutex_unlock(&s_Lock);
+
+    if ((idx >= 0) && !t_HasKey)
+    {
+        // Only there so threadExit() runs for this thread
+        pthread_setspecific(s_ThreadKey, (void*)1);
+        t_HasKey = true;
+    }
+
+    return idx;
+}
+
+static void queueBuf(int idx)
+{
+    LogBuf_t* pBuf = s_Bufs[idx];
+
+    pthread_mutex_lock(&s_Lock);
+
+    // Unless the writer has part of it out right now, it drains the queue before it stops
+    if (s_Direct && !pBuf->isFlushing)
+    {
+        writeAll(pBuf->data + pBuf->flushed, pBuf->used - pBuf->flushed);
+        pBuf->used = 0;
+        pBuf->flushed = 0;
+    }
+
+    if (pBuf->used == 0)
+    {
+        pBuf->state = BUF_FREE;
+        pthread_cond_broadcast(&s_Freed);
+    }
+    else
+    {
+        pBuf->seq = s_Seq++;
+        pBuf->state = BUF_QUEUED;
+        pthread_cond_signal(&s_Queued);
+    }
+
+    pthread_mutex_unlock(&s_Lock);
+}
+
+// No locks, also runs from the crash handler
+static void writeLeftovers(void)
+{
+    int i;
+
+    // Queued ones in the order they were queued, then the ones being filled
+    while ((i = oldestQueued()) >= 0)
+    {
+        writeAll(s_Bufs[i]->data + s_Bufs[i]->flushed, s_Bufs[i]->used - s_Bufs[i]->flushed);
+        s_Bufs[i]->used = 0;
+        s_Bufs[i]->flushed = 0;
+        s_Bufs[i]->state = BUF_FREE;
+    }
+
+    for (i = 0; i < DBG_LOG_NUM_BUFS; ++i)
+    {
+        if ((s_Bufs[i] != NULL) && (s_Bufs[i]->state == BUF_FILLING))
+        {
+            size_t flushed = __atomic_load_n(&s_Bufs[i]->flushed, __ATOMIC_ACQUIRE);
+
+            writeAll(s_Bufs[i]->data + flushed, __atomic_load_n(&s_Bufs[i]->used, __ATOMIC_ACQUIRE) - flushed);
+            s_Bufs[i]->used = 0;
+            s_Bufs[i]->flushed = 0;
+        }
+    }
+}
+
+static void append(const char* rec, size_t len, bool isUrgent)
+{
+    if ((t_Buf < 0) && !__atomic_load_n(&s_Direct, __ATOMIC_RELAXED))
+    {
+        t_Buf = acquireBuf();
+    }
+
+    if ((t_Buf < 0) || __atomic_load_n(&s_Direct, __ATOMIC_RELAXED))
+    {
+        writeAll(rec, len);
+        return;
+    }
+
+    LogBuf_t* pBuf = s_Bufs[t_Buf];
+
+    if (pBuf->used + len > DBG_LOG_BUF_SIZE)
+    {
+        queueBuf(t_Buf);
+
+        if ((t_Buf = acquireBuf()) < 0)
+        {
+            writeAll(rec, len);
+            return;
+        }
+        pBuf = s_Bufs[t_Buf];
+    }
+
+    uint64_t now = nowMs();
+
+    // The oldest line the writer has not taken yet
+    if (pBuf->used == __atomic_load_n(&pBuf->flushed, __ATOMIC_ACQUIRE))
+    {
+        __atomic_store_n(&pBuf->firstMs, now, __ATOMIC_RELAXED);
+    }
+
+    memcpy(pBuf->data + pBuf->used, rec, len);
+    // The crash handler only ever sees whole records
+    __atomic_store_n(&pBuf->used, pBuf->used + len, __ATOMIC_RELEASE);
+
+    if (isUrgent || (now - __atomic_load_n(&pBuf->firstMs, __ATOMIC_RELAXED) >= DBG_LOG_FLUSH_MS))
+    {
+        queueBuf(t_Buf);
+        t_Buf = -1;
+    }
+}
+
+// True the first time a format is seen (and when the table is full)
+static bool isNewFormat(const char* fmt)
+{
+    uintptr_t addr = (uintptr_t)fmt;
+    size_t slot = (size_t)(((uint64_t)addr * 0x9E3779B97F4A7C15ULL) >> 54) % DBG_LOG_FORMATS;
+
+    for (int n = 0; n < DBG_LOG_FORMATS; ++n, slot = (slot + 1) % DBG_LOG_FORMATS)
+    {
+        uintptr_t cur = __atomic_load_n(&s_Formats[slot], __ATOMIC_ACQUIRE);
+
+        if ((cur == 0) && __atomic_compare_exchange_n(&s_Formats[slot], &cur, addr, false,
+                                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return true;
+        }
+        if (cur == addr)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static char* put(char* p, const void* val, size_t len)
+{
+    memcpy(p, val, len);
+    return p + len;
+}
+
+// Returns the record length, -1 for a format the binary records cannot carry
+static int encodeBinary(char* rec, const char* fmt, va_list ap)
+{
+    struct timespec ts;
+    uint64_t addr = (uintptr_t)fmt;
+    uint64_t ns;
+    char* p = rec;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    if (t_Tid == 0)
+    {
+        t_Tid = (uint32_t)syscall(SYS_gettid);
+    }
+
+    *p++ = DBG_LOG_REC_MSG;
+    p = put(p, &addr, 8);
+    p = put(p, &ns, 8);
+    p = put(p, &s_Pid, 4);
+    p = put(p, &t_Tid, 4);
+
+    char* pArgLen = p;
+    char* pArgs = p + 2;
+    char* pArgsEnd = pArgs + DBG_LOG_MSG_MAX;
+
+    p = pArgs;
+
+    for (const char* f = fmt; *f != '\0'; ++f)
+    {
+        int stars;
+        int type;
+
+        if (*f != '%')
+        {
+            continue;
+        }
+
+        if ((f = dbg_log_spec(f + 1, &stars, &type)) == NULL)
+        {
+            return -1;
+        }
+        --f;
+
+        int64_t vInt = 0;
+        double  vDbl = 0;
+
+        for (int i = 0; i < stars; ++i)
+        {
+            vInt = va_arg(ap, int);
+            if (p + 8 > pArgsEnd)
+            {
+                return -1;
+            }
+            p = put(p, &vInt, 8);
+        }
+
+        switch (type)
+        {
+            case DBG_ARG_NONE:
+                continue;
+
+            case DBG_ARG_STR:
+            {
+                const char* str = va_arg(ap, const char*);
+                str = (str != NULL) ? str : "(null)";
+
+                if (p + 2 > pArgsEnd)
+                {
+                    return -1;
+                }
+
+                // Cut to what is left of the record
+                uint16_t strLen = (uint16_t)strnlen(str, pArgsEnd - p - 2);
+                p = put(p, &strLen, 2);
+                p = put(p, str, strLen);
+                continue;
+            }
+
+            case DBG_ARG_INT:     vInt = va_arg(ap, int); break;
+            case DBG_ARG_LONG:    vInt = va_arg(ap, long); break;
+            case DBG_ARG_LLONG:   vInt = va_arg(ap, long long); break;
+            case DBG_ARG_SIZE:    vInt = va_arg(ap, size_t); break;
+            case DBG_ARG_INTMAX:  vInt = va_arg(ap, intmax_t); break;
+            case DBG_ARG_PTRDIFF: vInt = va_arg(ap, ptrdiff_t); break;
+            case DBG_ARG_PTR:     vInt = (intptr_t)va_arg(ap, void*); break;
+            case DBG_ARG_DOUBLE:  vDbl = va_arg(ap, double); break;
+            case DBG_ARG_LDOUBLE: vDbl = (double)va_arg(ap, long double); break;
+        }
+
+        if (p + 8 > pArgsEnd)
+        {
+            return -1;
+        }
+        p = put(p, ((type == DBG_ARG_DOUBLE) || (type == DBG_ARG_LDOUBLE)) ?
+                   (const void*)&vDbl : (const void*)&vInt, 8);
+    }
+
+    uint16_t argLen = (uint16_t)(p - pArgs);
+    put(pArgLen, &argLen, 2);
+
+    if (isNewFormat(fmt))
+    {
+        uint16_t fmtLen = (uint16_t)strnlen(fmt, DBG_LOG_MSG_MAX);
+
+        *p++ = DBG_LOG_REC_FMT;
+        p = put(p, &addr, 8);
+        p = put(p, &fmtLen, 2);
+        p = put(p, fmt, fmtLen);
+    }
+
+    return (int)(p - rec);
+}
+
+static int encodeBinaryF(char* rec, const char* fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = encodeBinary(rec, fmt, ap);
+    va_end(ap);
+
+    return len;
+}
+
+static void threadExit(void* arg)
+{
+    if (t_Buf >= 0)
+    {
+        queueBuf(t_Buf);
+        t_Buf = -1;
+    }
+}
+
+static void exitFlush(void)
+{
+    pthread_mutex_lock(&s_Lock);
+
+    bool isJoining = s_WriterUp;
+
+    __atomic_store_n(&s_Direct, true, __ATOMIC_RELAXED);
+    s_Stopping = true;
+    s_WriterUp = false;
+    pthread_cond_signal(&s_Queued);
+
+    pthread_mutex_unlock(&s_Lock);
+
+    // It drains the queue before it stops
+    if (isJoining)
+    {
+        pthread_join(s_Writer, NULL);
+    }
+
+    writeLeftovers();
+    t_Buf = -1;
+}
+
+static void crashFlush(int sig)
+{
+    writeLeftovers();
+
+    // SA_RESETHAND put the default action back, it runs once we return
+    raise(sig);
+}
+
+static void forkPrepare(void)
+{
+    pthread_mutex_lock(&s_Lock);
+}
+
+static void forkParent(void)
+{
+    pthread_mutex_unlock(&s_Lock);
+}
+
+static void forkChild(void)
+{
+    // The writer did not come along, and what is buffered is the parent's to write
+    pthread_mutex_init(&s_Lock, NULL);
+    pthread_cond_init(&s_Queued, NULL);
+    pthread_cond_init(&s_Freed, NULL);
+
+    for (int i = 0; i < DBG_LOG_NUM_BUFS; ++i)
+    {
+        if (s_Bufs[i] != NULL)
+        {
+            s_Bufs[i]->state = BUF_FREE;
+            s_Bufs[i]->used = 0;
+            s_Bufs[i]->flushed = 0;
+            s_Bufs[i]->isFlushing = false;
+        }
+    }
+
+    s_WriterUp = false;
+    s_Stopping = false;
+    s_Pid = getpid();
+    t_Buf = -1;
+    t_Tid = 0;
+}
+
+int dbg_log_open(int mode, const char* path)
+{
+    char defPath[32];
+
+    if (s_Mode != DBG_MODE_SYNC)
+    {
+        return -1;
+    }
+
+    if ((mode == DBG_MODE_BINARY) && (path == NULL))
+    {
+        snprintf(defPath, sizeof(defPath), "cpe464log.%u", (unsigned)getpid());
+        path = defPath;
+    }
+
+    if (path != NULL)
+    {
+        // Appending, so forked children writing the same file do not clobber it
+        s_Fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (s_Fd < 0)
+        {
+            ERR_PRINT("open %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+    else
+    {
+        s_Fd = STDERR_FILENO;
+    }
+
+    if (mode == DBG_MODE_BINARY)
+    {
+        writeAll(DBG_LOG_MAGIC, strlen(DBG_LOG_MAGIC));
+    }
+
+    s_Pid = getpid();
+
+    pthread_key_create(&s_ThreadKey, threadExit);
+    pthread_atfork(forkPrepare, forkParent, forkChild);
+    atexit(exitFlush);
+
+    for (size_t i = 0; i < sizeof(s_CrashSignals) / sizeof(s_CrashSignals[0]); ++i)
+    {
+        struct sigaction act;
+
+        // Leaves alone any handler the program already has
+        if ((sigaction(s_CrashSignals[i], NULL, &act) < 0) || (act.sa_handler != SIG_DFL)
+                || (act.sa_flags & SA_SIGINFO))
+        {
+            continue;
+        }
+
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = crashFlush;
+        act.sa_flags = SA_RESETHAND;
+        sigemptyset(&act.sa_mask);
+        sigaction(s_CrashSignals[i], &act, NULL);
+    }
+
+    s_Mode = mode;
+
+    return 0;
+}
+
+void dbg_log_vwrite(int level, const char* fmt, va_list ap)
+{
+    char rec[DBG_LOG_REC_MAX];
+    int len;
+
+    if (s_Mode == DBG_MODE_BINARY)
+    {
+        va_list apCopy;
+
+        va_copy(apCopy, ap);
+        len = encodeBinary(rec, fmt, apCopy);
+        va_end(apCopy);
+
+        if (len < 0)
+        {
+            char line[DBG_LOG_MSG_MAX];
+
+            vsnprintf(line, sizeof(line), fmt, ap);
+            len = encodeBinaryF(rec, s_TextFmt, line);
+        }
+    }
+    else
+    {
+        len = vsnprintf(rec, DBG_LOG_MSG_MAX, fmt, ap);
+        len = (len < DBG_LOG_MSG_MAX) ? len : DBG_LOG_MSG_MAX - 1;
+    }
+
+    if (len > 0)
+    {
+        // Errors go out now, the program may be about to stop
+        append(rec, len, level == DBG_LEVEL_ERROR);
+    }
+}
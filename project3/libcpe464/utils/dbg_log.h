@@ -0,0 +1,161 @@
+/**
+ *  Buffered backends for dbg_print
+ *
+ *  Async: each thread formats into a buffer of its own and hands it to a
+ *  writer thread when full, so a slow terminal or pipe no longer holds up
+ *  the caller. Lines from different threads interleave a buffer at a time.
+ *
+ *  Binary: nothing is formatted. A record holds the format string's address
+ *  and the raw arguments, the format text itself goes out once, the first
+ *  time it is used. logdump turns the file back into text.
+ *
+ *  Buffers are written out when full, once their oldest line is
+ *  DBG_LOG_FLUSH_MS old, at exit and on a crash signal. The age is checked on
+ *  the thread's next line and by the writer, which takes what a thread that
+ *  went quiet (blocked in poll, hung) has buffered while it keeps the buffer.
+ *  A forked child starts with no buffers, the parent writes its own.
+ *
+ *  Binary file layout (host byte order): DBG_LOG_MAGIC, then records
+ *    FMT  u8 type, u64 format address, u16 length, text (no NUL)
+ *    MSG  u8 type, u64 format address, u64 ns (CLOCK_REALTIME), u32 pid,
+ *         u32 tid, u16 length of the arguments, arguments
+ *  An argument is 8 bytes (integers widened, floating point as a double) or,
+ *  for %s, a u16 length and the bytes.
+ */
+
+#ifndef __DBG_LOG_H
+#define __DBG_LOG_H
+
+// ============================================================================
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+// ============================================================================
+#define DBG_LOG_BUF_SIZE   (64 * 1024)
+#define DBG_LOG_NUM_BUFS   32
+#define DBG_LOG_MSG_MAX    1024
+#define DBG_LOG_FLUSH_MS   100
+// ============================================================================
+#define DBG_LOG_MAGIC      "CPE464L1"
+#define DBG_LOG_REC_FMT    1
+#define DBG_LOG_REC_MSG    2
+
+#define DBG_LOG_FMT_HDR    (1 + 8 + 2)
+#define DBG_LOG_MSG_HDR    (1 + 8 + 8 + 4 + 4 + 2)
+
+enum eDbgArg_t
+{
+    DBG_ARG_NONE = 0,
+    DBG_ARG_INT,
+    DBG_ARG_LONG,
+    DBG_ARG_LLONG,
+    DBG_ARG_SIZE,
+    DBG_ARG_INTMAX,
+    DBG_ARG_PTRDIFF,
+    DBG_ARG_DOUBLE,
+    DBG_ARG_LDOUBLE,
+    DBG_ARG_STR,
+    DBG_ARG_PTR
+};
+// ============================================================================
+/**
+ * Scans one conversion, p just past its '%'. Returns the character after it,
+ * NULL for one the binary format cannot carry (%n, wide strings, ...).
+ * *pStars counts the '*' int arguments that come before the value.
+ */
+static inline const char* dbg_log_spec(const char* p, int* pStars, int* pType)
+{
+    int length = DBG_ARG_INT;
+
+    *pStars = 0;
+    *pType = DBG_ARG_NONE;
+
+    if (*p == '%')
+    {
+        return p + 1;
+    }
+
+    while ((*p != '\0') && (strchr("-+ #0'", *p) != NULL))
+    {
+        ++p;
+    }
+
+    // Width, then precision
+    if (*p == '*')
+    {
+        ++*pStars;
+        ++p;
+    }
+    while ((*p >= '0') && (*p <= '9'))
+    {
+        ++p;
+    }
+
+    if (*p == '.')
+    {
+        ++p;
+        if (*p == '*')
+        {
+            ++*pStars;
+            ++p;
+        }
+        while ((*p >= '0') && (*p <= '9'))
+        {
+            ++p;
+        }
+    }
+
+    switch (*p)
+    {
+        case 'h': ++p; if (*p == 'h') ++p; break;
+        case 'l': ++p; length = DBG_ARG_LONG; if (*p == 'l') { ++p; length = DBG_ARG_LLONG; } break;
+        case 'q': ++p; length = DBG_ARG_LLONG; break;
+        case 'z': ++p; length = DBG_ARG_SIZE; break;
+        case 'j': ++p; length = DBG_ARG_INTMAX; break;
+        case 't': ++p; length = DBG_ARG_PTRDIFF; break;
+        case 'L': ++p; length = DBG_ARG_LDOUBLE; break;
+    }
+
+    switch (*p)
+    {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            *pType = (length == DBG_ARG_LDOUBLE) ? DBG_ARG_LLONG : length;
+            break;
+
+        case 'c':
+            if (length != DBG_ARG_INT)
+            {
+                return NULL;
+            }
+            *pType = DBG_ARG_INT;
+            break;
+
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            *pType = (length == DBG_ARG_LDOUBLE) ? DBG_ARG_LDOUBLE : DBG_ARG_DOUBLE;
+            break;
+
+        case 's':
+            if (length != DBG_ARG_INT)
+            {
+                return NULL;
+            }
+            *pType = DBG_ARG_STR;
+            break;
+
+        case 'p':
+            *pType = DBG_ARG_PTR;
+            break;
+
+        default:
+            return NULL;
+    }
+
+    return p + 1;
+}
+// ============================================================================
+// Library side, called by dbg_print
+int  dbg_log_open(int mode, const char* path);
+void dbg_log_vwrite(int level, const char* fmt, va_list ap);
+// ============================================================================
+
+#endif
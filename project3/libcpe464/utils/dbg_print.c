@@ -1,4 +1,5 @@
 #include "dbg_print.h"
+#include "dbg_log.h"
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -7,6 +8,7 @@
 
 static FILE* g_dbg_print_file  = DEFAULT_FILE;
 static int   g_dbg_print_level = DBG_LEVEL_VDEBUG;
+static int   g_dbg_print_mode  = DBG_MODE_SYNC;
 
 void dbg_print(int level, const char* fmt, ...)
 {
@@ -18,6 +20,14 @@ void dbg_print(int level, const char* fmt, ...)
         return;
     }
 
+    if (g_dbg_print_mode != DBG_MODE_SYNC)
+    {
+        va_start(ap, fmt);
+        dbg_log_vwrite(level, fmt, ap);
+        va_end(ap);
+        return;
+    }
+
     // HACK: for some reason, this variable is not init'd on Ubuntu 11
     if (g_dbg_print_file == NULL)
     {
@@ -34,3 +44,25 @@ void dbg_setlevel(int newLevel)
 {
     g_dbg_print_level = newLevel;
 }
+
+int dbg_setmode(int mode, const char* path)
+{
+    if ((mode == DBG_MODE_SYNC) || (g_dbg_print_mode != DBG_MODE_SYNC))
+    {
+        return (mode == g_dbg_print_mode) ? 0 : -1;
+    }
+
+    if (dbg_log_open(mode, path) < 0)
+    {
+        return -1;
+    }
+
+    g_dbg_print_mode = mode;
+
+    return 0;
+}
+
+int dbg_enabled(int level)
+{
+    return (level == DBG_LEVEL_ERROR) || (g_dbg_print_level >= level);
+}
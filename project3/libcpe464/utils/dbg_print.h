@@ -2,6 +2,10 @@
  *  A macro-based, variable-level debug printing functions
  *
  *  There are 5 levels available ranging from -1 (ERR) to 3 (VDBG)
+ *
+ *  Output is written and flushed line by line (sync), or buffered per thread
+ *  and written by a background thread, as text (async) or as binary records
+ *  that logdump formats later. See dbg_log.h.
  */
 
 #ifndef __DBG_PRINT_H
@@ -16,6 +20,10 @@
 #define DBG_LEVEL_INFO    1
 #define DBG_LEVEL_DEBUG   2
 #define DBG_LEVEL_VDEBUG  3
+
+#define DBG_MODE_SYNC     0
+#define DBG_MODE_ASYNC    1
+#define DBG_MODE_BINARY   2
 // ============================================================================
 #define PRINT_VERBOSE(LVL, FMT, ...) \
     dbg_print(LVL, "  (%u)(%-20s(%4u)::%-12s - " FMT, \
@@ -38,6 +46,10 @@
 // ============================================================================
 void dbg_print(int level, const char* fmt, ...);
 void dbg_setlevel(int newLevel);
+// Lets callers skip building output nobody will see
+int  dbg_enabled(int level);
+// Once only, path NULL for stderr (binary: cpe464log.<pid>)
+int  dbg_setmode(int mode, const char* path);
 // ============================================================================
 
 #endif
@@ -0,0 +1,392 @@
+// Formats the binary debug log libcpe464 writes with CPE464_LOG=binary.
+//
+// logdump [-t] log-file...
+//   -t  prefix each line with its time, pid and thread id
+//
+// Lines of every file are merged into one timeline.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libcpe464/utils/dbg_log.h"
+
+// Addresses only mean something within the program that wrote the file
+typedef struct {
+	uint32_t file;
+	uint64_t address;
+	const char* text;
+	uint16_t length;
+} LogFormat_t;
+
+typedef struct {
+	uint32_t file;
+	uint64_t address;
+	uint64_t ns;
+	uint32_t pid;
+	uint32_t tid;
+	const uint8_t* args;
+	uint16_t argsLength;
+	uint64_t order;
+} LogLine_t;
+
+static LogFormat_t* formats = NULL;
+static size_t numFormats = 0;
+static size_t formatsMax = 0;
+
+static LogLine_t* lines = NULL;
+static size_t numLines = 0;
+static size_t linesMax = 0;
+
+static void*
+grow(
+	void* array,
+	size_t* maxPtr,
+	size_t elementSize
+){
+	*maxPtr = (*maxPtr == 0) ? 4096 : *maxPtr * 2;
+
+	if((array = realloc(array, *maxPtr * elementSize)) == NULL){
+		perror("logdump: realloc() error");
+		exit(1);
+	}
+
+	return array;
+}
+
+static uint8_t*
+readFile(
+	const char* path,
+	size_t* lengthPtr
+){
+	FILE* file;
+	uint8_t* data;
+	long length;
+
+	if((file = fopen(path, "rb")) == NULL){
+		perror(path);
+		return NULL;
+	}
+
+	if(fseek(file, 0, SEEK_END) < 0 || (length = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) < 0){
+		perror(path);
+		fclose(file);
+		return NULL;
+	}
+
+	if((data = (uint8_t*) malloc(length + 1)) == NULL || fread(data, 1, length, file) != (size_t) length){
+		fprintf(stderr, "%s: read failed\n", path);
+		free(data);
+		fclose(file);
+		return NULL;
+	}
+
+	fclose(file);
+	*lengthPtr = length;
+
+	return data;
+}
+
+// The data is kept for the whole run, formats and lines point into it
+static bool
+loadLog(
+	const char* path,
+	uint32_t fileIndex
+){
+	size_t length;
+	uint8_t* data;
+
+	if((data = readFile(path, &length)) == NULL){
+		return false;
+	}
+
+	size_t magicLength = strlen(DBG_LOG_MAGIC);
+
+	if(length < magicLength || memcmp(data, DBG_LOG_MAGIC, magicLength) != 0){
+		fprintf(stderr, "%s: not a libcpe464 binary log\n", path);
+		free(data);
+		return false;
+	}
+
+	const uint8_t* p = data + magicLength;
+	const uint8_t* end = data + length;
+
+	while(p < end){
+		if(*p == DBG_LOG_REC_FMT && end - p >= DBG_LOG_FMT_HDR){
+			LogFormat_t format;
+
+			format.file = fileIndex;
+			memcpy(&format.address, p + 1, 8);
+			memcpy(&format.length, p + 9, 2);
+			format.text = (const char*) p + DBG_LOG_FMT_HDR;
+
+			if(end - p < DBG_LOG_FMT_HDR + format.length){
+				break;
+			}
+
+			if(numFormats == formatsMax){
+				formats = (LogFormat_t*) grow(formats, &formatsMax, sizeof(LogFormat_t));
+			}
+			formats[numFormats++] = format;
+
+			p += DBG_LOG_FMT_HDR + format.length;
+		} else if(*p == DBG_LOG_REC_MSG && end - p >= DBG_LOG_MSG_HDR){
+			LogLine_t line;
+
+			line.file = fileIndex;
+			memcpy(&line.address, p + 1, 8);
+			memcpy(&line.ns, p + 9, 8);
+			memcpy(&line.pid, p + 17, 4);
+			memcpy(&line.tid, p + 21, 4);
+			memcpy(&line.argsLength, p + 25, 2);
+			line.args = p + DBG_LOG_MSG_HDR;
+			line.order = numLines;
+
+			if(end - p < DBG_LOG_MSG_HDR + line.argsLength){
+				break;
+			}
+
+			if(numLines == linesMax){
+				lines = (LogLine_t*) grow(lines, &linesMax, sizeof(LogLine_t));
+			}
+			lines[numLines++] = line;
+
+			p += DBG_LOG_MSG_HDR + line.argsLength;
+		} else {
+			break;
+		}
+	}
+
+	if(p < end){
+		fprintf(stderr, "%s: damaged or truncated at offset %zu\n", path, (size_t) (p - data));
+	}
+
+	return true;
+}
+
+static int
+compareAddress(
+	const void* a,
+	const void* b
+){
+	const LogFormat_t* formatA = (const LogFormat_t*) a;
+	const LogFormat_t* formatB = (const LogFormat_t*) b;
+
+	if(formatA->file != formatB->file){
+		return (formatA->file < formatB->file) ? -1 : 1;
+	}
+	if(formatA->address != formatB->address){
+		return (formatA->address < formatB->address) ? -1 : 1;
+	}
+	return 0;
+}
+
+static int
+compareTime(
+	const void* a,
+	const void* b
+){
+	const LogLine_t* lineA = (const LogLine_t*) a;
+	const LogLine_t* lineB = (const LogLine_t*) b;
+
+	if(lineA->ns != lineB->ns){
+		return (lineA->ns < lineB->ns) ? -1 : 1;
+	}
+
+	// Keeps the file order for lines in the same nanosecond
+	return (lineA->order < lineB->order) ? -1 : 1;
+}
+
+static bool
+takeArg(
+	const uint8_t** pPtr,
+	const uint8_t* end,
+	void* value
+){
+	if(end - *pPtr < 8){
+		return false;
+	}
+
+	memcpy(value, *pPtr, 8);
+	*pPtr += 8;
+
+	return true;
+}
+
+#define PRINT_ARG(VALUE) \
+	switch(stars){ \
+	case 0: printf(spec, VALUE); break; \
+	case 1: printf(spec, star[0], VALUE); break; \
+	default: printf(spec, star[0], star[1], VALUE); break; \
+	}
+
+// Returns whether what it printed ended the line
+static bool
+printLine(
+	const LogLine_t* linePtr,
+	const LogFormat_t* format
+){
+	const uint8_t* p = linePtr->args;
+	const uint8_t* end = linePtr->args + linePtr->argsLength;
+	const char* f = format->text;
+	const char* fEnd = format->text + format->length;
+	bool endsLine = false;
+
+	while(f < fEnd){
+		char spec[64];
+		int stars;
+		int type;
+		int star[2] = {0, 0};
+		const char* next;
+
+		if(*f != '%'){
+			endsLine = (*f == '\n');
+			putchar(*f++);
+			continue;
+		}
+
+		// The text has no NUL of its own, copy the conversion out first
+		size_t specLength = (size_t) (fEnd - f) < sizeof(spec) - 1 ? (size_t) (fEnd - f) : sizeof(spec) - 1;
+		memcpy(spec, f, specLength);
+		spec[specLength] = '\0';
+
+		if((next = dbg_log_spec(spec + 1, &stars, &type)) == NULL){
+			printf("<bad format>\n");
+			return true;
+		}
+		spec[next - spec] = '\0';
+		f += next - spec;
+
+		for(int i = 0; i < stars; i++){
+			int64_t value;
+
+			if(!takeArg(&p, end, &value)){
+				printf("<missing argument>\n");
+				return true;
+			}
+			star[i] = (int) value;
+		}
+
+		endsLine = false;
+
+		if(type == DBG_ARG_NONE){
+			putchar('%');
+			continue;
+		}
+
+		if(type == DBG_ARG_STR){
+			char text[DBG_LOG_MSG_MAX + 1];
+			uint16_t length;
+
+			if(end - p < 2 || (memcpy(&length, p, 2), end - p - 2 < length)){
+				printf("<missing argument>\n");
+				return true;
+			}
+			memcpy(text, p + 2, length);
+			text[length] = '\0';
+			p += 2 + length;
+
+			PRINT_ARG(text);
+			endsLine = (length > 0 && text[length - 1] == '\n');
+			continue;
+		}
+
+		int64_t value;
+		double valueDouble;
+
+		if(!takeArg(&p, end, (type == DBG_ARG_DOUBLE || type == DBG_ARG_LDOUBLE) ? (void*) &valueDouble : (void*) &value)){
+			printf("<missing argument>\n");
+			return true;
+		}
+
+		switch(type){
+		case DBG_ARG_INT:     PRINT_ARG((int) value); break;
+		case DBG_ARG_LONG:    PRINT_ARG((long) value); break;
+		case DBG_ARG_LLONG:   PRINT_ARG((long long) value); break;
+		case DBG_ARG_SIZE:    PRINT_ARG((size_t) value); break;
+		case DBG_ARG_INTMAX:  PRINT_ARG((intmax_t) value); break;
+		case DBG_ARG_PTRDIFF: PRINT_ARG((ptrdiff_t) value); break;
+		case DBG_ARG_PTR:     PRINT_ARG((void*) (intptr_t) value); break;
+		case DBG_ARG_DOUBLE:  PRINT_ARG(valueDouble); break;
+		case DBG_ARG_LDOUBLE: PRINT_ARG((long double) valueDouble); break;
+		}
+	}
+
+	return endsLine;
+}
+
+static void
+printLines(
+	bool showTime
+){
+	uint64_t startNs = (numLines > 0) ? lines[0].ns : 0;
+	bool atLineStart = true;
+
+	for(size_t i = 0; i < numLines; i++){
+		LogFormat_t key;
+		const LogFormat_t* format;
+
+		// A line is often printed in pieces, only its first one gets the prefix
+		if(showTime && atLineStart){
+			printf("%10.6f [%u/%u] ", (lines[i].ns - startNs) / 1000000000.0, lines[i].pid, lines[i].tid);
+		}
+
+		key.file = lines[i].file;
+		key.address = lines[i].address;
+		format = (const LogFormat_t*) bsearch(&key, formats, numFormats, sizeof(LogFormat_t), compareAddress);
+
+		if(format == NULL){
+			printf("<format %#llx not in the log>\n", (unsigned long long) lines[i].address);
+			atLineStart = true;
+			continue;
+		}
+
+		atLineStart = printLine(&lines[i], format);
+	}
+}
+
+int
+main(
+	int argc,
+	char* argv[]
+){
+	bool showTime = false;
+	int opt;
+
+	while((opt = getopt(argc, argv, "t")) != -1){
+		switch(opt){
+		case 't':
+			showTime = true;
+			break;
+		default:
+			argc = 0;
+			break;
+		}
+	}
+
+	if(argc - optind < 1){
+		fprintf(stderr, "Usage: %s [-t] log-file...\n", argv[0]);
+		fprintf(stderr, "  -t  prefix lines with time, pid and thread id\n");
+		return 1;
+	}
+
+	int status = 0;
+
+	for(int i = optind; i < argc; i++){
+		if(!loadLog(argv[i], i)){
+			status = 1;
+		}
+	}
+
+	// Formats may follow their first use (another thread's buffer went out first)
+	qsort(formats, numFormats, sizeof(LogFormat_t), compareAddress);
+	qsort(lines, numLines, sizeof(LogLine_t), compareTime);
+
+	printLines(showTime);
+
+	return status;
+}
@@ -176,6 +176,68 @@ int udpServerSetup(int serverPort)
 	
 }
 
+// Same as udpServerSetup() but sets SO_REUSEPORT before binding, so several
+// processes can each bind their own socket to the same port and the kernel
+// spreads incoming datagrams across them by source address.
+// Only prints the port number if debugFlag is set.
+
+int udpServerSetupReusePort(int serverPort, int debugFlag)
+{
+	struct sockaddr_in6 serverAddress;
+	int socketNum = 0;
+	int serverAddrLen = 0;
+	int reuse = 1;
+
+	if ((socketNum = socket(AF_INET6,SOCK_DGRAM,0)) < 0)
+	{
+		perror("socket() call error");
+		exit(-1);
+	}
+
+	if (setsockopt(socketNum, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
+	{
+		perror("setsockopt() SO_REUSEPORT error");
+		exit(-1);
+	}
+
+	memset(&serverAddress, 0, sizeof(struct sockaddr_in6));
+	serverAddress.sin6_family = AF_INET6;
+	serverAddress.sin6_addr = in6addr_any;
+	serverAddress.sin6_port = htons(serverPort);
+
+	if (bind(socketNum,(struct sockaddr *) &serverAddress, sizeof(serverAddress)) < 0)
+	{
+		perror("bind() call error");
+		exit(-1);
+	}
+
+	if (debugFlag)
+	{
+		serverAddrLen = sizeof(serverAddress);
+		getsockname(socketNum,(struct sockaddr *) &serverAddress,  (socklen_t *) &serverAddrLen);
+		printf("Server using Port #: %d\n", ntohs(serverAddress.sin6_port));
+	}
+
+	return socketNum;
+}
+
+// Asks for send and receive buffers of bufferBytes each, so a full window of
+// large datagrams can queue without being dropped. The kernel silently caps
+// the request at net.core.rmem_max/wmem_max.
+
+void udpSetBufferSizes(int socketNum, int bufferBytes)
+{
+	if (setsockopt(socketNum, SOL_SOCKET, SO_RCVBUF, &bufferBytes, sizeof(bufferBytes)) < 0)
+	{
+		perror("setsockopt() SO_RCVBUF error");
+	}
+
+	if (setsockopt(socketNum, SOL_SOCKET, SO_SNDBUF, &bufferBytes, sizeof(bufferBytes)) < 0)
+	{
+		perror("setsockopt() SO_SNDBUF error");
+	}
+}
+
 // This function opens a socket and fills in the serverAdress structure using the hostName and serverPort.  
 // It assumes the address structure is created before calling this.
 // Returns the socket number and the filled in serverAddress struct.
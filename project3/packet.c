@@ -12,7 +12,9 @@ buildPacketHeader(
     SeqNum_t seqNum,
     uint8_t flag
 ){
-    memset(packetPtr, 0, PACKET_MAX_SSIZE);
+    // Only the header, a Packet_t is sized for the largest payload and every
+    // builder fills exactly the bytes it sends
+    memset(packetPtr, 0, PACKET_HEADER_SSIZE);
 
     packetPtr->header.seqNum = htonl(seqNum);
     packetPtr->header.cksum = 0;
@@ -25,11 +27,13 @@ Packet_t*
 buildRrPacket(
     Packet_t* packetPtr,
     SeqNum_t seqNum,
-    SeqNum_t rrSeqNum
+    SeqNum_t rrSeqNum,
+    uint32_t credit
 ){
     buildPacketHeader(packetPtr, seqNum, FLAG_TYPE_RR);
 
     packetPtr->payload.rr.seqNum = htonl(rrSeqNum);
+    packetPtr->payload.rr.credit = htonl(credit);
 
     packetPtr->header.cksum = in_cksum((uint16_t*) packetPtr, RR_PACKET_SSIZE);
 
@@ -73,12 +77,14 @@ Packet_t*
 buildFileNameRespPacket(
     Packet_t* packetPtr,
     SeqNum_t seqNum,
-    bool response
+    bool response,
+    uint8_t options
 ){
     buildPacketHeader(packetPtr, seqNum, FLAG_TYPE_FILENAME_RESP);
 
     //Populate packet
     packetPtr->payload.fileNameResponse.response = response;
+    packetPtr->payload.fileNameResponse.options = options;
 
     // Calculate checksum
     packetPtr->header.cksum = in_cksum((uint16_t*) packetPtr, FILENAME_RESP_PACKET_SSIZE);
@@ -92,6 +98,9 @@ buildFileNamePacket(
     SeqNum_t seqNum,
     uint32_t windowSize,
     uint16_t bufferSize,
+    uint8_t options,
+    int64_t rangeOffset,
+    uint64_t rangeLength,
     uint8_t* fileNamePtr,
     uint8_t fileNameSize
 ){
@@ -99,7 +108,11 @@ buildFileNamePacket(
 
     packetPtr->payload.fileName.bufferSize = htons(bufferSize);
     packetPtr->payload.fileName.windowSize = htonl(windowSize);
+    packetPtr->payload.fileName.options = options;
+    packetPtr->payload.fileName.rangeOffset = (int64_t) hostToNet64((uint64_t) rangeOffset);
+    packetPtr->payload.fileName.rangeLength = hostToNet64(rangeLength);
 
+    memset(&packetPtr->payload.fileName.fileName, 0, FILENAME_MAX_LEN);
     memcpy(&packetPtr->payload.fileName.fileName, fileNamePtr, fileNameSize);
 
     packetPtr->header.cksum = in_cksum((uint16_t*) packetPtr, FILENAME_PACKET_SSIZE(fileNameSize));
@@ -107,6 +120,66 @@ buildFileNamePacket(
     return packetPtr;
 }
 
+uint8_t
+negotiateOptions(
+    uint8_t requested,
+    uint16_t bufferSize
+){
+    // Both ends run this on the filename packet, so they agree on the options
+    // without another round trip
+    uint8_t accepted = requested & (FILE_OPT_COMPRESS | FILE_OPT_DIGEST | FILE_OPT_DIGEST_SHA256 | FILE_OPT_RANGE | FILE_OPT_STREAM);
+
+    if(bufferSize <= BLOCK_HEADER_SSIZE){
+        accepted &= ~FILE_OPT_COMPRESS;
+    }
+
+    // The digest travels alone in the EOF packet, so it has to fit in one payload
+    if(accepted & FILE_OPT_DIGEST_SHA256){
+        accepted |= FILE_OPT_DIGEST;
+    }
+
+    if(bufferSize < EOF_DIGEST_SSIZE(accepted)){
+        accepted &= ~FILE_OPT_DIGEST_SHA256;
+    }
+
+    if(bufferSize < EOF_DIGEST_SSIZE(accepted)){
+        accepted &= ~FILE_OPT_DIGEST;
+    }
+
+    return accepted;
+}
+
+uint64_t
+hostToNet64(
+    uint64_t value
+){
+    uint8_t bytes[sizeof(uint64_t)];
+
+    for(uint32_t i = 0; i < sizeof(uint64_t); i++){
+        bytes[i] = (uint8_t) (value >> (56 - (i * 8)));
+    }
+
+    memcpy(&value, bytes, sizeof(uint64_t));
+
+    return value;
+}
+
+uint64_t
+netToHost64(
+    uint64_t value
+){
+    uint8_t bytes[sizeof(uint64_t)];
+    uint64_t hostValue = 0;
+
+    memcpy(bytes, &value, sizeof(uint64_t));
+
+    for(uint32_t i = 0; i < sizeof(uint64_t); i++){
+        hostValue = (hostValue << 8) | bytes[i];
+    }
+
+    return hostValue;
+}
+
 bool
 isValidPacket(
     Packet_t* packetPtr,
@@ -8,7 +8,12 @@
 #define TIMEOUT_MAX 10
 
 #define PAYLOAD_MIN 1
-#define PAYLOAD_MAX 1400
+// Largest UDP payload over IPv4 (65507) less the packet header
+#define PAYLOAD_MAX 65500
+
+// Bytes below the payload on the wire, per IP version
+#define IPV4_UDP_OVERHEAD (20 + 8)
+#define IPV6_UDP_OVERHEAD (40 + 8)
 
 #define FILENAME_MAX_LEN 100
 
@@ -16,6 +21,17 @@
 
 #define SEQ_NUM_START 1
 
+// --- File Options ---
+#define FILE_OPT_NONE 0x00
+#define FILE_OPT_COMPRESS 0x01
+#define FILE_OPT_DIGEST 0x02
+#define FILE_OPT_DIGEST_SHA256 0x04
+#define FILE_OPT_RANGE 0x08
+#define FILE_OPT_STREAM 0x10
+
+#define COMPRESS_RATIO_MAX 8
+#define COMPRESS_RAW_MAX 0xFFFF
+
 typedef uint32_t SeqNum_t;
 
 #pragma pack(push, 1)
@@ -39,6 +55,7 @@ typedef enum FlagTypes {
 // --- Packet Structures ---
 typedef struct {
 	SeqNum_t seqNum;
+	uint32_t credit; // Packets past seqNum the receiver can take right now
 } RrPacket_t;
 
 typedef struct {
@@ -51,14 +68,35 @@ typedef struct {
 
 typedef struct {
 	bool response;
+	uint8_t options;
 } FileNameRespPacket_t;
 
 typedef struct {
 	uint32_t windowSize;
 	uint16_t bufferSize;
+	uint8_t options;
+	int64_t rangeOffset; // FILE_OPT_RANGE, negative counts back from the end of the file
+	uint64_t rangeLength; // FILE_OPT_RANGE, 0 runs to the end of the file
 	uint8_t fileName[FILENAME_MAX_LEN];
 } FileNamePacket_t;
 
+// --- Block Encoding (FILE_OPT_COMPRESS) ---
+typedef enum BlockEncodings {
+	BLOCK_ENCODING_RAW = 0,
+	BLOCK_ENCODING_LZ = 1,
+} BlockEncodings_e;
+
+typedef struct {
+	uint8_t encoding;
+	uint16_t rawSize;
+} BlockHeader_t;
+
+// --- EOF Digest (FILE_OPT_DIGEST) ---
+typedef struct {
+	uint64_t fastHash;
+	uint8_t sha256[32];
+} EofDigest_t;
+
 typedef union {
 	RrPacket_t rr;
 	SrejPacket_t srej;
@@ -90,9 +128,17 @@ typedef struct {
 #define FILENAME_RESP_PACKET_SSIZE (PACKET_HEADER_SSIZE + sizeof(FileNameRespPacket_t))
 #define RR_PACKET_SSIZE (PACKET_HEADER_SSIZE + sizeof(RrPacket_t))
 #define SREJ_PACKET_SSIZE (PACKET_HEADER_SSIZE + sizeof(SrejPacket_t))
-#define DATA_PACKET_SSIZE(x) (PACKET_HEADER_SSIZE + x)
+#define DATA_PACKET_SSIZE(x) (PACKET_HEADER_SSIZE + (x))
 #define FILENAME_PACKET_SSIZE(x) (FILENAME_MAX_SSIZE - FILENAME_MAX_LEN + x)
 
+// Socket buffers hold a full window of packets, up to a sane cap
+#define SOCKET_BUFFER_MAX (8 << 20)
+#define SOCKET_BUFFER_SSIZE(w, b) ((uint64_t) (w) * DATA_PACKET_SSIZE(b) > SOCKET_BUFFER_MAX ? SOCKET_BUFFER_MAX : (int) ((w) * DATA_PACKET_SSIZE(b)))
+
+#define BLOCK_HEADER_SSIZE sizeof(BlockHeader_t)
+#define EOF_DIGEST_SSIZE(x) (((x) & FILE_OPT_DIGEST_SHA256) ? sizeof(EofDigest_t) : sizeof(uint64_t))
+#define BLOCK_RAW_MAX_SSIZE(x) ((uint32_t) (x) * COMPRESS_RATIO_MAX > COMPRESS_RAW_MAX ? COMPRESS_RAW_MAX : (uint32_t) (x) * COMPRESS_RATIO_MAX)
+
 Packet_t*
 buildPacketHeader(
     Packet_t* packetPtr,
@@ -104,7 +150,8 @@ Packet_t*
 buildRrPacket(
     Packet_t* packetPtr,
     SeqNum_t seqNum,
-    SeqNum_t rrSeqNum
+    SeqNum_t rrSeqNum,
+    uint32_t credit
 );
 
 Packet_t*
@@ -126,7 +173,8 @@ Packet_t*
 buildFileNameRespPacket(
 	Packet_t* packetPtr,
 	SeqNum_t seqNum,
-	bool response
+	bool response,
+	uint8_t options
 );
 
 Packet_t*
@@ -135,10 +183,29 @@ buildFileNamePacket(
     SeqNum_t seqNum,
     uint32_t windowSize,
     uint16_t bufferSize,
+    uint8_t options,
+    int64_t rangeOffset,
+    uint64_t rangeLength,
     uint8_t* fileNamePtr,
     uint8_t fileNameSize
 );
 
+uint8_t
+negotiateOptions(
+	uint8_t requested,
+	uint16_t bufferSize
+);
+
+uint64_t
+hostToNet64(
+	uint64_t value
+);
+
+uint64_t
+netToHost64(
+	uint64_t value
+);
+
 bool
 isValidPacket(
 	Packet_t* packetPtr,
@@ -6,12 +6,26 @@ import hashlib
 import signal
 import shutil
 import socket
+import threading
 
 # Configuration
 SERVER_EXEC = "./server"
 RCOPY_EXEC  = "./rcopy"
 BASE_PORT = 12345
 
+# rcopy verifies each transfer against a digest the server streams with EOF
+# (-d). Set to True to also re-read both files with md5 afterwards.
+RCOPY_OPTS = ["-d"]
+VERIFY_WITH_MD5 = False
+
+# Server options for the concurrent test. With a rate cap (-r Mbit/s) the server
+# shares it fairly across transfers, so clients finish in proportion to their
+# file sizes instead of by window size.
+SERVER_CONCURRENT_OPTS = ["-r", "40"]
+
+# Equal transfers under that cap should get equal goodput whatever their window.
+FAIRNESS_MIN = 0.9
+
 # ---------------------------
 # Helper Functions
 # ---------------------------
@@ -31,6 +45,31 @@ def compute_md5(filename):
         return None
     return hash_md5.hexdigest()
 
+def transfer_verified(from_file, downloaded_file, client_log_filename):
+    """
+    Returns (ok, detail) for a finished transfer, using the digest verdict
+    rcopy printed when it sent EOF_ACK.
+    """
+    verdict = None
+    try:
+        with open(client_log_filename, "r", errors="replace") as log:
+            for line in log:
+                if line.startswith("Digest: "):
+                    verdict = line.strip()
+    except Exception as e:
+        return False, f"Error reading log {client_log_filename}: {e}"
+
+    if VERIFY_WITH_MD5 or verdict is None:
+        orig_hash = compute_md5(from_file)
+        downloaded_hash = compute_md5(downloaded_file)
+        if orig_hash is None or downloaded_hash is None:
+            return False, "Error computing checksum(s)."
+        if orig_hash != downloaded_hash:
+            return False, f"Checksums differ. Original: {orig_hash}, Downloaded: {downloaded_hash}."
+        return True, "md5 match"
+
+    return verdict.startswith("Digest: match"), verdict
+
 def run_command(cmd, log_filename):
     """
     Runs a command with its stdout and stderr redirected to log_filename.
@@ -57,13 +96,58 @@ def is_port_free(port, host='localhost'):
         except socket.error:
             return False
 
+def wait_port_free(port, timeout=10, interval=0.5):
+    """Poll until the port is free. Returns False if it is still in use after timeout seconds."""
+    start_time_check = time.time()
+    while not is_port_free(port) and time.time() - start_time_check < timeout:
+        time.sleep(interval)
+    return is_port_free(port)
+
+def start_server(server_port, error_rate, log_filename, server_opts=()):
+    """Starts a server and gives it time to come up. Returns (proc, log handle)."""
+    server_cmd = ["stdbuf", "-oL", "-eL", SERVER_EXEC, *server_opts, f"{error_rate:.2f}", str(server_port)]
+    server = run_command(server_cmd, log_filename)
+    time.sleep(2)
+    return server
+
+def run_rcopy(rcopy_opts, from_file, downloaded_file, window_size, buffer_size, error_rate,
+              server_port, log_filename, timeout=120):
+    """Runs one rcopy to completion. Returns its exit code (None if it hung) and the elapsed time."""
+    client_cmd = ["stdbuf", "-oL", "-eL", RCOPY_EXEC, *rcopy_opts, from_file, downloaded_file,
+                  str(window_size), str(buffer_size), f"{error_rate:.2f}", "localhost", str(server_port)]
+    start_time_monotonic = time.monotonic()
+    client_proc, client_log_handle = run_command(client_cmd, log_filename)
+    try:
+        exit_code = client_proc.wait(timeout=timeout)
+    except subprocess.TimeoutExpired:
+        kill_process(client_proc)
+        exit_code = None
+    elapsed = time.monotonic() - start_time_monotonic
+    client_log_handle.close()
+    return exit_code, elapsed
+
+def output_matches(downloaded_file, expected):
+    """Returns (ok, detail) comparing a downloaded file against the bytes it should hold."""
+    try:
+        with open(downloaded_file, "rb") as f:
+            got = f.read()
+    except Exception as e:
+        return False, f"Error reading {downloaded_file}: {e}"
+    if got != expected:
+        return False, f"Output differs: {len(got)} bytes, expected {len(expected)}."
+    return True, f"{len(got)} bytes match"
+
+def shell_output(command):
+    """The stdout of a shell pipeline, as bytes."""
+    return subprocess.run(command, shell=True, check=True, stdout=subprocess.PIPE).stdout
+
 # ---------------------------
 # Test Case Functions
 # ---------------------------
 def run_sequential_test(from_file, base_downloaded, window_size, buffer_size, error_rate,
-                          base_server_log, base_client_log, test_name, test_dir, server_port):
+                          base_server_log, base_client_log, test_name, test_dir, server_port, rcopy_opts=()):
     """
-    Runs a single test case up to 3 attempts on the given port.
+    Runs a single test case up to 3 attempts on the given port, passing rcopy_opts to rcopy.
     Returns the best (shortest) successful time in seconds or None if failed.
     """
     best_time = None
@@ -99,8 +183,8 @@ def run_sequential_test(from_file, base_downloaded, window_size, buffer_size, er
         time.sleep(2)
         
         # Build client command:
-        # stdbuf -oL -eL ./rcopy <from_file> <downloaded_file> <window_size> <buffer_size> <error_rate> localhost <server_port>
-        client_cmd = ["stdbuf", "-oL", "-eL", RCOPY_EXEC, from_file, downloaded_file,
+        # stdbuf -oL -eL ./rcopy [opts] <from_file> <downloaded_file> <window_size> <buffer_size> <error_rate> localhost <server_port>
+        client_cmd = ["stdbuf", "-oL", "-eL", RCOPY_EXEC, *RCOPY_OPTS, *rcopy_opts, from_file, downloaded_file,
                       str(window_size), str(buffer_size), f"{error_rate:.2f}", "localhost", str(server_port)]
         start_time_monotonic = time.monotonic()
         client_proc, client_log_handle = run_command(client_cmd, client_log_file)
@@ -113,17 +197,14 @@ def run_sequential_test(from_file, base_downloaded, window_size, buffer_size, er
         server_log_handle.close()
         client_log_handle.close()
         
-        # Compare checksums.
-        orig_hash = compute_md5(from_file)
-        downloaded_hash = compute_md5(downloaded_file)
-        if orig_hash is None or downloaded_hash is None:
-            print("Error computing checksum(s).")
-        elif orig_hash == downloaded_hash:
-            print(f"SUCCESS: {test_name} completed in {elapsed:.3f} seconds (attempt {attempt}).")
+        # Check the transfer.
+        ok, detail = transfer_verified(from_file, downloaded_file, client_log_file)
+        if ok:
+            print(f"SUCCESS: {test_name} completed in {elapsed:.3f} seconds (attempt {attempt}). {detail}")
             best_time = elapsed if best_time is None or elapsed < best_time else best_time
             break
         else:
-            print(f"FAIL: Checksums differ (attempt {attempt}). Original: {orig_hash}, Downloaded: {downloaded_hash}.")
+            print(f"FAIL: {detail} (attempt {attempt})")
     
     if best_time is None:
         print(f"Test {test_name} FAILED all 3 attempts.")
@@ -131,6 +212,12 @@ def run_sequential_test(from_file, base_downloaded, window_size, buffer_size, er
         print(f"Test {test_name} PASSED with best run time: {best_time:.3f} seconds.")
     return best_time
 
+def jain_fairness(rates):
+    """Jain's fairness index, 1.0 when every rate is equal, 1/n when one takes everything."""
+    if not rates:
+        return 1.0
+    return sum(rates) ** 2 / (len(rates) * sum(r * r for r in rates))
+
 def run_concurrent_clients_test(results_dir, server_port):
     """
     Runs a concurrent test where one server handles up to four concurrent clients on the given port.
@@ -176,7 +263,7 @@ def run_concurrent_clients_test(results_dir, server_port):
     
     # Start one server for all concurrent clients.
     server_log_file = os.path.join(test_dir, "server_concurrent_attempt1.log")
-    server_cmd = ["stdbuf", "-oL", "-eL", SERVER_EXEC, "0.20", str(server_port)]
+    server_cmd = ["stdbuf", "-oL", "-eL", SERVER_EXEC, *SERVER_CONCURRENT_OPTS, "0.20", str(server_port)]
     server_proc, server_log_handle = run_command(server_cmd, server_log_file)
     time.sleep(2)  # Allow server to initialize.
     
@@ -185,40 +272,264 @@ def run_concurrent_clients_test(results_dir, server_port):
     for idx, test in enumerate(client_tests):
         downloaded_file = os.path.join(test_dir, f"{test['downloaded']}_attempt1")
         client_log_file = os.path.join(test_dir, f"{test['base_client_log']}_attempt1.log")
-        client_cmd = ["stdbuf", "-oL", "-eL", RCOPY_EXEC, test["from_file"], downloaded_file,
+        client_cmd = ["stdbuf", "-oL", "-eL", RCOPY_EXEC, *RCOPY_OPTS, test["from_file"], downloaded_file,
                       str(test["window"]), str(test["buffer"]), f"{test['error']:.2f}", "localhost", str(server_port)]
         proc, log_handle = run_command(client_cmd, client_log_file)
-        client_procs.append((proc, test, downloaded_file, log_handle))
+        client_procs.append((proc, test, downloaded_file, log_handle, client_log_file))
         start_times[proc.pid] = time.monotonic()
     
     remaining_procs = client_procs.copy()
+    finish_times = []
 
     while remaining_procs:
-        for proc, test, downloaded_file, log_handle in remaining_procs.copy():
+        for proc, test, downloaded_file, log_handle, client_log_file in remaining_procs.copy():
             exit_code = proc.poll()
             if exit_code is not None:
                 elapsed = time.monotonic() - start_times[proc.pid]
                 log_handle.close()
                 
                 if exit_code == 0:
-                    print(f"SUCCESS: {test['test_name']} completed in {elapsed:.3f} seconds.")
+                    goodput = os.path.getsize(test["from_file"]) / elapsed
+                    finish_times.append(elapsed)
+                    print(f"SUCCESS: {test['test_name']} completed in {elapsed:.3f} seconds ({goodput / 1000:.1f} kB/s).")
                 else:
                     print(f"FAIL: {test['test_name']} failed with exit code {exit_code}.")
                 
-                orig_hash = compute_md5(test["from_file"])
-                downloaded_hash = compute_md5(downloaded_file)
-                if orig_hash == downloaded_hash:
-                    print(f"SUCCESS: Checksums match for {test['test_name']}.")
+                ok, detail = transfer_verified(test["from_file"], downloaded_file, client_log_file)
+                if ok:
+                    print(f"SUCCESS: Transfer verified for {test['test_name']}. {detail}")
                 else:
-                    print(f"FAIL: Checksums differ for {test['test_name']}. Original: {orig_hash}, Downloaded: {downloaded_hash}.")
+                    print(f"FAIL: {test['test_name']}: {detail}")
                 
-                remaining_procs.remove((proc, test, downloaded_file, log_handle))
+                remaining_procs.remove((proc, test, downloaded_file, log_handle, client_log_file))
         time.sleep(0.1)
 
     kill_process(server_proc)
     server_log_handle.close()
+
+    # Sizes differ, so the spread shows how the small files fare next to the big ones, not fairness
+    if finish_times:
+        print(f"Completion spread (mixed sizes): first {min(finish_times):.3f}s last {max(finish_times):.3f}s")
     print("Concurrent Clients Test completed.")
 
+def run_fairness_test(results_dir, server_port):
+    """
+    Runs three clients with windows 5, 50 and 500 fetching the same 5 MB file at once, with no
+    loss, under the server's rate cap. Reports Jain's index over their goodputs.
+    """
+    test_dir = os.path.join(results_dir, "fairness")
+    create_dir(test_dir)
+    print(f"\n=== Running Fairness Test on port {server_port} ===")
+
+    if not wait_port_free(server_port):
+        print(f"FATAL: Timeout reached: port {server_port} is still in use. Fairness Test FAILED.")
+        return
+
+    from_file = os.path.join(test_dir, "random_5mb.bin")
+    with open(from_file, "wb") as f:
+        f.write(os.urandom(5 * 1024 * 1024))
+
+    server_proc, server_log_handle = start_server(server_port, 0.0, os.path.join(test_dir, "server_fairness.log"),
+                                                  SERVER_CONCURRENT_OPTS)
+
+    clients = []
+    for window_size in (5, 50, 500):
+        downloaded_file = os.path.join(test_dir, f"downloaded_w{window_size}")
+        client_log_file = os.path.join(test_dir, f"client_w{window_size}.log")
+        client_cmd = ["stdbuf", "-oL", "-eL", RCOPY_EXEC, *RCOPY_OPTS, from_file, downloaded_file,
+                      str(window_size), "1000", "0.00", "localhost", str(server_port)]
+        proc, log_handle = run_command(client_cmd, client_log_file)
+        clients.append((proc, log_handle, window_size, downloaded_file, client_log_file, time.monotonic()))
+
+    # Poll them all so each is timed to its own exit, not to when a wait got around to it
+    exit_times = {}
+    deadline = time.monotonic() + 120
+    while len(exit_times) < len(clients) and time.monotonic() < deadline:
+        for proc, *_ in clients:
+            if proc.pid not in exit_times and proc.poll() is not None:
+                exit_times[proc.pid] = time.monotonic()
+        time.sleep(0.01)
+
+    goodputs = []
+    for proc, log_handle, window_size, downloaded_file, client_log_file, start_time_monotonic in clients:
+        if proc.pid in exit_times:
+            exit_code = proc.returncode
+        else:
+            kill_process(proc)
+            exit_code = None
+            exit_times[proc.pid] = time.monotonic()
+        elapsed = exit_times[proc.pid] - start_time_monotonic
+        log_handle.close()
+
+        ok, detail = transfer_verified(from_file, downloaded_file, client_log_file)
+        if exit_code == 0 and ok:
+            goodputs.append(os.path.getsize(from_file) / elapsed)
+            print(f"SUCCESS: Window {window_size} completed in {elapsed:.3f} seconds ({goodputs[-1] / 1000:.1f} kB/s). {detail}")
+        else:
+            print(f"FAIL: Window {window_size} (exit code {exit_code}). {detail}")
+
+    kill_process(server_proc)
+    server_log_handle.close()
+
+    if len(goodputs) == len(clients):
+        fairness = jain_fairness(goodputs)
+        verdict = "SUCCESS" if fairness >= FAIRNESS_MIN else "FAIL"
+        print(f"{verdict}: Goodput fairness (Jain's index over {len(goodputs)} equal transfers): {fairness:.3f}")
+    print("Fairness Test completed.")
+
+def run_range_test(results_dir, server_port):
+    """
+    Fetches byte ranges (-o/-l): the tail of a file, compared against tail -c, and a range
+    written sparse at its offset (-S), compared against head | tail behind a zero-filled hole.
+    """
+    test_dir = os.path.join(results_dir, "range")
+    create_dir(test_dir)
+    print(f"\n=== Running Byte Range Test on port {server_port} ===")
+
+    if not wait_port_free(server_port):
+        print(f"FATAL: Timeout reached: port {server_port} is still in use. Byte Range Test FAILED.")
+        return
+
+    from_file = "random_big_text.txt"
+    offset, length = 100000, 50000
+    range_tests = [
+        { "test_name": "Tail range (-o -30000)", "downloaded": "downloaded_tail",
+          "opts": ["-o", "-30000"],
+          "expected": shell_output(f"tail -c 30000 {from_file}") },
+        { "test_name": f"Sparse range (-S -o {offset} -l {length})", "downloaded": "downloaded_sparse",
+          "opts": ["-S", "-o", str(offset), "-l", str(length)],
+          "expected": bytes(offset) + shell_output(f"head -c {offset + length} {from_file} | tail -c {length}") },
+    ]
+
+    server_proc, server_log_handle = start_server(server_port, 0.1, os.path.join(test_dir, "server_range.log"))
+
+    for test in range_tests:
+        downloaded_file = os.path.join(test_dir, test["downloaded"])
+        client_log_file = os.path.join(test_dir, f"client_{test['downloaded']}.log")
+        exit_code, elapsed = run_rcopy(RCOPY_OPTS + test["opts"], from_file, downloaded_file, 10, 1000, 0.1,
+                                       server_port, client_log_file)
+
+        ok, detail = output_matches(downloaded_file, test["expected"])
+        if exit_code == 0 and ok:
+            print(f"SUCCESS: {test['test_name']} completed in {elapsed:.3f} seconds. {detail}")
+        else:
+            print(f"FAIL: {test['test_name']} (exit code {exit_code}). {detail}")
+
+    kill_process(server_proc)
+    server_log_handle.close()
+    print("Byte Range Test completed.")
+
+def run_swarm_test(results_dir, server_port):
+    """
+    Fetches one file from two sources at once (-s): a clean server on server_port and a lossy
+    one on server_port + 1, in 64 KB ranges, and compares the result against the source.
+    """
+    test_dir = os.path.join(results_dir, "swarm")
+    create_dir(test_dir)
+    print(f"\n=== Running Swarm Test on ports {server_port} and {server_port + 1} ===")
+
+    for port in (server_port, server_port + 1):
+        if not wait_port_free(port):
+            print(f"FATAL: Timeout reached: port {port} is still in use. Swarm Test FAILED.")
+            return
+
+    from_file = "random_big_text.txt"
+    downloaded_file = os.path.join(test_dir, "downloaded_swarm")
+    servers = [
+        start_server(server_port, 0.0, os.path.join(test_dir, "server_clean.log")),
+        start_server(server_port + 1, 0.2, os.path.join(test_dir, "server_lossy.log")),
+    ]
+
+    exit_code, elapsed = run_rcopy(["-s", f"localhost:{server_port + 1}", "-k", "65536"], from_file,
+                                   downloaded_file, 50, 1000, 0.0, server_port,
+                                   os.path.join(test_dir, "client_swarm.log"))
+
+    for server_proc, server_log_handle in servers:
+        kill_process(server_proc)
+        server_log_handle.close()
+
+    with open(from_file, "rb") as f:
+        ok, detail = output_matches(downloaded_file, f.read())
+    if exit_code == 0 and ok:
+        print(f"SUCCESS: Swarm transfer completed in {elapsed:.3f} seconds. {detail}")
+    else:
+        print(f"FAIL: Swarm transfer (exit code {exit_code}). {detail}")
+    print("Swarm Test completed.")
+
+def live_children(pid):
+    """The pids of a process's children that have not exited (zombies left out)."""
+    ps = subprocess.run(["ps", "-o", "pid=,stat=", "--ppid", str(pid)], stdout=subprocess.PIPE, text=True)
+    return [line.split()[0] for line in ps.stdout.splitlines() if not line.split()[1].startswith("Z")]
+
+def write_slowly(path, chunks, delay=0.05):
+    """Writes chunks to path one at a time, pausing between them, then closes it."""
+    with open(path, "wb", buffering=0) as f:
+        for chunk in chunks:
+            time.sleep(delay)
+            f.write(chunk)
+
+def run_stream_test(results_dir, server_port):
+    """
+    Streams sources that are still being written (-f): a FIFO and a regular file a writer
+    holds open. Each writer closes after its last chunk, and the output must hold every chunk.
+    Then kills an rcopy while its source is still empty, the server must end that session.
+    """
+    test_dir = os.path.join(results_dir, "stream")
+    create_dir(test_dir)
+    print(f"\n=== Running Stream Test on port {server_port} ===")
+
+    if not wait_port_free(server_port):
+        print(f"FATAL: Timeout reached: port {server_port} is still in use. Stream Test FAILED.")
+        return
+
+    chunks = [os.urandom(1000 + i * 737 % 5000) for i in range(40)]
+    server_proc, server_log_handle = start_server(server_port, 0.1, os.path.join(test_dir, "server_stream.log"))
+
+    for kind in ("fifo", "file"):
+        from_file = os.path.join(test_dir, f"source_{kind}")
+        downloaded_file = os.path.join(test_dir, f"downloaded_{kind}")
+        if kind == "fifo":
+            os.mkfifo(from_file)
+        else:
+            open(from_file, "wb").close()
+
+        writer = threading.Thread(target=write_slowly, args=(from_file, chunks))
+        writer.start()
+        exit_code, elapsed = run_rcopy(["-f"], from_file, downloaded_file, 50, 1000, 0.1,
+                                       server_port, os.path.join(test_dir, f"client_{kind}.log"))
+        writer.join()
+
+        ok, detail = output_matches(downloaded_file, b"".join(chunks))
+        if exit_code == 0 and ok:
+            print(f"SUCCESS: Streamed {kind} completed in {elapsed:.3f} seconds. {detail}")
+        else:
+            print(f"FAIL: Streamed {kind} (exit code {exit_code}). {detail}")
+
+    # rcopy dies while the writer has sent nothing yet, the session must still time out
+    from_file = os.path.join(test_dir, "source_idle")
+    with open(from_file, "wb"):
+        client_cmd = ["stdbuf", "-oL", "-eL", RCOPY_EXEC, "-f", from_file, os.path.join(test_dir, "downloaded_idle"),
+                      "10", "1000", "0.10", "localhost", str(server_port)]
+        client_proc, client_log_handle = run_command(client_cmd, os.path.join(test_dir, "client_idle.log"))
+        time.sleep(2)
+        client_proc.kill()
+        client_proc.wait()
+        client_log_handle.close()
+
+        start_time_monotonic = time.monotonic()
+        while live_children(server_proc.pid) and time.monotonic() - start_time_monotonic < 30:
+            time.sleep(0.5)
+        elapsed = time.monotonic() - start_time_monotonic
+
+    if live_children(server_proc.pid):
+        print("FAIL: Session for a client killed before any data was still running after 30 seconds.")
+    else:
+        print(f"SUCCESS: Session for a client killed before any data ended {elapsed:.3f} seconds later.")
+
+    kill_process(server_proc)
+    server_log_handle.close()
+    print("Stream Test completed.")
+
 # ---------------------------
 # Main
 # ---------------------------
@@ -296,8 +607,58 @@ def main():
     )
     next_port += 1
 
+    test5_dir = os.path.join(results_dir, "bigz")
+    create_dir(test5_dir)
+    run_sequential_test(
+        from_file="random_big_text.txt",
+        base_downloaded="downloaded_big_z",
+        window_size=10,
+        buffer_size=1000,
+        error_rate=0.2,
+        base_server_log="server_big_z",
+        base_client_log="client_big_z",
+        test_name="Test #5 (big, compressed -z, window=10, buffer=1000, error=0.2)",
+        test_dir=test5_dir,
+        server_port=next_port,
+        rcopy_opts=["-z"]
+    )
+    next_port += 1
+
+    test6_dir = os.path.join(results_dir, "bigb8000")
+    create_dir(test6_dir)
+    run_sequential_test(
+        from_file="random_big_text.txt",
+        base_downloaded="downloaded_big_b8000",
+        window_size=10,
+        buffer_size=8000,
+        error_rate=0.1,
+        base_server_log="server_big_b8000",
+        base_client_log="client_big_b8000",
+        test_name="Test #6 (big, window=10, buffer=8000, error=0.1)",
+        test_dir=test6_dir,
+        server_port=next_port
+    )
+    next_port += 1
+
     # Concurrent test.
     run_concurrent_clients_test(results_dir, server_port=next_port)
+    next_port += 1
+
+    # Fairness test.
+    run_fairness_test(results_dir, server_port=next_port)
+    next_port += 1
+
+    # Byte range test.
+    run_range_test(results_dir, server_port=next_port)
+    next_port += 1
+
+    # Swarm test, on two ports.
+    run_swarm_test(results_dir, server_port=next_port)
+    next_port += 2
+
+    # Stream test.
+    run_stream_test(results_dir, server_port=next_port)
+    next_port += 1
     
     print("\nAll tests completed.")
     print("Check the 'test-results' directory for detailed output files and logs.")
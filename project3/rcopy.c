@@ -14,6 +14,10 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/sock_diag.h>
 
 #include "checksum.h"
 #include "gethostbyname.h"
@@ -24,9 +28,24 @@
 
 #include "packet.h"
 #include "window.h"
+#include "compress.h"
+#include "digest.h"
+#include "rtt.h"
+#include "swarm.h"
+#include "trace.h"
+#include "telemetry.h"
 
 #define SERVER_NAME_MAX 1024
 
+// Rough kernel bookkeeping per queued datagram, on top of its bytes
+#define SKB_OVERHEAD_ESTIMATE 768
+
+#define ACK_EVERY_DEFAULT 1
+#define ACK_DELAY_DEFAULT_MS 20
+
+// EOF_ACK resends while lingering, each one probe interval later than the last
+#define EOF_ACK_RESENDS 3
+
 typedef struct{
 	char fromFileName[FILENAME_MAX_LEN + 1];
 	char toFileName[FILENAME_MAX_LEN + 1];
@@ -35,6 +54,18 @@ typedef struct{
 	
 	uint32_t windowSize;
 	uint16_t bufferSize;
+	uint8_t options;
+	uint8_t fileOptions;
+	bool probeMtu;
+
+	// Byte range (FILE_OPT_RANGE), sparse writes it at its offset in the local file
+	int64_t rangeOffset;
+	uint64_t rangeLength;
+	bool sparse;
+
+	// Delayed ack policy, RR every ackEvery in-order packets or after ackDelayMs
+	uint32_t ackEvery;
+	uint32_t ackDelayMs;
 
 	float errorRate;
 
@@ -44,6 +75,18 @@ typedef struct{
 	int socketNum;
 	struct sockaddr_in6* server;
 	int serverAddrLen;
+
+	// Swarm mode, the remote-machine/remote-port source plus each -s
+	SwarmSource_t sources[SWARM_SOURCES_MAX];
+	uint32_t numSources;
+	uint64_t chunkBytes;
+
+	// JSON report per transfer (-t), and every second while it runs (-T)
+	const char* telemetryPath;
+	bool telemetryPeriodic;
+
+	// Binary event trace per process (-E), see trace.h
+	const char* traceDir;
 }rcopySettings_t;
 
 enum rcopyState{
@@ -62,6 +105,20 @@ enum rcopyState{
 	NUM_STATES,
 };
 
+static const char* const stateNames[NUM_STATES] = {
+	"send_filename",
+	"send_filename_timeout",
+	"wait_for_filename_ack",
+	"receive_first_data",
+	"receive_data",
+	"receive_data_timeout",
+	"bad_data",
+	"buffer_data",
+	"process_data",
+	"last_data",
+	"kill",
+};
+
 static rcopySettings_t settings = 
 	{
 		{0},
@@ -70,6 +127,14 @@ static rcopySettings_t settings =
 		0,
 		0,
 		0,
+		0,
+		false,
+		0,
+		0,
+		false,
+		0,
+		0,
+		0,
 		{0},
 		0
 	};
@@ -79,6 +144,44 @@ static SeqNum_t expected = SEQ_NUM_START;
 static SeqNum_t highest = SEQ_NUM_START;
 
 static bool wroteLastData = false;
+static uint64_t bytesWritten = 0;
+
+static uint32_t ackPending = 0;
+static uint64_t ackDueMs = 0;
+
+// Only the filename handshake gives rcopy an RTT sample
+static Rtt_t rtt;
+static uint64_t fileNameSentUs = 0;
+
+static Digest_t fileDigest;
+static bool digestChecked = false;
+static bool digestMatched = false;
+static char digestReport[DIGEST_HEX_MAX * 2 + 64];
+
+uint64_t
+nowMs(
+	void
+){
+	return rttNowUs() / 1000;
+}
+
+int
+ackWaitMs(
+	int waitMs
+){
+	// Don't sleep past a pending delayed ack
+	if(ackPending == 0){
+		return waitMs;
+	}
+
+	uint64_t now = nowMs();
+
+	if(ackDueMs <= now){
+		return 0;
+	}
+
+	return (ackDueMs - now < (uint64_t) waitMs) ? (int) (ackDueMs - now) : waitMs;
+}
 
 bool 
 receiveAndValidateData(
@@ -87,13 +190,9 @@ receiveAndValidateData(
 	uint16_t expectedSize
 ){	
 	bool retVal = true;
-	char buffer[expectedSize];
 
-	// call safeRecvFrom
-	int dataLen = safeRecvfrom(settings.socketNum, buffer, expectedSize, 0, (struct sockaddr*) settings.server, &settings.serverAddrLen);
-
-	// Copy data from buffer into packet struct
-	memcpy(packetPtr, buffer, dataLen);
+	// Receive straight into the packet, payloads can be up to PAYLOAD_MAX
+	int dataLen = safeRecvfrom(settings.socketNum, (uint8_t*) packetPtr, expectedSize, 0, (struct sockaddr*) settings.server, &settings.serverAddrLen);
 
 	if(dataSize != NULL){
 		*dataSize = dataLen;
@@ -101,12 +200,13 @@ receiveAndValidateData(
 
 	if(!isValidPacket(packetPtr, dataLen)){
 		// Invalid Packet Received
-	#ifdef __DEBUG_ON
-		printf("Error: Malformed packet receieved!\n");
-	#endif // __DEBUG_ON
+		TRACE(MALFORMED_PACKET, expected);
 		retVal = false;
 	}
 
+	// A corrupted flag can't be trusted to say what the packet was
+	telemetryReceived(dataLen, retVal ? packetPtr->header.flag : 0);
+
 // #ifdef __DEBUG_ON
 // 	char * ipString = NULL;
 // 	ipString = ipAddressToString(settings.server);
@@ -115,7 +215,7 @@ receiveAndValidateData(
 
 // 	// print out bytes received
 // 	for(int i=0; i < dataLen; i++){
-// 		printf("%02x ", buffer[i]);
+// 		printf("%02x ", ((uint8_t*) packetPtr)[i]);
 // 	}
 
 // 	printf("\n");
@@ -124,67 +224,162 @@ receiveAndValidateData(
 	return retVal;
 }
 
+void
+sendToServer(
+	Packet_t* packetPtr,
+	uint16_t size
+){
+	safeSendto(settings.socketNum, (uint8_t*) packetPtr, size, 0, (struct sockaddr*) settings.server, settings.serverAddrLen);
+
+	telemetrySent(size, packetPtr->header.flag);
+}
+
 void
 sendFileName(
 	void
 ){
 	Packet_t packet;
 	int fileNameLen = strlen(settings.fromFileName);
-#ifdef __DEBUG_ON
-	printf("Info: Sending filename: %s\n", settings.fromFileName);
-#endif // __DEBUG_ON
+	TRACE(RC_SEND_FILENAME, seqNum, fileNameLen);
 
-	buildFileNamePacket(&packet, seqNum, settings.windowSize, settings.bufferSize, (uint8_t*) settings.fromFileName, fileNameLen);
+	buildFileNamePacket(&packet, seqNum, settings.windowSize, settings.bufferSize, settings.options, settings.rangeOffset, settings.rangeLength, (uint8_t*) settings.fromFileName, fileNameLen);
 
 	int packetSize = FILENAME_PACKET_SSIZE(fileNameLen);
 
-	safeSendto(settings.socketNum, (uint8_t*) &packet, packetSize, 0, (struct sockaddr*) settings.server, settings.serverAddrLen);
+	sendToServer(&packet, packetSize);
+
+	fileNameSentUs = rttNowUs();
+}
+
+void
+acceptFileName(
+	uint8_t fileOptions
+){
+	uint64_t rttUs = rttNowUs() - fileNameSentUs;
+
+	rttSample(&rtt, rttUs);
+	telemetryRtt(rttUs);
+
+	settings.fileOptions = fileOptions;
+	digestInit(&fileDigest, settings.fileOptions & FILE_OPT_DIGEST_SHA256);
+
+	highest++;
 }
 
 int 
 waitForFileNameAck(
-	Packet_t* packetPtr
+	Packet_t* packetPtr,
+	uint16_t* dataSize
 ){
 	if(pollCall(1000) < 0){
 		// Timeout
-	#ifdef __DEBUG_ON
-		printf("Timeout: Filename response timed out! Resending filename...\n");
-	#endif // __DEBUG_ON
+		TRACE(RC_FILENAME_TIMEOUT, expected);
 
 		return STATE_SEND_FILENAME_TIMEOUT;
 	} else {
-		if(!receiveAndValidateData(packetPtr, NULL, FILENAME_RESP_PACKET_SSIZE)){
-		#ifdef __DEBUG_ON
-			printf("Error: Bad data received! Resending filename...\n");
-		#endif // __DEBUG_ON
-			return STATE_SEND_FILENAME_TIMEOUT;
+		// Sized for data, the server skips the positive response and starts sending right away
+		if(!receiveAndValidateData(packetPtr, dataSize, DATA_PACKET_SSIZE(settings.bufferSize))){
+			TRACE(RC_BAD_DATA_WAITING, expected);
+			return STATE_WAIT_FOR_FILENAME_ACK;
+		}
+
+		if(
+			packetPtr->header.flag == FLAG_TYPE_DATA ||
+			packetPtr->header.flag == FLAG_TYPE_SREJ_DATA ||
+			packetPtr->header.flag == FLAG_TYPE_TIMEOUT_DATA ||
+			packetPtr->header.flag == FLAG_TYPE_EOF
+		){
+			// Data is the implicit ack, both ends negotiate the options the same way
+			acceptFileName(negotiateOptions(settings.options, settings.bufferSize));
+			seqNum++;
+			TRACE(RC_FIRST_DATA_OK, expected, settings.fileOptions);
+
+			return STATE_PROCESS_DATA;
 		}
 
 		if(packetPtr->header.flag != FLAG_TYPE_FILENAME_RESP){
 			// Incorrect Packet Received
-		#ifdef __DEBUG_ON
-			printf("Error: Didn't recieve a filename response packet! Resending filename...\n");
-		#endif // __DEBUG_ON
+			TRACE(RC_NO_FILENAME_RESP, expected);
 			return STATE_SEND_FILENAME_TIMEOUT;
 		}
 
 		if(packetPtr->payload.fileNameResponse.response != true){
 			// Bad Filename
-		#ifdef __DEBUG_ON
-			printf("Error: Bad filename! Gracefully Exiting...\n");
-		#endif //__DEBUG_ON
+			TRACE(RC_BAD_FILENAME, expected);
 			printf("Error: file %s not found.\n", settings.fromFileName);
 			return STATE_KILL;
 		}
-	#ifdef __DEBUG_ON
-		printf("Info: Received filename ok! Waiting for first data...\n");
-	#endif // __DEBUG_ON
+		acceptFileName(packetPtr->payload.fileNameResponse.options);
+		TRACE(RC_FILENAME_OK, expected, settings.fileOptions);
 
-		highest++;
 		return STATE_RECEIVE_FIRST_DATA;
 	}
 }
 
+uint32_t
+receiveCredit(
+	void
+){
+	uint32_t credit = settings.windowSize;
+
+	// Datagrams the kernel holds that we haven't read yet, a stalled write shows up here first
+#ifdef SO_MEMINFO
+	uint32_t memInfo[SK_MEMINFO_VARS];
+	socklen_t memInfoLen = sizeof(memInfo);
+
+	if(getsockopt(settings.socketNum, SOL_SOCKET, SO_MEMINFO, memInfo, &memInfoLen) == 0){
+		uint32_t packetMem = DATA_PACKET_SSIZE(settings.bufferSize) + SKB_OVERHEAD_ESTIMATE;
+		uint32_t queued = memInfo[SK_MEMINFO_RMEM_ALLOC] / packetMem;
+		uint32_t room = (memInfo[SK_MEMINFO_RCVBUF] > memInfo[SK_MEMINFO_RMEM_ALLOC]) ? (memInfo[SK_MEMINFO_RCVBUF] - memInfo[SK_MEMINFO_RMEM_ALLOC]) / packetMem : 0;
+
+		// Whatever is unread, and never more than the socket buffer can still hold
+		credit = (queued < credit) ? credit - queued : 0;
+		credit = (room < credit) ? room : credit;
+	}
+#else
+	int nextLen = 0;
+
+	if(ioctl(settings.socketNum, FIONREAD, &nextLen) == 0 && nextLen > 0){
+		credit--;
+	}
+#endif // SO_MEMINFO
+
+	// Always allow one packet, the server's retransmit timer then doubles as a window probe
+	return (credit > 0) ? credit : 1;
+}
+
+void
+sendRR(
+	void
+){
+	Packet_t rrPacket;
+	uint32_t credit = receiveCredit();
+
+	buildRrPacket(&rrPacket, seqNum++, expected, credit);
+
+	TRACE(RC_SEND_RR, expected, expected, credit);
+
+	sendToServer(&rrPacket, RR_PACKET_SSIZE);
+
+	// RRs are cumulative, this one covers anything still waiting on the delayed ack
+	ackPending = 0;
+}
+
+void
+ackInOrder(
+	bool isEof
+){
+	if(ackPending == 0){
+		ackDueMs = nowMs() + settings.ackDelayMs;
+	}
+
+	ackPending++;
+
+	if(isEof || ackPending >= settings.ackEvery){
+		sendRR();
+	}
+}
+
 int
 recvData(
 	Packet_t* packetPtr,
@@ -192,21 +387,21 @@ recvData(
 	bool firstPacket,
 	bool buffering
 ){
-#ifdef __DEBUG_ON
-	printf("Info: Expected SeqNum: %i\n", expected);
-#endif // __DEBUG_ON
-	if(pollCall(10000) < 0){
+	TRACE(RC_EXPECTED, expected, expected);
+	if(pollCall(ackWaitMs(10000)) < 0){
+		if(ackPending > 0){
+			// Delayed ack timer, not a timeout
+			sendRR();
+			return STATE_RECEIVE_DATA;
+		}
+
 		// Timeout
 		if (firstPacket) {
-		#ifdef __DEBUG_ON
-			printf("Timeout: Timeout receiving first file data! Resending filename...\n");
-		#endif // __DEBUG_ON
+			TRACE(RC_FIRST_DATA_TIMEOUT, expected);
 
 			return STATE_SEND_FILENAME_TIMEOUT;
 		} else {
-		#ifdef __DEBUG_ON
-			printf("Timeout: Timeout receiving data!\n");
-		#endif // __DEBUG_ON
+			TRACE(RC_DATA_TIMEOUT, expected);
 
 			return STATE_RECEIVE_DATA_TIMEOUT;
 		}
@@ -215,9 +410,7 @@ recvData(
 			// Bad data received
 			return STATE_BAD_DATA;
 		}
-	#ifdef __DEBUG_ON
-		printf("Info: Good data received! Processing data...\n");
-	#endif // __DEBUG_ON
+		TRACE(RC_GOOD_DATA, expected);
 
 		if(buffering){
 			return STATE_BUFFER_DATA;
@@ -234,25 +427,9 @@ sendSREJ(
 	Packet_t srejPacket;
 	buildSrejPacket(&srejPacket, seqNum++, srejNum);
 
-#ifdef __DEBUG_ON
-	printf("Info: Sending SREJ: %i\n", srejNum);
-#endif // __DEBUG_ON
-
-	safeSendto(settings.socketNum, (uint8_t*) &srejPacket, SREJ_PACKET_SSIZE, 0, (struct sockaddr*) settings.server, settings.serverAddrLen);
-}
+	TRACE(RC_SEND_SREJ, srejNum, srejNum);
 
-void
-sendRR(
-	void
-){
-	Packet_t rrPacket;
-	buildRrPacket(&rrPacket, seqNum++, expected);
-
-#ifdef __DEBUG_ON
-	printf("Info: Sending RR: %i...\n", expected);
-#endif // __DEBUG_ON
-
-	safeSendto(settings.socketNum, (uint8_t*) &rrPacket, RR_PACKET_SSIZE, 0, (struct sockaddr*) settings.server, settings.serverAddrLen);
+	sendToServer(&srejPacket, SREJ_PACKET_SSIZE);
 }
 
 void
@@ -266,6 +443,117 @@ writeDataToDisk(
 		perror("writeDataToDisk: Error writing data to disk. Exiting...");
 		exit(1);
 	}
+
+	bytesWritten += numBytes;
+	telemetryCount(TELEMETRY_FILE_BYTES, numBytes);
+
+	if(settings.fileOptions & FILE_OPT_STREAM){
+		// Readers of a replicated stream see each packet as it lands
+		fflush(settings.toFile);
+	}
+
+	if(settings.fileOptions & FILE_OPT_DIGEST){
+		digestUpdate(&fileDigest, data, dataSize);
+	}
+}
+
+void
+writePayloadToDisk(
+	uint8_t* payload,
+	uint16_t payloadSize
+){
+	static uint8_t rawBlock[COMPRESS_RAW_MAX];
+
+	if(!(settings.fileOptions & FILE_OPT_COMPRESS)){
+		writeDataToDisk(payload, payloadSize);
+		return;
+	}
+
+	if(payloadSize < BLOCK_HEADER_SSIZE){
+		fprintf(stderr, "writePayloadToDisk: Short compressed block. Exiting...\n");
+		exit(1);
+	}
+
+	BlockHeader_t* blockPtr = (BlockHeader_t*) payload;
+	uint16_t rawSize = ntohs(blockPtr->rawSize);
+	uint16_t blockLen = payloadSize - BLOCK_HEADER_SSIZE;
+
+	switch (blockPtr->encoding)
+	{
+	case BLOCK_ENCODING_RAW:
+	{
+		if(blockLen != rawSize){
+			fprintf(stderr, "writePayloadToDisk: Raw block size mismatch. Exiting...\n");
+			exit(1);
+		}
+
+		writeDataToDisk(payload + BLOCK_HEADER_SSIZE, rawSize);
+		break;
+	}
+	case BLOCK_ENCODING_LZ:
+	{
+		if(lzDecompress(payload + BLOCK_HEADER_SSIZE, blockLen, rawBlock, sizeof(rawBlock)) != rawSize){
+			fprintf(stderr, "writePayloadToDisk: Corrupt compressed block. Exiting...\n");
+			exit(1);
+		}
+
+		writeDataToDisk(rawBlock, rawSize);
+		break;
+	}
+	default:
+		fprintf(stderr, "writePayloadToDisk: Unknown block encoding %i. Exiting...\n", blockPtr->encoding);
+		exit(1);
+	}
+}
+
+void
+checkDigest(
+	uint8_t* payload,
+	uint16_t payloadSize
+){
+	EofDigest_t* sentPtr = (EofDigest_t*) payload;
+	uint8_t sha256[DIGEST_SHA256_LEN];
+	uint64_t fastHash;
+	char hex[DIGEST_HEX_MAX];
+
+	digestFinal(&fileDigest, &fastHash, sha256);
+	digestChecked = true;
+
+	if(payloadSize < EOF_DIGEST_SSIZE(settings.fileOptions)){
+		digestMatched = false;
+		snprintf(digestReport, sizeof(digestReport), "short digest packet");
+		return;
+	}
+
+	digestMatched = (netToHost64(sentPtr->fastHash) == fastHash);
+
+	int reportLen = snprintf(digestReport, sizeof(digestReport), "fnv1a64 %016llx", (unsigned long long) fastHash);
+
+	if(settings.fileOptions & FILE_OPT_DIGEST_SHA256){
+		digestMatched = digestMatched && (memcmp(sentPtr->sha256, sha256, DIGEST_SHA256_LEN) == 0);
+
+		snprintf(digestReport + reportLen, sizeof(digestReport) - reportLen, " sha256 %s", digestToHex(sha256, DIGEST_SHA256_LEN, hex));
+	}
+}
+
+void
+deliverPacket(
+	Packet_t* packetPtr,
+	uint16_t dataSize
+){
+	uint16_t payloadSize = dataSize - sizeof(PacketHeader_t);
+
+	if(packetPtr->header.flag == FLAG_TYPE_EOF){
+		wroteLastData = true;
+
+		// With a digest the EOF packet carries only the digest
+		if(settings.fileOptions & FILE_OPT_DIGEST){
+			checkDigest(packetPtr->payload.data.payload, payloadSize);
+			return;
+		}
+	}
+
+	writePayloadToDisk(packetPtr->payload.data.payload, payloadSize);
 }
 
 void
@@ -278,21 +566,13 @@ flushWindow(
 	SeqNum_t currSeqNum;
 
 	for(uint32_t i = 0; i < numValidPackets; i++){
-		memset(&packet, 0, PACKET_MAX_SSIZE);
-
 		currSeqNum = validPackets[i].seqNum;
 
 		getPacket(&packet, &dataSize, currSeqNum);
 
-	#ifdef __DEBUG_ON
-		printf("Info: Writing data %i to disk.\n", currSeqNum);
-	#endif // __DEBUG_ON
-
-		if(packet.header.flag == FLAG_TYPE_EOF){
-			wroteLastData = true;
-		}
+		TRACE(RC_WRITE_DATA, currSeqNum, currSeqNum);
 
-		writeDataToDisk(packet.payload.data.payload, dataSize - sizeof(PacketHeader_t));
+		deliverPacket(&packet, dataSize);
 
 		expected++;
 	}
@@ -310,16 +590,12 @@ checkWindowState(
 	inorderValidPackets(&validPackets, &numValidPackets);
 
 	if(numValidPackets > 0){
-	#ifdef __DEBUG_ON
-		printf("Info: %i valid in-order packets in window! Flushing window...\n", numValidPackets);
-	#endif // __DEBUG_ON
+		TRACE(RC_FLUSH_WINDOW, expected, numValidPackets);
 
 		flushWindow(validPackets, numValidPackets);
 	
 	} else {
-	#ifdef __DEBUG_ON
-		printf("Info: Out of order data still in buffer.\n");
-	#endif // __DEBUG_ON
+		TRACE(RC_OUT_OF_ORDER_BUFFERED, expected);
 	}
 
 	free(validPackets);
@@ -337,17 +613,13 @@ processDataBuffering(
 		packetPtr->header.flag != FLAG_TYPE_DATA &&
 		packetPtr->header.flag != FLAG_TYPE_EOF
 	){
-	#ifdef __DEBUG_ON
-		printf("Error: Packet isn't a data packet! Throwing out...\n");
-	#endif // __DEBUG_ON
+		TRACE(RC_NOT_DATA, expected);
 		return STATE_RECEIVE_DATA;
 	}
 
 	if(!packetValidInWindow(ntohl(packetPtr->header.seqNum))){
 		if( ntohl(packetPtr->header.seqNum) == expected ){
-		#ifdef __DEBUG_ON
-			printf("Info: Replacement data received (SeqNum %i)! Replacing in window...\n", ntohl(packetPtr->header.seqNum));
-		#endif // __DEBUG_ON
+			TRACE(RC_REPLACEMENT, ntohl(packetPtr->header.seqNum), ntohl(packetPtr->header.seqNum));
 			replacePacket(packetPtr, dataSize);
 
 			checkWindowState(false);
@@ -356,11 +628,7 @@ processDataBuffering(
 				sendSREJ(expected);
 				sendRR();
 			} else {
-			#ifdef __DEBUG_ON
-				printf("\nInfo: ---------------------------\n");
-				printf("Info: --- Exiting buffer mode ---\n");
-				printf("Info: ---------------------------\n\n");
-			#endif // __DEBUG_ON
+				TRACE(RC_EXIT_BUFFER, expected);
 
 				*buffering = false;
 
@@ -368,31 +636,26 @@ processDataBuffering(
 			}
 
 		} else if(ntohl(packetPtr->header.seqNum) > expected) {
-			#ifdef __DEBUG_ON
-			printf("Error: Greater than expected (%i) data packet received (%i)! Buffering data...\n", expected, ntohl(packetPtr->header.seqNum));
-		#endif // __DEBUG_ON
+			TRACE(RC_BUFFER_AHEAD, ntohl(packetPtr->header.seqNum), expected, ntohl(packetPtr->header.seqNum));
 
 			if(!addPacket(packetPtr, dataSize)){
-			#ifdef __DEBUG_ON
-				printf("Error: Failure to add packet to buffer! Shouldn't happen. Exiting...\n");
-			#endif // __DEBUG_ON
+				TRACE(RC_BUFFER_ADD_FAILED, ntohl(packetPtr->header.seqNum));
 
 				exit(1);
 			}
 
-			highest = ntohl(packetPtr->header.seqNum);
+			// A reordered packet can fill a hole below the highest one buffered
+			if(ntohl(packetPtr->header.seqNum) > highest){
+				highest = ntohl(packetPtr->header.seqNum);
+			}
 		} else {
-		#ifdef __DEBUG_ON
-			printf("Info: Received lower (%i) than expected (%i) when buffering! Sending lowest SREJ and RR\n", ntohl(packetPtr->header.seqNum), expected);
-		#endif // __DEBUG_ON
+			TRACE(RC_BUFFER_LOWER, ntohl(packetPtr->header.seqNum), ntohl(packetPtr->header.seqNum), expected);
 
 			sendSREJ(expected);
 			sendRR();
 		}
 	} else{
-	#ifdef __DEBUG_ON
-		printf("Info: Duplicate data (SeqNum: %i) received! Throwing out...\n", ntohl(packetPtr->header.seqNum));
-	#endif // __DEBUG_ON
+		TRACE(RC_DUPLICATE, ntohl(packetPtr->header.seqNum), ntohl(packetPtr->header.seqNum));
 		
 		sendSREJ(expected);
 		sendRR();
@@ -411,36 +674,31 @@ processData(
 	uint16_t dataSize,
 	bool* buffering
 ){
+	if(packetPtr->header.flag == FLAG_TYPE_FILENAME_RESP){
+		// The server's keepalive before a stream's first data, it gives up on us unless answered
+		TRACE(RC_KEEPALIVE, expected);
+		sendRR();
+		return STATE_RECEIVE_DATA;
+	}
+
 	if(
 		packetPtr->header.flag != FLAG_TYPE_SREJ_DATA &&
 		packetPtr->header.flag != FLAG_TYPE_TIMEOUT_DATA &&
 		packetPtr->header.flag != FLAG_TYPE_DATA &&
 		packetPtr->header.flag != FLAG_TYPE_EOF
 	){
-	#ifdef __DEBUG_ON
-		printf("Error: Packet isn't a data packet! Throwing out...\n");
-	#endif // __DEBUG_ON
+		TRACE(RC_NOT_DATA, expected);
 		return STATE_RECEIVE_DATA;
 	}
 
 	if (ntohl(packetPtr->header.seqNum) == expected) {
-	#ifdef __DEBUG_ON
-		printf("Info: Regular data packet recieved! Writing to disk...\n");
-	#endif // __DEBUG_ON
+		TRACE(RC_REGULAR_DATA, expected);
 
-	#ifdef __DEBUG_ON
-		printf("Info: Writing data %i to disk.\n", expected);
-	#endif // __DEBUG_ON
+		TRACE(RC_WRITE_DATA, expected, expected);
 
-		writeDataToDisk(packetPtr->payload.data.payload, dataSize - sizeof(PacketHeader_t));
+		deliverPacket(packetPtr, dataSize);
 
-		if(packetPtr->header.flag == FLAG_TYPE_EOF){
-			wroteLastData = true;
-		}
-
-	#ifdef __DEBUG_ON
-		printf("Info: Good packet received! Moving up window...\n");
-	#endif // __DEBUG_ON
+		TRACE(RC_GOOD_PACKET, expected);
 	
 		highest = expected;
 
@@ -448,36 +706,31 @@ processData(
 
 		removePacket(expected);
 
-		sendRR();
+		ackInOrder(packetPtr->header.flag == FLAG_TYPE_EOF);
 
 	} else if (ntohl(packetPtr->header.seqNum) > expected) {
-	#ifdef __DEBUG_ON
-		printf("Error: Greater than expected data packet received! Sending SREJ for current RR...\n");
-	#endif // __DEBUG_ON
+		TRACE(RC_SREJ_AHEAD, ntohl(packetPtr->header.seqNum));
 		
 		sendSREJ(expected);
 
+		// Gaps are reported right away, with whatever the delayed ack was holding
+		if(ackPending > 0){
+			sendRR();
+		}
+
 		highest = ntohl(packetPtr->header.seqNum);
 
 		*buffering = true;
 
-	#ifdef __DEBUG_ON
-		printf("\nInfo: ----------------------------\n");
-		printf("Info: --- Entering buffer mode ---\n");
-		printf("Info: ----------------------------\n\n");
-	#endif // __DEBUG_ON
+		TRACE(RC_ENTER_BUFFER, expected);
 
 		if(!addPacket(packetPtr, dataSize)){
-		#ifdef __DEBUG_ON
-			printf("Error: Failure to add packet to buffer! Shouldn't happen. Exiting...\n");
-		#endif // __DEBUG_ON
+			TRACE(RC_BUFFER_ADD_FAILED, ntohl(packetPtr->header.seqNum));
 
 			exit(1);
 		}
 	} else {
-	#ifdef __DEBUG_ON
-		printf("Error: Lower than expected data packet received! Sending current RR...\n");
-	#endif // __DEBUG_ON
+		TRACE(RC_LOWER_DATA, ntohl(packetPtr->header.seqNum));
 
 		sendRR();
 	}
@@ -489,15 +742,46 @@ processData(
 	}
 }
 
+void
+sendEofAck(
+	void
+){
+	Packet_t packet;
+
+	buildRrPacket(&packet, seqNum++, expected, receiveCredit());
+
+	packet.header.cksum = 0;
+	packet.header.flag = FLAG_TYPE_EOF_ACK;
+
+	packet.header.cksum = in_cksum((uint16_t*) &packet, RR_PACKET_SSIZE);
+
+	sendToServer(&packet, RR_PACKET_SSIZE);
+}
+
+void
+linger(
+	void
+){
+	Packet_t packet;
+	uint16_t dataSize = 0;
+
+	// Nothing acks the EOF_ACK, if it's lost the server keeps probing with its last
+	// packet. Resend it on a doubling schedule and answer any probe that shows up.
+	for(uint32_t resends = 0; resends < EOF_ACK_RESENDS; resends++){
+		if(pollCall(rttProbeMs(&rtt, resends)) >= 0){
+			receiveAndValidateData(&packet, &dataSize, DATA_PACKET_SSIZE(settings.bufferSize));
+			TRACE(RC_EOF_ACK_PROBE, expected);
+		}
+
+		sendEofAck();
+	}
+}
+
 void
 lastData(
 	bool buffering
 ){
-#ifdef __DEBUG_ON
-	printf("\nInfo: ------------------------------------\n");
-	printf("Info: Entering last data teardown state...\n");
-	printf("Info: ------------------------------------\n\n");
-#endif // __DEBUG_ON
+	TRACE(LAST_DATA_BANNER, expected);
 
 	Packet_t packet;
 	int timeout = 0;
@@ -505,36 +789,36 @@ lastData(
 
 	do{
 		if(wroteLastData){
-		#ifdef __DEBUG_ON
-			printf("Info: All data written to disk! Sending Ack and closing file...\n");
-		#endif // __DEBUG_ON
+			TRACE(RC_ALL_WRITTEN, expected);
 
-			buildRrPacket(&packet, seqNum++, expected);
+			sendEofAck();
 
-			packet.header.cksum = 0;
-			packet.header.flag = FLAG_TYPE_EOF_ACK;
-
-			packet.header.cksum = in_cksum((uint16_t*) &packet, RR_PACKET_SSIZE);
-
-			safeSendto(settings.socketNum, (uint8_t*) &packet, RR_PACKET_SSIZE, 0, (struct sockaddr*) settings.server, settings.serverAddrLen);
+			if(digestChecked){
+				printf("Digest: %s (%s)\n", digestMatched ? "match" : "MISMATCH", digestReport);
+			}
 			
 			fclose(settings.toFile);
+
+			linger();
 			return;
 		}
 
-		if(pollCall(10000) < 0){
-		#ifdef __DEBUG_ON
-			printf("Timeout: Timedout while receiving last data packets! Trying again...\n");
-		#endif // __DEBUG_ON
+		// Waiting on retransmits the EOF overtook, no need for the old 10s rounds
+		if(pollCall(ackWaitMs(rttProbeMs(&rtt, timeout))) < 0){
+			if(ackPending > 0){
+				sendRR();
+				continue;
+			}
+			TRACE(RC_LAST_DATA_TIMEOUT, expected);
 
 			timeout++;
+
+			sendSREJ(expected);
 		}else{
 			timeout = 0;
 
 			if(!receiveAndValidateData(&packet, &dataSize, DATA_PACKET_SSIZE(settings.bufferSize))){
-			#ifdef __DEBUG_ON
-				printf("Error: Bad data received! Sending SREJ...\n");
-			#endif // __DEBUG_ON
+				TRACE(RC_LAST_BAD_DATA, expected);
 
 				sendSREJ(ntohl(packet.header.seqNum));
 			} else if (buffering) {
@@ -545,9 +829,7 @@ lastData(
 		}
 
 	}while(timeout < TIMEOUT_MAX);
-#ifdef __DEBUG_ON
-	printf("Timeout: Timeout maximum (%i) reached while receiving last data packets!\n", TIMEOUT_MAX);
-#endif // __DEBUG_ON
+	TRACE(RC_LAST_DATA_TIMEOUT_MAX, expected, TIMEOUT_MAX);
 }
 
 void 
@@ -563,19 +845,21 @@ stateMachine(
 	static uint16_t dataSize;
 
 	windowInit(settings.windowSize, settings.bufferSize);
+	rttInit(&rtt);
 
 	while(1){
+		telemetryState(state);
+		telemetryTick();
+
 		if(timeout >= TIMEOUT_MAX){
-		#ifdef __DEBUG_ON
-			printf("Timeout: Timeout maximum (%i) reached! Gracefully Exiting...\n", TIMEOUT_MAX);
-		#endif // __DEBUG_ON
+			TRACE(RC_TIMEOUT_MAX, expected, TIMEOUT_MAX);
 
 			state = STATE_KILL;
 		}
 		
-		// Clear packet buffer if we aren't processing the data
+		// Clear packet header if we aren't processing the data
 		if(state == STATE_RECEIVE_DATA){
-			memset(&currPacket, 0, PACKET_MAX_SSIZE);
+			memset(&currPacket, 0, PACKET_HEADER_SSIZE);
 		}
 
 		switch (state)
@@ -597,6 +881,7 @@ stateMachine(
 			close(settings.socketNum);
 			
 			settings.socketNum = setupUdpClientToServer(settings.server, (char*) settings.serverName, settings.serverPort);
+			udpSetBufferSizes(settings.socketNum, SOCKET_BUFFER_SSIZE(settings.windowSize, settings.bufferSize));
 
 			addToPollSet(settings.socketNum);
 			
@@ -605,7 +890,7 @@ stateMachine(
 		}
 		case STATE_WAIT_FOR_FILENAME_ACK:
 		{	
-			nextState = waitForFileNameAck(&currPacket);
+			nextState = waitForFileNameAck(&currPacket, &dataSize);
 			break;
 		}
 		case STATE_RECEIVE_FIRST_DATA:
@@ -658,9 +943,7 @@ stateMachine(
 
 		default:
 			// Shouldn't happen
-		#ifdef __DEBUG_ON
-			printf("Error: Invalid state reached! Exiting...\n");
-		#endif
+			TRACE(RC_INVALID_STATE, expected);
 
 			exit(1);
 		}
@@ -675,12 +958,138 @@ checkArgs(
 	char *argv[], 
 	rcopySettings_t *settings
 ){
-    // Expecting 7 arguments plus the program name.
-    if (argc != 8) {
-        fprintf(stderr, "Usage: %s from-filename to-filename window-size buffer-size error-rate remote-machine remote-port\n", argv[0]);
+    int opt;
+    char *endptr;
+    long value;
+    long long rangeValue;
+
+    settings->ackEvery = ACK_EVERY_DEFAULT;
+    settings->ackDelayMs = ACK_DELAY_DEFAULT_MS;
+
+    while ((opt = getopt(argc, argv, "zdDmfTa:A:o:l:Ss:k:t:E:")) != -1) {
+        switch (opt) {
+        case 'z':
+            settings->options |= FILE_OPT_COMPRESS;
+            break;
+        case 'd':
+            settings->options |= FILE_OPT_DIGEST;
+            break;
+        case 'D':
+            settings->options |= FILE_OPT_DIGEST | FILE_OPT_DIGEST_SHA256;
+            break;
+        case 'm':
+            settings->probeMtu = true;
+            break;
+        case 'f':
+            settings->options |= FILE_OPT_STREAM;
+            break;
+        case 'a':
+            value = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || value <= 0) {
+                fprintf(stderr, "Invalid ack count: %s\n", optarg);
+                return -1;
+            }
+            settings->ackEvery = (uint32_t)value;
+            break;
+        case 'A':
+            value = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || value < 0 || value > 1000) {
+                fprintf(stderr, "Invalid ack delay: %s\n", optarg);
+                return -1;
+            }
+            settings->ackDelayMs = (uint32_t)value;
+            break;
+        case 'o':
+            rangeValue = strtoll(optarg, &endptr, 10);
+            if (*endptr != '\0' || *optarg == '\0') {
+                fprintf(stderr, "Invalid offset: %s\n", optarg);
+                return -1;
+            }
+            settings->rangeOffset = (int64_t)rangeValue;
+            settings->options |= FILE_OPT_RANGE;
+            break;
+        case 'l':
+            rangeValue = strtoll(optarg, &endptr, 10);
+            if (*endptr != '\0' || rangeValue <= 0) {
+                fprintf(stderr, "Invalid length: %s\n", optarg);
+                return -1;
+            }
+            settings->rangeLength = (uint64_t)rangeValue;
+            settings->options |= FILE_OPT_RANGE;
+            break;
+        case 'S':
+            settings->sparse = true;
+            break;
+        case 's':
+            // Slot 0 is left for the positional source
+            if (settings->numSources == 0) {
+                settings->numSources = 1;
+            }
+            if (settings->numSources >= SWARM_SOURCES_MAX || !swarmParseSource(optarg, &settings->sources[settings->numSources])) {
+                fprintf(stderr, "Invalid or too many sources: %s\n", optarg);
+                return -1;
+            }
+            settings->numSources++;
+            break;
+        case 'k':
+            rangeValue = strtoll(optarg, &endptr, 10);
+            if (*endptr != '\0' || rangeValue <= 0) {
+                fprintf(stderr, "Invalid chunk size: %s\n", optarg);
+                return -1;
+            }
+            settings->chunkBytes = (uint64_t)rangeValue;
+            break;
+        case 't':
+            settings->telemetryPath = optarg;
+            break;
+        case 'T':
+            settings->telemetryPeriodic = true;
+            break;
+        case 'E':
+            settings->traceDir = optarg;
+            break;
+        default:
+            argc = 0;
+            break;
+        }
+    }
+
+    // Without the file size rcopy can't place a range counted from the end
+    if (settings->sparse && settings->rangeOffset < 0) {
+        fprintf(stderr, "-S needs a non-negative offset\n");
         return -1;
     }
 
+    // Swarm ranges are picked by the coordinator, and need a file whose end stays put
+    if (settings->numSources > 0 && (settings->options & (FILE_OPT_RANGE | FILE_OPT_STREAM) || settings->sparse)) {
+        fprintf(stderr, "-s can't be combined with -f, -o, -l or -S\n");
+        return -1;
+    }
+
+    // Expecting 7 arguments after the options.
+    if (argc - optind != 7) {
+        fprintf(stderr, "Usage: %s [-zdDmfST] [-a ack-every] [-A ack-delay-ms] [-o offset] [-l length] [-s host:port]... [-k chunk-bytes] [-t telemetry-file] [-E trace-dir] from-filename to-filename window-size buffer-size error-rate remote-machine remote-port\n", argv[0]);
+        fprintf(stderr, "  -z  compress the data stream (falls back to raw per block)\n");
+        fprintf(stderr, "  -d  verify the file against a digest sent with EOF\n");
+        fprintf(stderr, "  -D  like -d, and include SHA-256 in the digest\n");
+        fprintf(stderr, "  -f  follow a growing file or FIFO, EOF comes when its writer closes it\n");
+        fprintf(stderr, "  -m  lower buffer-size (max %i) to the largest payload the path MTU carries unfragmented\n", PAYLOAD_MAX);
+        fprintf(stderr, "  -a  send one RR per this many in-order packets, at most half the window (default %i)\n", ACK_EVERY_DEFAULT);
+        fprintf(stderr, "  -A  longest an in-order packet waits for its RR (default %i ms)\n", ACK_DELAY_DEFAULT_MS);
+        fprintf(stderr, "  -o  fetch from this byte offset, negative counts back from the end\n");
+        fprintf(stderr, "  -l  fetch at most this many bytes\n");
+        fprintf(stderr, "  -S  write the range at its offset in to-filename, leaving a hole before it\n");
+        fprintf(stderr, "  -s  also fetch from this server, ranges go to whichever source is free (up to %i sources)\n", SWARM_SOURCES_MAX);
+        fprintf(stderr, "  -k  swarm range size (default %i bytes)\n", SWARM_CHUNK_DEFAULT);
+        fprintf(stderr, "  -t  append a JSON report per transfer to this file, - for stdout\n");
+        fprintf(stderr, "  -T  with -t, also report every %i ms while the transfer runs\n", TELEMETRY_INTERVAL_MS);
+        fprintf(stderr, "  -E  record a binary event trace per process in this directory, read it with tracedump\n");
+        return -1;
+    }
+
+    // Line the positional arguments up with argv[1]
+    argv += optind - 1;
+
     // Copy fromFilename (ensure null termination)
     strncpy((char *)settings->fromFileName, argv[1], FILENAME_MAX_LEN);
     settings->fromFileName[FILENAME_MAX_LEN] = '\0';
@@ -689,9 +1098,6 @@ checkArgs(
     strncpy((char *)settings->toFileName, argv[2], FILENAME_MAX_LEN);
     settings->toFileName[FILENAME_MAX_LEN] = '\0';
 
-    char *endptr;
-    long value;
-
     // Parse and validate windowSize (must be > 0 and fit in uint32_t)
     value = strtol(argv[3], &endptr, 10);
     if (*endptr != '\0' || value <= 0 || value > WINDOW_SIZE_MAX) {
@@ -700,6 +1106,11 @@ checkArgs(
     }
     settings->windowSize = (uint32_t)value;
 
+    // Leave the server room to keep sending while it waits on a delayed ack
+    if (settings->ackEvery > settings->windowSize / 2) {
+        settings->ackEvery = (settings->windowSize > 1) ? settings->windowSize / 2 : 1;
+    }
+
     // Parse and validate bufferSize (must be > 0 and fit in uint16_t)
     value = strtol(argv[4], &endptr, 10);
     if (*endptr != '\0' || value < PAYLOAD_MIN || value > PAYLOAD_MAX) {
@@ -728,34 +1139,95 @@ checkArgs(
     }
     settings->serverPort = (uint16_t)value;
 
+    if (settings->numSources > 0) {
+        strcpy(settings->sources[0].serverName, settings->serverName);
+        settings->sources[0].serverPort = settings->serverPort;
+
+        if (settings->chunkBytes == 0) {
+            settings->chunkBytes = SWARM_CHUNK_DEFAULT;
+        }
+    }
+
     // All arguments validated and stored successfully.
     return 0;
 }
 
+uint16_t
+probePathMtu(
+	struct sockaddr_in6* server
+){
+	int probeSocket;
+	int mtu = 0;
+	socklen_t mtuLen = sizeof(mtu);
+	bool isIpv4 = IN6_IS_ADDR_V4MAPPED(&server->sin6_addr);
+
+	if((probeSocket = socket(AF_INET6, SOCK_DGRAM, 0)) < 0){
+		perror("probePathMtu: socket() call");
+		return settings.bufferSize;
+	}
+
+	// Set DF on the probe socket, the kernel then reports the path MTU rather than
+	// fragmenting, and refines it from any ICMP too-big messages on this route
+	int discover = IP_PMTUDISC_DO;
+	int discover6 = IPV6_PMTUDISC_DO;
+
+	setsockopt(probeSocket, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover));
+	setsockopt(probeSocket, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &discover6, sizeof(discover6));
+
+	if(connect(probeSocket, (struct sockaddr*) server, sizeof(struct sockaddr_in6)) < 0){
+		perror("probePathMtu: connect() call");
+		close(probeSocket);
+		return settings.bufferSize;
+	}
+
+	if(
+		getsockopt(probeSocket, IPPROTO_IPV6, IPV6_MTU, &mtu, &mtuLen) < 0 &&
+		getsockopt(probeSocket, IPPROTO_IP, IP_MTU, &mtu, &mtuLen) < 0
+	){
+		perror("probePathMtu: getsockopt() MTU");
+		close(probeSocket);
+		return settings.bufferSize;
+	}
+
+	close(probeSocket);
+
+	int payload = mtu - ((isIpv4) ? IPV4_UDP_OVERHEAD : IPV6_UDP_OVERHEAD) - (int) PACKET_HEADER_SSIZE;
+
+	if(payload < PAYLOAD_MIN){
+		payload = PAYLOAD_MIN;
+	}
+
+	TRACE(RC_PATH_MTU, 0, mtu, payload);
+
+	return (payload < settings.bufferSize) ? (uint16_t) payload : settings.bufferSize;
+}
+
 void
 openToFile(
-	void
+	const char* mode
 ){
-	settings.toFile = fopen(settings.toFileName, "w");
+	settings.toFile = fopen(settings.toFileName, mode);
 
 	if(settings.toFile == NULL) {
 		perror("Error opening file");
 
 		exit(1);
 	}
-}
 
-int 
-main(
-	int argc, 
-	char *argv[]
-){	
-	if(checkArgs(argc, argv, &settings) != 0){
-		exit(1);
+	if(settings.sparse && settings.rangeOffset > 0){
+		// Sized up front so the hole is there even if the range comes back empty
+		if(ftruncate(fileno(settings.toFile), settings.rangeOffset) < 0 || fseeko(settings.toFile, settings.rangeOffset, SEEK_SET) < 0){
+			perror("Error seeking to offset");
+
+			exit(1);
+		}
 	}
+}
 
-	openToFile();
-	
+void
+runTransfer(
+	void
+){
 	struct sockaddr_in6 server;		// Supports 4 and 6 but requires IPv6 struct
 
 	settings.socketNum = setupUdpClientToServer(&server, (char*) settings.serverName, settings.serverPort);
@@ -763,16 +1235,83 @@ main(
 	settings.server = &server;
 	settings.serverAddrLen = sizeof(struct sockaddr_in6);
 
-	sendErr_init(settings.errorRate, DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON);
+	if(settings.probeMtu){
+		settings.bufferSize = probePathMtu(&server);
+	}
+
+	udpSetBufferSizes(settings.socketNum, SOCKET_BUFFER_SSIZE(settings.windowSize, settings.bufferSize));
 
 	setupPollSet();
 	addToPollSet(settings.socketNum);
-	
+
+	telemetryStart("rcopy", settings.fromFileName, stateNames, NUM_STATES, STATE_SEND_FILENAME);
+
 	stateMachine();
 
+	telemetryFinish(wroteLastData && !(digestChecked && !digestMatched));
+
 	removeFromPollSet(settings.socketNum);
 	
 	close(settings.socketNum);
+}
+
+int64_t
+fetchChunk(
+	const SwarmSource_t* sourcePtr,
+	uint64_t offset,
+	uint64_t length
+){
+	// Forked from the coordinator, one plain range transfer into the shared output file
+	strcpy(settings.serverName, sourcePtr->serverName);
+	settings.serverPort = sourcePtr->serverPort;
+
+	settings.rangeOffset = (int64_t) offset;
+	settings.rangeLength = length;
+	settings.options |= FILE_OPT_RANGE;
+
+	openToFile("r+");
+
+	if(fseeko(settings.toFile, offset, SEEK_SET) < 0){
+		perror("Error seeking to offset");
+		return -1;
+	}
+
+	runTransfer();
+
+	if(!wroteLastData || (digestChecked && !digestMatched)){
+		return -1;
+	}
+
+	return (int64_t) bytesWritten;
+}
+
+int 
+main(
+	int argc, 
+	char *argv[]
+){	
+	if(checkArgs(argc, argv, &settings) != 0){
+		exit(1);
+	}
+
+	if(settings.traceDir != NULL && !traceOpen(settings.traceDir, "rcopy")){
+		exit(1);
+	}
+
+	if(settings.telemetryPath != NULL && !telemetryOpen(settings.telemetryPath, settings.telemetryPeriodic)){
+		exit(1);
+	}
+
+	// Once, each forked swarm child gets its own seed
+	sendErr_init(settings.errorRate, DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON);
+
+	if(settings.numSources > 0){
+		exit(swarmRun(settings.sources, settings.numSources, settings.chunkBytes, settings.toFileName, fetchChunk));
+	}
+
+	openToFile("w");
+
+	runTransfer();
 
-	exit(0);
+	exit((digestChecked && !digestMatched) ? 1 : 0);
 }
@@ -0,0 +1,81 @@
+#include <time.h>
+
+#include "rtt.h"
+
+static uint32_t
+clampMs(
+	uint64_t us
+){
+	uint64_t ms = (us + 999) / 1000;
+
+	if(ms < RTT_MIN_MS){
+		return RTT_MIN_MS;
+	}
+
+	return (ms > RTT_MAX_MS) ? RTT_MAX_MS : (uint32_t) ms;
+}
+
+uint64_t
+rttNowUs(
+	void
+){
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void
+rttInit(
+	Rtt_t* rttPtr
+){
+	rttPtr->hasSample = false;
+	rttPtr->srttUs = 0;
+	rttPtr->rttvarUs = 0;
+}
+
+void
+rttSample(
+	Rtt_t* rttPtr,
+	uint64_t sampleUs
+){
+	if(!rttPtr->hasSample){
+		rttPtr->srttUs = sampleUs;
+		rttPtr->rttvarUs = sampleUs / 2;
+		rttPtr->hasSample = true;
+		return;
+	}
+
+	uint64_t deltaUs = (sampleUs > rttPtr->srttUs) ? sampleUs - rttPtr->srttUs : rttPtr->srttUs - sampleUs;
+
+	// RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, then SRTT = 7/8 SRTT + 1/8 R
+	rttPtr->rttvarUs = (3 * rttPtr->rttvarUs + deltaUs) / 4;
+	rttPtr->srttUs = (7 * rttPtr->srttUs + sampleUs) / 8;
+}
+
+uint32_t
+rttTimeoutMs(
+	Rtt_t* rttPtr
+){
+	if(!rttPtr->hasSample){
+		return RTT_INITIAL_MS;
+	}
+
+	return clampMs(rttPtr->srttUs + 4 * rttPtr->rttvarUs);
+}
+
+uint32_t
+rttProbeMs(
+	Rtt_t* rttPtr,
+	uint32_t backoff
+){
+	uint64_t probeUs = (rttPtr->hasSample) ? 2 * rttPtr->srttUs : (uint64_t) RTT_INITIAL_MS * 1000;
+
+	// Doubles per unanswered probe
+	if(backoff > 16){
+		backoff = 16;
+	}
+
+	return clampMs(probeUs << backoff);
+}
@@ -0,0 +1,49 @@
+// Round trip time estimate (RFC 6298) used to pace the teardown probes.
+
+#ifndef RTT_H
+#define RTT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Floor for probe timers, below this poll() granularity and scheduling noise dominate
+#define RTT_MIN_MS 2
+// Never probe slower than the old fixed 1 s timer
+#define RTT_MAX_MS 1000
+// Probe interval until the first sample arrives
+#define RTT_INITIAL_MS 200
+
+typedef struct {
+	bool hasSample;
+	uint64_t srttUs;
+	uint64_t rttvarUs;
+} Rtt_t;
+
+uint64_t
+rttNowUs(
+	void
+);
+
+void
+rttInit(
+	Rtt_t* rttPtr
+);
+
+void
+rttSample(
+	Rtt_t* rttPtr,
+	uint64_t sampleUs
+);
+
+uint32_t
+rttTimeoutMs(
+	Rtt_t* rttPtr
+);
+
+uint32_t
+rttProbeMs(
+	Rtt_t* rttPtr,
+	uint32_t backoff
+);
+
+#endif // RTT_H
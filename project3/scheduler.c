@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#include "scheduler.h"
+#include "rtt.h"
+#include "trace.h"
+
+typedef struct {
+	pid_t pid;
+	uint32_t weight;
+	uint64_t lastSendMs;
+} SchedSlot_t;
+
+typedef struct {
+	struct in6_addr addr;
+	uint32_t weight;
+} SchedWeight_t;
+
+// Shared by every session, NULL when neither a rate cap nor a session limit is set
+static SchedSlot_t* slots = NULL;
+static uint64_t rateBytes = 0;
+static uint32_t sessionsMax = 0;
+
+static SchedWeight_t weights[SCHED_WEIGHTS_MAX];
+static uint32_t numWeights = 0;
+
+// This process's session
+static int32_t mySlot = -1;
+static uint32_t myWeight = SCHED_WEIGHT_DEFAULT;
+static uint64_t shareBytes = 0;
+static uint64_t shareCheckUs = 0;
+static int64_t deficit = 0;
+static uint64_t lastEarnUs = 0;
+
+void
+schedulerInit(
+	uint64_t rate,
+	uint32_t sessions
+){
+	rateBytes = rate;
+	sessionsMax = sessions;
+
+	if(rateBytes == 0 && sessionsMax == 0){
+		return;
+	}
+
+	// Mapped before any fork so every session sees the same table
+	slots = (SchedSlot_t*) mmap(NULL, SCHED_SESSIONS_MAX * sizeof(SchedSlot_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if(slots == MAP_FAILED){
+		perror("schedulerInit: mmap() error");
+		exit(1);
+	}
+
+	memset(slots, 0, SCHED_SESSIONS_MAX * sizeof(SchedSlot_t));
+}
+
+bool
+schedulerSetWeight(
+	const char* arg
+){
+	const char* equals = strrchr(arg, '=');
+	char addrString[INET6_ADDRSTRLEN];
+	struct in_addr addr4;
+	char* endptr;
+
+	if(equals == NULL || equals == arg || (size_t) (equals - arg) >= sizeof(addrString) || numWeights == SCHED_WEIGHTS_MAX){
+		return false;
+	}
+
+	long weight = strtol(equals + 1, &endptr, 10);
+
+	if(*(equals + 1) == '\0' || *endptr != '\0' || weight <= 0 || weight > SCHED_WEIGHT_MAX){
+		return false;
+	}
+
+	memcpy(addrString, arg, equals - arg);
+	addrString[equals - arg] = '\0';
+
+	SchedWeight_t* weightPtr = &weights[numWeights];
+
+	if(inet_pton(AF_INET, addrString, &addr4) == 1){
+		// IPv4 clients show up v4-mapped on the server's IPv6 socket
+		memset(&weightPtr->addr, 0, sizeof(weightPtr->addr));
+		weightPtr->addr.s6_addr[10] = 0xFF;
+		weightPtr->addr.s6_addr[11] = 0xFF;
+		memcpy(&weightPtr->addr.s6_addr[12], &addr4, sizeof(addr4));
+	} else if(inet_pton(AF_INET6, addrString, &weightPtr->addr) != 1){
+		return false;
+	}
+
+	weightPtr->weight = (uint32_t) weight;
+	numWeights++;
+
+	return true;
+}
+
+static uint32_t
+weightFor(
+	const struct sockaddr_in6* client
+){
+	for(uint32_t i = 0; i < numWeights; i++){
+		if(memcmp(&weights[i].addr, &client->sin6_addr, sizeof(struct in6_addr)) == 0){
+			return weights[i].weight;
+		}
+	}
+
+	return SCHED_WEIGHT_DEFAULT;
+}
+
+static bool
+slotAlive(
+	pid_t pid
+){
+	return pid != 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+uint32_t
+schedulerJoin(
+	const struct sockaddr_in6* client,
+	uint32_t windowSize
+){
+	if(slots == NULL){
+		return windowSize;
+	}
+
+	pid_t me = getpid();
+	uint32_t live = 0;
+
+	mySlot = -1;
+	myWeight = weightFor(client);
+
+	for(uint32_t i = 0; i < SCHED_SESSIONS_MAX; i++){
+		pid_t pid = slots[i].pid;
+
+		if(slotAlive(pid)){
+			live++;
+		} else if(mySlot < 0 && __sync_bool_compare_and_swap(&slots[i].pid, pid, me)){
+			// Free, or left behind by a session that died
+			mySlot = i;
+		}
+	}
+
+	uint64_t nowUs = rttNowUs();
+
+	if(mySlot >= 0){
+		slots[mySlot].weight = myWeight;
+		__atomic_store_n(&slots[mySlot].lastSendMs, nowUs / 1000, __ATOMIC_RELAXED);
+	}
+
+	shareBytes = 0;
+	shareCheckUs = 0;
+	deficit = 0;
+	lastEarnUs = nowUs;
+
+	if(sessionsMax > 0 && live >= sessionsMax){
+		// Overloaded, shrink the window in proportion so the newcomer can't flood the others
+		uint32_t admitted = (uint32_t) ((uint64_t) windowSize * sessionsMax / (live + 1));
+
+		if(admitted < SCHED_WINDOW_MIN){
+			admitted = SCHED_WINDOW_MIN;
+		}
+
+		if(admitted < windowSize){
+			TRACE(SCHED_SHRINK_WINDOW, 0, live, admitted, windowSize);
+
+			windowSize = admitted;
+		}
+	}
+
+	TRACE(SCHED_SLOT, 0, mySlot, myWeight);
+
+	return windowSize;
+}
+
+void
+schedulerLeave(
+	void
+){
+	if(slots != NULL && mySlot >= 0){
+		__sync_bool_compare_and_swap(&slots[mySlot].pid, getpid(), 0);
+	}
+
+	mySlot = -1;
+}
+
+static void
+refreshShare(
+	uint64_t nowUs
+){
+	if(shareBytes != 0 && nowUs - shareCheckUs < SCHED_SHARE_MS * 1000){
+		return;
+	}
+
+	uint64_t nowMs = nowUs / 1000;
+	uint64_t totalWeight = myWeight;
+
+	for(int32_t i = 0; i < SCHED_SESSIONS_MAX; i++){
+		if(i == mySlot || slots[i].pid == 0){
+			continue;
+		}
+
+		if(nowMs < __atomic_load_n(&slots[i].lastSendMs, __ATOMIC_RELAXED) + SCHED_ACTIVE_MS){
+			totalWeight += slots[i].weight;
+		}
+	}
+
+	shareCheckUs = nowUs;
+	shareBytes = rateBytes * myWeight / totalWeight;
+
+	if(shareBytes == 0){
+		shareBytes = 1;
+	}
+}
+
+uint32_t
+schedulerWaitMs(
+	void
+){
+	if(slots == NULL || rateBytes == 0){
+		return 0;
+	}
+
+	uint64_t nowUs = rttNowUs();
+
+	refreshShare(nowUs);
+
+	// Only move the clock on by time that earned a whole byte, or frequent calls would round it all away
+	uint64_t earned = shareBytes * (nowUs - lastEarnUs) / 1000000;
+
+	if(earned > 0){
+		int64_t burst = (int64_t) (shareBytes * SCHED_BURST_MS / 1000);
+
+		deficit += (int64_t) earned;
+		lastEarnUs = nowUs;
+
+		if(deficit > burst){
+			deficit = burst;
+		}
+	}
+
+	if(deficit >= 0){
+		return 0;
+	}
+
+	uint64_t waitUs = (uint64_t) (-deficit) * 1000000 / shareBytes;
+
+	return (waitUs < 1000) ? 1 : (uint32_t) ((waitUs + 999) / 1000);
+}
+
+void
+schedulerCharge(
+	uint32_t bytes
+){
+	if(slots == NULL || rateBytes == 0){
+		return;
+	}
+
+	deficit -= bytes;
+
+	if(mySlot >= 0){
+		uint64_t nowMs = rttNowUs() / 1000;
+
+		if(slots[mySlot].lastSendMs != nowMs){
+			__atomic_store_n(&slots[mySlot].lastSendMs, nowMs, __ATOMIC_RELAXED);
+		}
+	}
+}
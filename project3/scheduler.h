@@ -0,0 +1,63 @@
+// Server side scheduler shared by every concurrent session.
+//
+// Deficit round robin spread across the forked sessions: each one registers in a
+// table the parent maps shared before forking, earns credit at its weighted share
+// of the aggregate rate cap and may send while its deficit is not negative. Only
+// sessions that sent recently take part in the split, so whatever a window-limited
+// or idle session leaves unused goes to the others. Under overload new sessions
+// are admitted with a smaller window.
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#define SCHED_SESSIONS_MAX 256
+#define SCHED_WEIGHTS_MAX 16
+#define SCHED_WEIGHT_DEFAULT 1
+#define SCHED_WEIGHT_MAX 1000
+
+// A session quiet for longer than this leaves its share to the others
+#define SCHED_ACTIVE_MS 100
+// How often a session re-reads the table for its share
+#define SCHED_SHARE_MS 10
+// Credit a session may bank while it has nothing to send
+#define SCHED_BURST_MS 5
+// Smallest window admission control hands out
+#define SCHED_WINDOW_MIN 4
+
+void
+schedulerInit(
+	uint64_t rate, // Aggregate bytes per second, 0 for no cap
+	uint32_t sessions // Sessions before admission control kicks in, 0 for no limit
+);
+
+bool
+schedulerSetWeight(
+	const char* arg
+);
+
+uint32_t
+schedulerJoin(
+	const struct sockaddr_in6* client,
+	uint32_t windowSize
+);
+
+void
+schedulerLeave(
+	void
+);
+
+uint32_t
+schedulerWaitMs(
+	void
+);
+
+void
+schedulerCharge(
+	uint32_t bytes
+);
+
+#endif // SCHEDULER_H
@@ -1,13 +1,27 @@
 /* Server side - UDP Code				    */
 /* By Hugh Smith	4/1/2017	*/
 
+// F_SETLEASE
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <linux/sockios.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -20,13 +34,45 @@
 
 #include "packet.h"
 #include "window.h"
-
-#define MAX_ARGS 3
-#define MIN_ARGS 2
+#include "compress.h"
+#include "digest.h"
+#include "fileCache.h"
+#include "rtt.h"
+#include "scheduler.h"
+#include "telemetry.h"
+#include "trace.h"
+
+#define MAX_ARGS 2
+#define MIN_ARGS 1
+
+#define WORKERS_MAX 256
+#define FILENAME_STALE_MS 1000
+
+// Streaming sources (FILE_OPT_STREAM)
+#define STREAM_KEEPALIVE_MS 1000
+#define STREAM_POLL_MS 250
+// Without a lease to ask for writers, a source this long without new data counts as closed
+#define STREAM_IDLE_EOF_MS 10000
 
 typedef struct{
 	float errorRate;
 	uint16_t port;
+	size_t cacheBytes;
+
+	// Prefork mode, a fixed pool of workers share the port through SO_REUSEPORT
+	bool prefork;
+	uint32_t numWorkers;
+
+	// Shared across sessions, see scheduler.h
+	uint64_t rateBytes;
+	uint32_t sessionsMax;
+
+	// JSON report per transfer (-t), and every second while it runs (-T)
+	const char* telemetryPath;
+	bool telemetryPeriodic;
+
+	// Binary event trace per process (-E), see trace.h
+	const char* traceDir;
 
 	int socketNum;
 }ServerSettings_t;
@@ -34,8 +80,29 @@ typedef struct{
 typedef struct{
 	uint32_t windowSize;
 	uint16_t bufferSize;
+	uint8_t options;
 
 	FILE* file;
+	const uint8_t* fileMap;
+	size_t fileMapLen;
+	size_t filePos;
+	size_t rangeEnd;
+
+	uint8_t* stage;
+	uint32_t stageLen;
+	uint32_t stageMax;
+	bool stageEof;
+
+	Digest_t digest;
+	bool digestPending;
+
+	Rtt_t rtt;
+
+	// inotify for a growing file, the file itself for a FIFO, -1 if neither
+	int streamFd;
+	bool streamIsFifo;
+	bool streamClosed;
+	uint64_t streamDataMs;
 
 	int socketNum;
 	struct sockaddr_in6* client;
@@ -47,11 +114,33 @@ enum MainServerStates_e{
 	STATE_PROCESS_FILENAME,
 	STATE_SEND_RECEIVE_DATA,
 	STATE_LAST_DATA,
+	STATE_END_SESSION,
 	STATE_KILL,
 
 	NUM_MAIN_STATES
 };
 
+// Where a session's time goes, the send loop split finer than the state machine
+enum SessionPhases_e{
+	PHASE_SETUP = 0,
+	PHASE_WINDOW_OPEN,
+	PHASE_WINDOW_CLOSED,
+	PHASE_PACED,
+	PHASE_STREAM_WAIT,
+	PHASE_LAST_DATA,
+
+	NUM_PHASES
+};
+
+static const char* const phaseNames[NUM_PHASES] = {
+	"setup",
+	"window_open",
+	"window_closed",
+	"paced",
+	"stream_wait",
+	"last_data",
+};
+
 static ServerSettings_t settings = {0};
 static SeqNum_t seqNum = 0;
 
@@ -65,21 +154,15 @@ receiveAndValidateData(
 	bool serverSocket
 ){	
 	bool retVal = true;
-	char buffer[expectedSize];
 
 	int socketNum = (serverSocket) ? settings.socketNum : client->socketNum;
 
-	// call safeRecvFrom
-	int dataLen = safeRecvfrom(socketNum, buffer, expectedSize, 0, (struct sockaddr*) client->client, &client->clientAddrlen);
-
-	// Copy data from buffer into packet struct
-	memcpy(packetPtr, buffer, dataLen);
+	// Receive straight into the packet, payloads can be up to PAYLOAD_MAX
+	int dataLen = safeRecvfrom(socketNum, (uint8_t*) packetPtr, expectedSize, 0, (struct sockaddr*) client->client, &client->clientAddrlen);
 
 	if(validateSize && dataLen < expectedSize){
 		// Short Packet Received
-	#ifdef __DEBUG_ON
-		printf("Error: Less bytes received than expected!\n");
-	#endif // __DEBUG_ON
+		TRACE(SRV_SHORT_PACKET, seqNum);
 		retVal = false;
 	}
 
@@ -89,9 +172,7 @@ receiveAndValidateData(
 
 	if(!isValidPacket(packetPtr, dataLen)){
 		// Invalid Packet Received
-	#ifdef __DEBUG_ON
-		printf("Error: Malformed packet receieved!\n");
-	#endif // __DEBUG_ON
+		TRACE(MALFORMED_PACKET, seqNum);
 		retVal = false;
 	}
 	
@@ -103,7 +184,7 @@ receiveAndValidateData(
 
 // 	// print out bytes received
 // 	for(int i=0; i < dataLen; i++){
-// 		printf("%02x ", buffer[i]);
+// 		printf("%02x ", ((uint8_t*) packetPtr)[i]);
 // 	}
 
 // 	printf("\n");
@@ -112,6 +193,26 @@ receiveAndValidateData(
 	return retVal;
 }
 
+bool
+isStaleFileName(
+	void
+){
+	struct timeval now;
+	struct timeval stamp;
+
+	// rcopy reopens its socket each time it retries the filename, so a request that sat
+	// in a busy worker's queue longer than that has nobody left to answer to
+	if(ioctl(settings.socketNum, SIOCGSTAMP, &stamp) < 0){
+		return false;
+	}
+
+	gettimeofday(&now, NULL);
+
+	long waitedMs = (now.tv_sec - stamp.tv_sec) * 1000 + (now.tv_usec - stamp.tv_usec) / 1000;
+
+	return waitedMs >= FILENAME_STALE_MS;
+}
+
 int
 waitFileName(
 	Packet_t* packetPtr,
@@ -119,73 +220,314 @@ waitFileName(
 ){	
 	if(settings.socketNum == pollCall(POLL_FOREVER)){
 		if(!receiveAndValidateData(packetPtr, NULL, FILENAME_MAX_SSIZE, client, false, true)){
-		#ifdef __DEBUG_ON
-			printf("Error: Bad filename packet received! Throwing out...\n");
-		#endif // __DEBUG_ON
+			TRACE(SRV_BAD_FILENAME_PACKET, seqNum);
+			return STATE_WAIT_FILENAME;
+		}
+
+		if(settings.prefork && isStaleFileName()){
+			TRACE(SRV_STALE_FILENAME, seqNum);
 			return STATE_WAIT_FILENAME;
 		}
-	#ifdef __DEBUG_ON
-		printf("Info: Filename received! Processing filename...\n");
-	#endif // __DEBUG_ON
+		TRACE(SRV_FILENAME_RECEIVED, seqNum);
 
 		return STATE_PROCESS_FILENAME;
 	} else {
-	#ifdef __DEBUG_ON
-		printf("Error: Data recieved on not main socket while waiting for filename! (This shouldn't happen)\n");
-	#endif // __DEBUG_ON
+		TRACE(SRV_DATA_ON_MAIN_SOCKET, seqNum);
 		return STATE_KILL;
 	}
 }
 
+FILE*
+openSource(
+	const char* fileName,
+	uint8_t options
+){
+	if(!(options & FILE_OPT_STREAM)){
+		return fopen(fileName, "r");
+	}
+
+	// Non-blocking, opening a FIFO would otherwise wait for a writer
+	int fd = open(fileName, O_RDONLY | O_NONBLOCK);
+
+	return (fd < 0) ? NULL : fdopen(fd, "r");
+}
+
+void
+setupStream(
+	ClientSettings_t* client,
+	const char* fileName
+){
+	struct stat fileStat;
+
+	client->streamClosed = false;
+	client->streamDataMs = rttNowUs() / 1000;
+	client->streamIsFifo = (fstat(fileno(client->file), &fileStat) == 0 && S_ISFIFO(fileStat.st_mode));
+
+	if(client->streamIsFifo){
+		client->streamFd = fileno(client->file);
+		return;
+	}
+
+	// Lease breaks raise SIGIO, ours is only ever held for an instant
+	signal(SIGIO, SIG_IGN);
+
+	if((client->streamFd = inotify_init1(IN_NONBLOCK)) < 0){
+		perror("setupStream: inotify_init1() error");
+		return;
+	}
+
+	if(inotify_add_watch(client->streamFd, fileName, IN_MODIFY | IN_CLOSE_WRITE) < 0){
+		// Falls back to polling the file
+		perror("setupStream: inotify_add_watch() error");
+
+		close(client->streamFd);
+		client->streamFd = -1;
+	}
+}
+
+bool
+streamWriterGone(
+	ClientSettings_t* client
+){
+	if(client->streamIsFifo){
+		struct pollfd fifoPoll = {fileno(client->file), POLLIN, 0};
+
+		// Linux only raises POLLHUP on a FIFO once a writer has come and gone
+		return poll(&fifoPoll, 1, 0) > 0 && (fifoPoll.revents & POLLHUP);
+	}
+
+	// A read lease is only granted while nobody has the file open for writing
+	if(fcntl(fileno(client->file), F_SETLEASE, F_RDLCK) == 0){
+		fcntl(fileno(client->file), F_SETLEASE, F_UNLCK);
+		return true;
+	}
+
+	if(errno == EAGAIN){
+		return false;
+	}
+
+	// Not the file's owner, go by close events and how long it's been quiet
+	return client->streamClosed || rttNowUs() / 1000 - client->streamDataMs >= STREAM_IDLE_EOF_MS;
+}
+
+size_t
+readStream(
+	ClientSettings_t* client,
+	uint8_t* buffer,
+	size_t bufferLen,
+	bool* atEndPtr
+){
+	ssize_t readLen = read(fileno(client->file), buffer, bufferLen);
+
+	if(readLen < 0 && errno != EAGAIN && errno != EINTR){
+		perror("readStream: Error reading file. Exiting...");
+		exit(1);
+	}
+
+	if(readLen <= 0 && bufferLen > 0 && streamWriterGone(client)){
+		// Once more, the writer may have added to it right before leaving
+		readLen = read(fileno(client->file), buffer, bufferLen);
+
+		if(readLen <= 0){
+			*atEndPtr = true;
+		}
+	}
+
+	if(readLen < 0){
+		return 0;
+	}
+
+	if(readLen > 0){
+		client->streamDataMs = rttNowUs() / 1000;
+	}
+
+	return readLen;
+}
+
+void
+drainStreamEvents(
+	ClientSettings_t* client
+){
+	uint8_t events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t eventsLen;
+
+	if(client->streamIsFifo){
+		return;
+	}
+
+	while((eventsLen = read(client->streamFd, events, sizeof(events))) > 0){
+		for(uint8_t* eventPtr = events; eventPtr < events + eventsLen; eventPtr += sizeof(struct inotify_event) + ((struct inotify_event*) eventPtr)->len){
+			if(((struct inotify_event*) eventPtr)->mask & IN_CLOSE_WRITE){
+				client->streamClosed = true;
+			}
+		}
+	}
+}
+
+void
+sendToClient(
+	ClientSettings_t* client,
+	Packet_t* packetPtr,
+	uint16_t size
+){
+	safeSendto(client->socketNum, (uint8_t*) packetPtr, size, 0, (struct sockaddr*) client->client, client->clientAddrlen);
+
+	schedulerCharge(size);
+	telemetrySent(size, packetPtr->header.flag);
+}
+
+void
+sendFileNameResp(
+	ClientSettings_t* client,
+	bool response
+){
+	Packet_t respPacket;
+	buildFileNameRespPacket(&respPacket, 0, response, client->options);
+
+	sendToClient(client, &respPacket, FILENAME_RESP_PACKET_SSIZE);
+}
+
+void
+selectRange(
+	FileNamePacket_t* fileNamePtr,
+	ClientSettings_t* client
+){
+	struct stat fileStat;
+
+	client->filePos = 0;
+	client->rangeEnd = SIZE_MAX;
+
+	if(!(client->options & FILE_OPT_RANGE) || fstat(fileno(client->file), &fileStat) < 0){
+		return;
+	}
+
+	size_t fileSize = fileStat.st_size;
+	int64_t offset = (int64_t) netToHost64((uint64_t) fileNamePtr->rangeOffset);
+	uint64_t length = netToHost64(fileNamePtr->rangeLength);
+
+	// Clamped to the file, a range hanging off either end just comes back short
+	if(offset < 0){
+		client->filePos = (0 - (uint64_t) offset > fileSize) ? 0 : fileSize - (0 - (uint64_t) offset);
+	} else {
+		client->filePos = ((uint64_t) offset > fileSize) ? fileSize : (size_t) offset;
+	}
+
+	if(length > 0 && length < SIZE_MAX - client->filePos){
+		client->rangeEnd = client->filePos + length;
+	}
+
+	if(client->fileMap == NULL && fseeko(client->file, client->filePos, SEEK_SET) < 0){
+		perror("selectRange: fseeko() error");
+	}
+
+	TRACE(SRV_BYTE_RANGE, seqNum, client->filePos, (client->rangeEnd < fileSize) ? client->rangeEnd : fileSize, fileSize);
+}
+
 int
 processFileName(
 	Packet_t* packetPtr,
 	ClientSettings_t* client
 ){
 	bool goodFile = true;
+	char fileName[FILENAME_MAX_LEN + 1];
 
-	if((client->file = fopen((char*) packetPtr->payload.fileName.fileName, "r")) == NULL){
+	memcpy(fileName, packetPtr->payload.fileName.fileName, FILENAME_MAX_LEN);
+	fileName[FILENAME_MAX_LEN] = '\0';
+
+	client->windowSize = ntohl(packetPtr->payload.fileName.windowSize);
+	client->bufferSize = ntohs(packetPtr->payload.fileName.bufferSize);
+	client->options = negotiateOptions(packetPtr->payload.fileName.options, client->bufferSize);
+	client->streamFd = -1;
+
+	if(
+		client->windowSize == 0 || client->windowSize > WINDOW_SIZE_MAX ||
+		client->bufferSize < PAYLOAD_MIN || client->bufferSize > PAYLOAD_MAX
+	){
+		// Buffers are sized from these, refuse anything out of range
+		TRACE(SRV_BAD_SIZES, seqNum, client->windowSize, client->bufferSize);
+		client->file = NULL;
+		goodFile = false;
+	} else if((client->file = openSource(fileName, client->options)) == NULL){
 		// Bad filename
-	#ifdef __DEBUG_ON
-		printf("Error: Bad filename received! Sending response...\n");
-	#endif // __DEBUG_ONf
+		TRACE(SRV_BAD_FILENAME, seqNum);
 		goodFile = false;
 	}
 
-	pid_t pid;
+	const char* cacheLookup = NULL;
 
-	if((pid = fork()) < 0){
-		perror("processFileName: fork() error. Exiting...");
+	if(goodFile && !(client->options & FILE_OPT_STREAM)){
+		// A mapping would only ever show the file as it was when the session started
+		FileCacheStats_t before = fileCacheStats();
 
-		exit(1);
-	} else if (pid != 0){
-		//Parent
-		return STATE_WAIT_FILENAME;
+		client->fileMap = fileCacheAcquire(fileName, &client->fileMapLen);
+
+		FileCacheStats_t after = fileCacheStats();
+		cacheLookup = (after.hits > before.hits) ? "hit" : (after.bypassed > before.bypassed) ? "bypass" : "miss";
+		TRACE(SRV_FILE_CACHE, seqNum, after.hits, after.misses, after.evictions);
+	} else {
+		client->fileMap = NULL;
+	}
+
+	if(!settings.prefork){
+		pid_t pid;
+
+		if((pid = fork()) < 0){
+			perror("processFileName: fork() error. Exiting...");
+
+			exit(1);
+		} else if (pid != 0){
+			//Parent
+			if(client->file != NULL){
+				fclose(client->file);
+			}
+
+			return STATE_WAIT_FILENAME;
+		}
+
+		//Child, fork() is forkMod and already gave it its own seed
+	}
+
+	if(goodFile){
+		// May come back smaller when the server is overloaded, rcopy's larger buffer still fits it
+		client->windowSize = schedulerJoin(client->client, client->windowSize);
+
+		telemetryStart("server", fileName, phaseNames, NUM_PHASES, PHASE_SETUP);
+
+		if(cacheLookup != NULL){
+			FileCacheStats_t cacheStats = fileCacheStats();
+			telemetryFileCache(cacheLookup, &cacheStats);
+		}
 	}
 
-	//Child
 	if((client->socketNum = socket(AF_INET6, SOCK_DGRAM, 0)) < 0){
 			perror("processFileName: socket() call");
 	}
 
-	sendErr_init(settings.errorRate, DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON);
-
-	client->windowSize = ntohl(packetPtr->payload.fileName.windowSize);
-	client->bufferSize = ntohs(packetPtr->payload.fileName.bufferSize);
-#ifdef __DEBUG_ON
-	printf("Info: Client window size received as: %i buffer size received as: %i\n", client->windowSize, client->bufferSize);
-#endif // __DEBUG_ON
+	removeFromPollSet(settings.socketNum);
+	addToPollSet(client->socketNum);
 
-	Packet_t respPacket;
-	buildFileNameRespPacket(&respPacket, seqNum++, goodFile);
+	udpSetBufferSizes(client->socketNum, SOCKET_BUFFER_SSIZE(client->windowSize, client->bufferSize));
 
-	safeSendto(client->socketNum, (uint8_t*) &respPacket, FILENAME_RESP_PACKET_SSIZE, 0, (struct sockaddr*) client->client, client->clientAddrlen);
+	TRACE(SRV_CLIENT_SETTINGS, seqNum, client->windowSize, client->bufferSize, client->options);
 
 	if(goodFile){
+		selectRange(&packetPtr->payload.fileName, client);
+
+		// No positive response, the first data packet tells rcopy the file is good
+		seqNum = SEQ_NUM_START;
+
+		if(client->options & FILE_OPT_STREAM){
+			// Unless the source may stay empty for a while
+			setupStream(client, fileName);
+			sendFileNameResp(client, true);
+		}
+
 		return STATE_SEND_RECEIVE_DATA;
-	} else {
-		return STATE_KILL;
 	}
+
+	sendFileNameResp(client, false);
+
+	return STATE_END_SESSION;
 }
 
 int
@@ -193,33 +535,48 @@ processRrSrej(
 	Packet_t* packetPtr,
 	ClientSettings_t* client
 ){
-	memset(packetPtr, 0, PACKET_MAX_SSIZE);
+	memset(packetPtr, 0, RR_PACKET_SSIZE);
 
 	uint16_t dataSize;
 
-	if(!receiveAndValidateData(packetPtr, &dataSize, RR_PACKET_SSIZE, client, true, false)){
-	#ifdef __DEBUG_ON
-		printf("Error: Invalid RR/SREJ packet recieved! Throwing out...\n");
-	#endif // __DEBUG_ON
+	if(!receiveAndValidateData(packetPtr, &dataSize, RR_PACKET_SSIZE, client, false, false)){
+		TRACE(SRV_INVALID_RR_SREJ, seqNum);
 
 		return -1;
 	}
 
+	// RRs carry a credit that SREJs don't, check the size against the flag
+	if(dataSize < ((packetPtr->header.flag == FLAG_TYPE_SREJ) ? SREJ_PACKET_SSIZE : RR_PACKET_SSIZE)){
+		TRACE(SRV_SHORT_RR_SREJ, seqNum);
+
+		return -1;
+	}
+
+	telemetryReceived(dataSize, packetPtr->header.flag);
+
 	switch (packetPtr->header.flag)
 	{
 	case FLAG_TYPE_RR:
 	{
-	#ifdef __DEBUG_ON
-		printf("Info: Received RR# %i. Removing from window...\n", ntohl(packetPtr->payload.rr.seqNum));
-	#endif // __DEBUG_ON
+		TRACE(SRV_RR, ntohl(packetPtr->payload.rr.seqNum), ntohl(packetPtr->payload.rr.seqNum), ntohl(packetPtr->payload.rr.credit));
+
+		uint64_t rttUs;
+
+		// The RR's newest packet gives the sample, delayed acks included
+		if(packetRttSample(ntohl(packetPtr->payload.rr.seqNum) - 1, rttNowUs(), &rttUs)){
+			rttSample(&client->rtt, rttUs);
+			telemetryRtt(rttUs);
+		}
 
 		removePacket(ntohl(packetPtr->payload.rr.seqNum));
+		setWindowCredit(ntohl(packetPtr->payload.rr.seqNum), ntohl(packetPtr->payload.rr.credit));
 		return FLAG_TYPE_RR;
 	}
 	case FLAG_TYPE_SREJ:
 	{
 		Packet_t srejDataPacket;
 		getPacket(&srejDataPacket, &dataSize, ntohl(packetPtr->payload.srej.seqNum));
+		markPacketResent(ntohl(packetPtr->payload.srej.seqNum));
 
 		if(srejDataPacket.header.flag != FLAG_TYPE_EOF){
 			srejDataPacket.header.cksum = 0;
@@ -228,7 +585,7 @@ processRrSrej(
 			srejDataPacket.header.cksum = in_cksum((uint16_t*) &srejDataPacket, dataSize);
 		}
 
-		safeSendto(client->socketNum, (uint8_t*) &srejDataPacket, dataSize, 0, (struct sockaddr*) client->client, client->clientAddrlen);
+		sendToClient(client, &srejDataPacket, dataSize);
 		return FLAG_TYPE_SREJ;
 	}
 	case FLAG_TYPE_EOF_ACK:
@@ -237,15 +594,166 @@ processRrSrej(
 	}
 	
 	default:
-	#ifdef __DEBUG_ON
-		printf("Error: Recieved packet not SREJ or RR Type! Throwing out...\n");
-	#endif // __DEBUG_ON
+		TRACE(SRV_NOT_RR_SREJ, seqNum);
 
 		return -1;
 	}
 }
 
-void
+size_t
+readFileData(
+	ClientSettings_t* client,
+	uint8_t* buffer,
+	size_t bufferLen,
+	bool* atEndPtr
+){
+	size_t readLen;
+	bool rangeDone = false;
+
+	// A byte range can stop short of the end of the file
+	if(bufferLen >= client->rangeEnd - client->filePos){
+		bufferLen = client->rangeEnd - client->filePos;
+		rangeDone = true;
+	}
+
+	if(client->fileMap != NULL){
+		// Cached file, copy straight out of the shared mapping
+		readLen = (client->filePos < client->fileMapLen) ? client->fileMapLen - client->filePos : 0;
+
+		if(readLen > bufferLen){
+			readLen = bufferLen;
+		}
+
+		if(!fileCacheCopy(buffer, client->fileMap + client->filePos, readLen)){
+			// Truncated under us, finish it like an uncached file (short, at the new EOF)
+			TRACE(SRV_CACHE_TRUNCATED, seqNum, client->filePos);
+			client->fileMap = NULL;
+
+			if(fseeko(client->file, client->filePos, SEEK_SET) < 0){
+				perror("readFileData: fseeko() error");
+			}
+
+			return readFileData(client, buffer, bufferLen, atEndPtr);
+		}
+		client->filePos += readLen;
+
+		*atEndPtr = (client->filePos >= client->fileMapLen);
+	} else if(client->options & FILE_OPT_STREAM){
+		readLen = readStream(client, buffer, bufferLen, atEndPtr);
+		client->filePos += readLen;
+	} else {
+		readLen = fread(buffer, sizeof(char), bufferLen, client->file);
+		client->filePos += readLen;
+
+		if(readLen < bufferLen){
+			if(feof(client->file)){
+				*atEndPtr = true;
+			}
+
+			if(ferror(client->file)){
+				perror("sendAndRecieveData: Error reading file. Exiting...");
+				exit(1);
+			}
+		}
+	}
+
+	if(rangeDone && readLen == bufferLen){
+		*atEndPtr = true;
+	}
+
+	if(client->options & FILE_OPT_DIGEST){
+		digestUpdate(&client->digest, buffer, readLen);
+	}
+
+	telemetryCount(TELEMETRY_FILE_BYTES, readLen);
+
+	return readLen;
+}
+
+uint16_t
+readRawBlock(
+	ClientSettings_t* client,
+	uint8_t* data,
+	bool* atEof
+){
+	uint16_t dataLen = (uint16_t) readFileData(client, data, client->bufferSize, atEof);
+
+	if(*atEof){
+		TRACE(SRV_EOF_REACHED, seqNum);
+	}
+
+	return dataLen;
+}
+
+uint16_t
+readCompressedBlock(
+	ClientSettings_t* client,
+	uint8_t* data,
+	bool* atEof
+){
+	BlockHeader_t* blockPtr = (BlockHeader_t*) data;
+	uint8_t* blockData = data + BLOCK_HEADER_SSIZE;
+	uint16_t blockRoom = client->bufferSize - BLOCK_HEADER_SSIZE;
+
+	// Keep the stage full so a block can carry as much raw data as will compress into it
+	if(!client->stageEof){
+		client->stageLen += readFileData(client, client->stage + client->stageLen, client->stageMax - client->stageLen, &client->stageEof);
+	}
+
+	if(client->stageLen == 0 && !client->stageEof){
+		// Streaming source with nothing new yet
+		return 0;
+	}
+
+	uint32_t rawUsed = 0;
+	uint16_t blockLen = lzCompress(client->stage, client->stageLen, &rawUsed, blockData, blockRoom);
+	uint32_t rawFit = (client->stageLen < blockRoom) ? client->stageLen : blockRoom;
+
+	if(rawUsed > rawFit || (rawUsed == rawFit && blockLen < rawFit)){
+		blockPtr->encoding = BLOCK_ENCODING_LZ;
+	} else {
+		// Compression doesn't help this block, send it raw
+		blockPtr->encoding = BLOCK_ENCODING_RAW;
+
+		rawUsed = rawFit;
+		blockLen = (uint16_t) rawFit;
+
+		memcpy(blockData, client->stage, rawFit);
+	}
+
+	TRACE(SRV_BLOCK_ENCODING, seqNum, blockPtr->encoding, rawUsed, blockLen);
+
+	blockPtr->rawSize = htons((uint16_t) rawUsed);
+
+	client->stageLen -= rawUsed;
+	memmove(client->stage, client->stage + rawUsed, client->stageLen);
+
+	if(client->stageEof && client->stageLen == 0){
+		TRACE(SRV_EOF_REACHED, seqNum);
+
+		*atEof = true;
+	}
+
+	return BLOCK_HEADER_SSIZE + blockLen;
+}
+
+uint16_t
+buildDigestPayload(
+	ClientSettings_t* client,
+	uint8_t* data
+){
+	EofDigest_t* digestPtr = (EofDigest_t*) data;
+	uint64_t fastHash;
+
+	digestFinal(&client->digest, &fastHash, digestPtr->sha256);
+	digestPtr->fastHash = hostToNet64(fastHash);
+
+	TRACE(SRV_DIGEST, seqNum, fastHash);
+
+	return EOF_DIGEST_SSIZE(client->options);
+}
+
+bool
 readFromDiskAndSend(
 	Packet_t* packetPtr,
 	ClientSettings_t* client,
@@ -253,31 +761,35 @@ readFromDiskAndSend(
 	uint16_t* dataSize,
 	bool* atEof
 ){
-	memset(data, 0, client->bufferSize);
-	memset(packetPtr, 0, PACKET_MAX_SSIZE);
-
-	uint16_t dataLen = (uint16_t) fread(data, sizeof(char), client->bufferSize, client->file);
+	uint16_t dataLen = 0;
 
-	if(dataLen < client->bufferSize){
-		if(feof(client->file)){
-		#ifdef __DEBUG_ON
-			printf("Info: End of file reached! Sending last bit of data...\n");
-		#endif // __DEBUG_ON
-
-			*atEof = true;
+	if(!client->digestPending){
+		if(client->options & FILE_OPT_COMPRESS){
+			dataLen = readCompressedBlock(client, data, atEof);
+		} else {
+			dataLen = readRawBlock(client, data, atEof);
 		}
 
-		if(ferror(client->file)){
-			perror("sendAndRecieveData: Error reading file. Exiting...");
-			exit(1);
+		if(*atEof && (client->options & FILE_OPT_DIGEST)){
+			// The digest goes alone in the EOF packet, finish the file data as a normal packet first
+			*atEof = false;
+			client->digestPending = true;
 		}
 	}
+
+	if(client->digestPending && dataLen == 0){
+		dataLen = buildDigestPayload(client, data);
+		*atEof = true;
+	}
+
+	if(dataLen == 0 && !*atEof){
+		// Only a streaming source runs dry before its end
+		return false;
+	}
 	
 	*dataSize = DATA_PACKET_SSIZE(dataLen);
 
-#ifdef __DEBUG_ON
-printf("Info: Sending data %i\n", seqNum);
-#endif // __DEBUG_ON
+	TRACE(SRV_SEND_DATA, seqNum, seqNum);
 
 	buildDataPacket(packetPtr, seqNum++, data, dataLen);
 
@@ -288,9 +800,101 @@ printf("Info: Sending data %i\n", seqNum);
 		packetPtr->header.cksum = in_cksum((uint16_t*) packetPtr, *dataSize);
 	}
 
-	safeSendto(client->socketNum, (uint8_t*) packetPtr, *dataSize, 0, (struct sockaddr*) client->client, client->clientAddrlen);
+	sendToClient(client, packetPtr, *dataSize);
 
 	addPacket(packetPtr, *dataSize);
+	stampPacket(ntohl(packetPtr->header.seqNum), rttNowUs());
+
+	return true;
+}
+
+void
+resendLowest(
+	Packet_t* packetPtr,
+	ClientSettings_t* client
+){
+	uint16_t dataSize;
+
+	getLowestPacket(packetPtr, &dataSize);
+	markPacketResent(ntohl(packetPtr->header.seqNum));
+
+	packetPtr->header.cksum = 0;
+	packetPtr->header.flag = FLAG_TYPE_TIMEOUT_DATA;
+
+	packetPtr->header.cksum = in_cksum((uint16_t*) packetPtr, dataSize);
+
+	sendToClient(client, packetPtr, dataSize);
+}
+
+void
+sendKeepalive(
+	Packet_t* packetPtr,
+	ClientSettings_t* client,
+	int* timeoutPtr
+){
+	uint16_t dataSize;
+
+	if(seqNum == SEQ_NUM_START){
+		// Nothing sent yet, repeat the filename response. rcopy answers it with an RR, a client
+		// that went away before the first data counts toward TIMEOUT_MAX like any other
+		sendFileNameResp(client, true);
+
+		(*timeoutPtr)++;
+		return;
+	}
+
+	// Everything sent is acked, rcopy answers a repeat of the last packet with an RR
+	getPacket(packetPtr, &dataSize, seqNum - 1);
+
+	packetPtr->header.cksum = 0;
+	packetPtr->header.flag = FLAG_TYPE_TIMEOUT_DATA;
+
+	packetPtr->header.cksum = in_cksum((uint16_t*) packetPtr, dataSize);
+
+	sendToClient(client, packetPtr, dataSize);
+
+	(*timeoutPtr)++;
+}
+
+bool
+waitStream(
+	Packet_t* packetPtr,
+	ClientSettings_t* client,
+	int* timeoutPtr
+){
+	bool inFlight = packetsInFlight() > 0;
+	int waitMs = (inFlight) ? (int) rttProbeMs(&client->rtt, *timeoutPtr) : STREAM_KEEPALIVE_MS;
+
+	if(client->streamFd < 0 && waitMs > STREAM_POLL_MS){
+		waitMs = STREAM_POLL_MS;
+	}
+
+	// Only in the poll set while waiting here, the other waits are for the client alone
+	if(client->streamFd >= 0){
+		addToPollSet(client->streamFd);
+	}
+
+	int readyFd = pollCall(waitMs);
+
+	if(client->streamFd >= 0){
+		removeFromPollSet(client->streamFd);
+	}
+
+	if(readyFd == client->socketNum){
+		*timeoutPtr = 0;
+
+		processRrSrej(packetPtr, client);
+	} else if(readyFd >= 0){
+		drainStreamEvents(client);
+	} else if(inFlight){
+		(*timeoutPtr)++;
+
+		resendLowest(packetPtr, client);
+	} else {
+		sendKeepalive(packetPtr, client, timeoutPtr);
+	}
+
+	return *timeoutPtr <= TIMEOUT_MAX;
 }
 
 int
@@ -300,34 +904,65 @@ sendAndReceiveData(
 ){
 	windowInit(client->windowSize, client->bufferSize);
 
+	if(client->options & FILE_OPT_COMPRESS){
+		client->stageMax = BLOCK_RAW_MAX_SSIZE(client->bufferSize);
+		client->stage = (uint8_t*) sCalloc(client->stageMax, sizeof(uint8_t));
+		client->stageLen = 0;
+		client->stageEof = false;
+	}
+
+	digestInit(&client->digest, client->options & FILE_OPT_DIGEST_SHA256);
+	client->digestPending = false;
+
+	rttInit(&client->rtt);
+
 	bool atEof = false;
 
 	uint8_t data[client->bufferSize];
 	uint16_t dataSize = 0;
 
-	removeFromPollSet(settings.socketNum);
-	addToPollSet(client->socketNum);
-
-	static int timeout = 0;
+	int timeout = 0;
 
 	while(!atEof){
-		#ifdef __DEBUG_ON
-			printf("\nInfo: -------------------\n");
-			printf("Info: --- Window Open ---\n");
-			printf("Info: -------------------\n\n");
-		#endif // __DEBUG_ON
+		TRACE(SRV_WINDOW_OPEN, seqNum);
 
 		while(isWindowOpen()){
+			uint32_t schedMs = schedulerWaitMs();
+
+			telemetryTick();
+
+			if(schedMs > 0){
+				telemetryState(PHASE_PACED);
+
+				// Over this session's share of the rate cap, keep serving RRs/SREJs until it earns more
+				if(pollCall(schedMs) >= 0){
+					timeout = 0;
+
+					processRrSrej(packetPtr, client);
+				}
+
+				continue;
+			}
+
+			telemetryState(PHASE_WINDOW_OPEN);
+
+			if(!readFromDiskAndSend(packetPtr, client, data, &dataSize, &atEof)){
+				telemetryState(PHASE_STREAM_WAIT);
+
+				if(!waitStream(packetPtr, client, &timeout)){
+					TRACE(SRV_STREAM_TIMEOUT, seqNum);
+
+					return STATE_END_SESSION;
+				}
 
-			readFromDiskAndSend(packetPtr, client, data, &dataSize, &atEof);
+				continue;
+			}
 
 			if(atEof){
 				return STATE_LAST_DATA;
 			}
 
-		#ifdef __DEBUG_ON
-			printf("Info: Checking for RR's or SREJ's\n");
-		#endif // __DEBUG_ON
+			TRACE(SRV_CHECK_RR_SREJ, seqNum);
 
 			//Handle RR's and SREJ's
 			while(pollCall(POLL_NO_BLOCK) > 0){
@@ -339,42 +974,28 @@ sendAndReceiveData(
 			return STATE_LAST_DATA;
 		}
 
-		#ifdef __DEBUG_ON
-			printf("\nInfo: --------------------\n");
-			printf("Info: --- Window Closed ---\n");
-			printf("Info: ---------------------\n\n");
-		#endif // __DEBUG_ON
+		TRACE(SRV_WINDOW_CLOSED, seqNum);
+
+		telemetryState(PHASE_WINDOW_CLOSED);
 
 		while(!isWindowOpen()){
-		#ifdef __DEBUG_ON
-			printf("Info: Waiting on RR/SREJs...\n");
-		#endif // __DEBUG_ON
+			TRACE(SRV_WAIT_RR_SREJ, seqNum);
+
+			telemetryTick();
 
 			if(timeout > TIMEOUT_MAX){
-			#ifdef __DEBUG_ON
-				printf("Timeout: Timed out waiting for client response! Ending session...\n");
-			#endif // __DEBUG_ON
+				TRACE(SRV_CLIENT_TIMEOUT, seqNum);
 				
-				return STATE_KILL;
+				return STATE_END_SESSION;
 			}
 
-			if(pollCall(1000) < 0){
-			#ifdef __DEBUG_ON
-				printf("Timeout: Timeout waiting for RR/SREJs. Sending lowest packet...\n");
-			#endif // __DEBUG_ON
+			// Same probe as the teardown, the tail of a closed window has nothing behind it to trigger an SREJ
+			if(pollCall(rttProbeMs(&client->rtt, timeout)) < 0){
+				TRACE(SRV_RESEND_LOWEST, seqNum);
 
 				timeout++;
 
-				memset(packetPtr, 0, PACKET_MAX_SSIZE);
-
-				getLowestPacket(packetPtr, &dataSize);
-
-				packetPtr->header.cksum = 0;
-				packetPtr->header.flag = FLAG_TYPE_TIMEOUT_DATA;
-
-				packetPtr->header.cksum = in_cksum((uint16_t*) packetPtr, dataSize);
-
-				safeSendto(client->socketNum, (uint8_t*) packetPtr, dataSize, 0, (struct sockaddr*) client->client, client->clientAddrlen);
+				resendLowest(packetPtr, client);
 			} else {
 				timeout = 0;
 
@@ -383,40 +1004,35 @@ sendAndReceiveData(
 		}
 	}
 
-#ifdef __DEBUG_ON
-	printf("Error: Sending data failed!\n");
-#endif // __DEBUG_ON
+	TRACE(SRV_SEND_FAILED, seqNum);
 
-	return STATE_KILL;
+	return STATE_END_SESSION;
 }
 
 void
 lastData(
 	ClientSettings_t* client
 ){
-#ifdef __DEBUG_ON
-	printf("\nInfo: ------------------------------------\n");
-	printf("Info: Entering last data teardown state...\n");
-	printf("Info: ------------------------------------\n\n");
-#endif // __DEBUG_ON
+	TRACE(LAST_DATA_BANNER, seqNum);
 
 	Packet_t currPacket;
 	uint16_t dataSize;
 	int timeout = 0;
 
+	telemetryState(PHASE_LAST_DATA);
+
 	do{
-		memset(&currPacket, 0, sizeof(Packet_t));
+		telemetryTick();
 
-		if(pollCall(1000) < 0){
-		#ifdef __DEBUG_ON
-			printf("Timeout: Timeout waiting for RR/SREJs. Sending lowest packet...\n");
-		#endif // __DEBUG_ON
+		// Tail-loss probe, nothing behind the last packets will trigger an SREJ so
+		// resend the lowest one after about 2 SRTT, doubling while unanswered
+		if(pollCall(rttProbeMs(&client->rtt, timeout)) < 0){
+			TRACE(SRV_TAIL_PROBE, seqNum, rttProbeMs(&client->rtt, timeout));
 
 			timeout++;
-			
-			memset(&currPacket, 0, PACKET_MAX_SSIZE);
 
 			getLowestPacket(&currPacket, &dataSize);
+			markPacketResent(ntohl(currPacket.header.seqNum));
 
 			if(currPacket.header.flag != FLAG_TYPE_EOF){
 				currPacket.header.cksum = 0;
@@ -425,32 +1041,65 @@ lastData(
 				currPacket.header.cksum = in_cksum((uint16_t*) &currPacket, dataSize);
 			}
 
-			safeSendto(client->socketNum, (uint8_t*) &currPacket, dataSize, 0, (struct sockaddr*) client->client, client->clientAddrlen);
+			sendToClient(client, &currPacket, dataSize);
 		} else {		
 			uint8_t respType = processRrSrej(&currPacket, client);
 
 			if ( respType == FLAG_TYPE_EOF_ACK){
-			#ifdef __DEBUG_ON
-				printf("Info: EOF ack recievied! Closing file...\n");
-			#endif // __DEBUG_ON
-				fclose(client->file);
-				return;
-			} else if (respType == FLAG_TYPE_RR){
-				SeqNum_t nextSeqNum = currPacket.payload.rr.seqNum;
+				TRACE(SRV_EOF_ACK, seqNum);
 
-				memset(&currPacket, 0, PACKET_MAX_SSIZE);
-
-				getPacket(&currPacket, &dataSize, nextSeqNum);
-
-				//safeSendto(client->socketNum, (uint8_t*) &currPacket, dataSize, 0, (struct sockaddr*) client->client, client->clientAddrlen);
+				telemetryFinish(true);
+				return;
+			} else if (respType == FLAG_TYPE_RR || respType == FLAG_TYPE_SREJ){
+				// Client is still there, restart the probe backoff
+				timeout = 0;
 			}
 		}
 	}while(timeout < TIMEOUT_MAX);
 
-#ifdef __DEBUG_ON
-	printf("Timeout: Timed out while waiting for EOF ack! Closing file...\n");
-#endif // __DEBUG_ON
-	fclose(client->file);
+	TRACE(SRV_EOF_ACK_TIMEOUT, seqNum);
+}
+
+int
+endSession(
+	ClientSettings_t* client
+){
+	if(client->streamFd >= 0 && !client->streamIsFifo){
+		close(client->streamFd);
+	}
+	client->streamFd = -1;
+
+	if(client->file != NULL){
+		fclose(client->file);
+		client->file = NULL;
+	}
+
+	if(client->socketNum >= 0){
+		removeFromPollSet(client->socketNum);
+		close(client->socketNum);
+		client->socketNum = -1;
+	}
+
+	windowDestroy();
+	schedulerLeave();
+
+	// No-op when lastData already reported a completed transfer
+	telemetryFinish(false);
+
+	free(client->stage);
+	client->stage = NULL;
+
+	if(!settings.prefork){
+		return STATE_KILL;
+	}
+
+	// Worker goes back to listening on the shared port for the next transfer
+	seqNum = 0;
+	addToPollSet(settings.socketNum);
+
+	TRACE(SRV_SESSION_ENDED, seqNum);
+
+	return STATE_WAIT_FILENAME;
 }
 
 void
@@ -472,14 +1121,13 @@ stateMachine(
 			client.client = &clientAddr;
 			client.socketNum = -1;
 			client.file = NULL;
+			client.fileMap = NULL;
+			client.stage = NULL;
 		}
 
-		if(
-			state == STATE_WAIT_FILENAME ||
-			state == STATE_SEND_RECEIVE_DATA
-		){
-			// Reset the currently received packet
-			memset(&currPacket, 0, PACKET_MAX_SSIZE);
+		if(state == STATE_WAIT_FILENAME){
+			// Reset the currently received packet, up to the largest filename packet
+			memset(&currPacket, 0, FILENAME_MAX_SSIZE);
 		}
 
 		switch (state)
@@ -506,14 +1154,14 @@ stateMachine(
 		{
 			lastData(&client);
 
-		#ifdef __DEBUG_ON
-			printf("Info: Exiting Gracefully...\n");
-		#endif // __DEBUG_ON
-
-			close(client.socketNum);
-			windowDestroy();
+			TRACE(SRV_EXIT, seqNum);
 
-			nextState = STATE_KILL;
+			nextState = STATE_END_SESSION;
+			break;
+		}
+		case STATE_END_SESSION:
+		{
+			nextState = endSession(&client);
 			break;
 		}
 		case STATE_KILL:
@@ -527,25 +1175,195 @@ stateMachine(
 	}
 }
 
+void
+runWorker(
+	uint32_t workerNum
+){
+	// Don't outlive the pool parent
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+	if(settings.socketNum < 0){
+		settings.socketNum = udpServerSetupReusePort(settings.port, 0);
+	}
+
+	TRACE(SRV_WORKER_START, 0, workerNum, getpid(), settings.port);
+
+	setupPollSet();
+	addToPollSet(settings.socketNum);
+
+	stateMachine();
+
+	close(settings.socketNum);
+
+	exit(0);
+}
+
+pid_t
+spawnWorker(
+	uint32_t workerNum
+){
+	pid_t pid;
+
+	if((pid = fork()) < 0){
+		perror("spawnWorker: fork() error. Exiting...");
+
+		exit(1);
+	} else if(pid == 0){
+		runWorker(workerNum);
+	}
+
+	return pid;
+}
+
+void
+runWorkerPool(
+	void
+){
+	struct sockaddr_in6 serverAddress;
+	socklen_t serverAddrLen = sizeof(serverAddress);
+
+	// Workers bind their own sockets to whatever port the OS picked
+	getsockname(settings.socketNum, (struct sockaddr*) &serverAddress, &serverAddrLen);
+	settings.port = ntohs(serverAddress.sin6_port);
+
+	pid_t* workers = (pid_t*) sCalloc(settings.numWorkers, sizeof(pid_t));
+
+	// The first worker inherits the parent's socket, the parent must not hold one in the
+	// group or the kernel would keep handing it datagrams nobody reads
+	workers[0] = spawnWorker(0);
+
+	close(settings.socketNum);
+	settings.socketNum = -1;
+
+	for(uint32_t i = 1; i < settings.numWorkers; i++){
+		workers[i] = spawnWorker(i);
+	}
+
+	while(1){
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+
+		if(pid < 0){
+			if(errno == EINTR){
+				continue;
+			}
+
+			perror("runWorkerPool: waitpid() error. Exiting...");
+			exit(1);
+		}
+
+		for(uint32_t i = 0; i < settings.numWorkers; i++){
+			if(workers[i] == pid){
+				TRACE(SRV_WORKER_RESPAWN, 0, i, pid);
+
+				workers[i] = spawnWorker(i);
+				break;
+			}
+		}
+	}
+}
+
 int
 checkArgs(
 	int argc,
 	char* argv[],
 	ServerSettings_t* settings
 ){
-    // Expecting 1 to 2 arguments plus the program name.
-    if (argc > MAX_ARGS || argc < MIN_ARGS) {
-        fprintf(stderr, "Usage: %s error-rate [optional-port-number]\n", argv[0]);
+    int opt;
+    char *endptr;
+    long value;
+
+    settings->cacheBytes = (size_t) FILE_CACHE_DEFAULT_MB << 20;
+    settings->prefork = false;
+    settings->rateBytes = 0;
+    settings->sessionsMax = 0;
+    settings->telemetryPath = NULL;
+    settings->telemetryPeriodic = false;
+    settings->traceDir = NULL;
+
+    while ((opt = getopt(argc, argv, "c:p:r:w:m:t:TE:")) != -1) {
+        switch (opt) {
+        case 'c':
+            value = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || value < 0) {
+                fprintf(stderr, "Invalid cache size: %s\n", optarg);
+                return -1;
+            }
+            settings->cacheBytes = (size_t) value << 20;
+            break;
+        case 'p':
+            value = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || value < 0 || value > WORKERS_MAX) {
+                fprintf(stderr, "Invalid number of workers: %s\n", optarg);
+                return -1;
+            }
+            if (value == 0) {
+                value = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+            settings->prefork = true;
+            settings->numWorkers = (value > 0) ? (uint32_t) value : 1;
+            break;
+        case 'r':
+        {
+            float mbps = strtof(optarg, &endptr);
+            if (*endptr != '\0' || mbps < 0.0f) {
+                fprintf(stderr, "Invalid rate cap: %s\n", optarg);
+                return -1;
+            }
+            settings->rateBytes = (uint64_t) (mbps * 1000000.0f / 8.0f);
+            break;
+        }
+        case 'w':
+            if (!schedulerSetWeight(optarg)) {
+                fprintf(stderr, "Invalid client weight: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'm':
+            value = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || value < 0 || value > SCHED_SESSIONS_MAX) {
+                fprintf(stderr, "Invalid session limit: %s\n", optarg);
+                return -1;
+            }
+            settings->sessionsMax = (uint32_t) value;
+            break;
+        case 't':
+            settings->telemetryPath = optarg;
+            break;
+        case 'T':
+            settings->telemetryPeriodic = true;
+            break;
+        case 'E':
+            settings->traceDir = optarg;
+            break;
+        default:
+            argc = 0;
+            break;
+        }
+    }
+
+    // Expecting 1 to 2 arguments after the options.
+    if (argc - optind > MAX_ARGS || argc - optind < MIN_ARGS) {
+        fprintf(stderr, "Usage: %s [-c cache-MB] [-p workers] [-r Mbit/s] [-w address=weight] [-m sessions] [-t telemetry-file [-T]] [-E trace-dir] error-rate [optional-port-number]\n", argv[0]);
+        fprintf(stderr, "  -c  memory cap of the shared file cache, 0 disables it (default %i)\n", FILE_CACHE_DEFAULT_MB);
+        fprintf(stderr, "  -p  prefork a pool of workers sharing the port, 0 for one per core (default forks per transfer)\n");
+        fprintf(stderr, "  -r  aggregate send rate shared fairly by all transfers, 0 for no cap (default 0)\n");
+        fprintf(stderr, "  -w  weight of a client address in the rate split, repeatable (default %i, max %i)\n", SCHED_WEIGHT_DEFAULT, SCHED_WEIGHT_MAX);
+        fprintf(stderr, "  -m  transfers past this many are admitted with a smaller window, 0 for no limit (default 0)\n");
+        fprintf(stderr, "  -t  append a JSON report per transfer to this file, - for stdout\n");
+        fprintf(stderr, "  -T  with -t, also report every %i ms while a transfer runs\n", TELEMETRY_INTERVAL_MS);
+        fprintf(stderr, "  -E  record a binary event trace per process in this directory, read it with tracedump\n");
         return -1;
     }
 
-	char *endptr;
-	long value;
+    // Line the positional arguments up with argv[1]
+    argv += optind - 1;
+    argc -= optind - 1;
 
     // Parse and validate errorRate (float between 0 and 1 inclusive)
     float rate = strtof(argv[1], &endptr);
     if (*endptr != '\0' || rate < 0.0f || rate > 1.0f) {
-        fprintf(stderr, "Invalid error-rate: %s\n", argv[5]);
+        fprintf(stderr, "Invalid error-rate: %s\n", argv[1]);
         return -1;
     }
     settings->errorRate = rate;
@@ -558,7 +1376,7 @@ checkArgs(
     // Parse and validate serverPort (must be in range 1 to 65535)
     value = strtol(argv[2], &endptr, 10);
     if (*endptr != '\0' || value <= 0 || value > 65535) {
-        fprintf(stderr, "Invalid optional-port-numbert: %s\n", argv[7]);
+        fprintf(stderr, "Invalid optional-port-numbert: %s\n", argv[2]);
         return -1;
     }
     settings->port = (uint16_t)value;
@@ -576,14 +1394,30 @@ main(
 		exit(1);
 	}
 
-#ifdef __DEBUG_ON
-	printf("Server PID: %i\n", getpid());
-#endif // __DEBUG_ON
+	if(settings.traceDir != NULL && !traceOpen(settings.traceDir, "server")){
+		exit(1);
+	}
 
-	settings.socketNum = udpServerSetup(settings.port);
+	TRACE(SRV_PID, 0, getpid());
+
+	fileCacheInit(settings.cacheBytes);
+	schedulerInit(settings.rateBytes, settings.sessionsMax);
+
+	if(settings.telemetryPath != NULL && !telemetryOpen(settings.telemetryPath, settings.telemetryPeriodic)){
+		exit(1);
+	}
 
+	// Once per program, forked workers and children each get their own seed from it
 	sendErr_init(settings.errorRate, DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON);
 
+	if(settings.prefork){
+		settings.socketNum = udpServerSetupReusePort(settings.port, 1);
+
+		runWorkerPool();
+	}
+
+	settings.socketNum = udpServerSetup(settings.port);
+
 	setupPollSet();
 	addToPollSet(settings.socketNum);
 
@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "cpe464.h"
+
+#include "swarm.h"
+#include "trace.h"
+
+enum ChunkStates_e{
+	CHUNK_TODO = 0,
+	CHUNK_RUNNING,
+	CHUNK_DONE,
+};
+
+typedef struct {
+	uint8_t state;
+	uint8_t copies;
+} Chunk_t;
+
+typedef struct {
+	pid_t pid;
+	uint64_t chunk;
+
+	uint32_t fails;
+	bool dead;
+
+	uint64_t chunksDone;
+	uint64_t bytesDone;
+} SourceState_t;
+
+static Chunk_t* chunks = NULL;
+static uint64_t numChunks = 0;
+static uint64_t chunksMax = 0;
+
+// Index of the range holding the end of the file, unknown until one comes back short
+static uint64_t lastChunk = UINT64_MAX;
+static uint64_t fileEnd = UINT64_MAX;
+
+bool
+swarmParseSource(
+	const char* arg,
+	SwarmSource_t* sourcePtr
+){
+	// Last colon, so IPv6 literals like ::1:4444 still split right
+	const char* colon = strrchr(arg, ':');
+	char* endptr;
+
+	if(colon == NULL || colon == arg || (size_t) (colon - arg) > SWARM_NAME_MAX){
+		return false;
+	}
+
+	long port = strtol(colon + 1, &endptr, 10);
+
+	if(*(colon + 1) == '\0' || *endptr != '\0' || port <= 0 || port > 65535){
+		return false;
+	}
+
+	memcpy(sourcePtr->serverName, arg, colon - arg);
+	sourcePtr->serverName[colon - arg] = '\0';
+	sourcePtr->serverPort = (uint16_t) port;
+
+	return true;
+}
+
+static uint64_t
+newChunk(
+	void
+){
+	if(numChunks == chunksMax){
+		chunksMax = (chunksMax == 0) ? 64 : chunksMax * 2;
+		chunks = (Chunk_t*) realloc(chunks, chunksMax * sizeof(Chunk_t));
+
+		if(chunks == NULL){
+			perror("newChunk: realloc() error");
+			exit(1);
+		}
+	}
+
+	chunks[numChunks].state = CHUNK_TODO;
+	chunks[numChunks].copies = 0;
+
+	return numChunks++;
+}
+
+static bool
+pickChunk(
+	uint64_t* chunkPtr
+){
+	// Ranges a failed source gave back come first
+	for(uint64_t i = 0; i < numChunks && i <= lastChunk; i++){
+		if(chunks[i].state == CHUNK_TODO){
+			*chunkPtr = i;
+			return true;
+		}
+	}
+
+	if(lastChunk == UINT64_MAX){
+		*chunkPtr = newChunk();
+		return true;
+	}
+
+	// Endgame, race a second source against a range still in flight
+	for(uint64_t i = 0; i <= lastChunk; i++){
+		if(chunks[i].state == CHUNK_RUNNING && chunks[i].copies == 1){
+			*chunkPtr = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool
+allChunksDone(
+	void
+){
+	if(lastChunk == UINT64_MAX){
+		return false;
+	}
+
+	for(uint64_t i = 0; i <= lastChunk; i++){
+		if(chunks[i].state != CHUNK_DONE){
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void
+startFetch(
+	const SwarmSource_t* sources,
+	SourceState_t* states,
+	int64_t* results,
+	uint32_t sourceIdx,
+	uint64_t chunk,
+	uint64_t chunkBytes,
+	SwarmFetch_t fetch
+){
+	pid_t pid;
+
+	results[sourceIdx] = -1;
+
+	if((pid = fork()) < 0){
+		perror("startFetch: fork() error");
+		exit(1);
+	} else if(pid == 0){
+		// Child
+		results[sourceIdx] = fetch(&sources[sourceIdx], chunk * chunkBytes, chunkBytes);
+
+		exit((results[sourceIdx] < 0) ? 1 : 0);
+	}
+
+	TRACE(SWARM_RANGE, 0, chunk, sourceIdx, pid);
+
+	states[sourceIdx].pid = pid;
+	states[sourceIdx].chunk = chunk;
+
+	chunks[chunk].state = CHUNK_RUNNING;
+	chunks[chunk].copies++;
+}
+
+static void
+finishFetch(
+	SourceState_t* states,
+	int64_t* results,
+	uint32_t numSources,
+	uint32_t sourceIdx,
+	int status,
+	uint64_t chunkBytes
+){
+	SourceState_t* statePtr = &states[sourceIdx];
+	uint64_t chunk = statePtr->chunk;
+
+	statePtr->pid = 0;
+	chunks[chunk].copies--;
+
+	if(chunks[chunk].state == CHUNK_DONE){
+		// Lost the endgame race
+		return;
+	}
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0 || results[sourceIdx] < 0){
+		if(++statePtr->fails >= SWARM_SOURCE_FAILS_MAX){
+			statePtr->dead = true;
+		}
+
+		if(chunks[chunk].copies == 0){
+			chunks[chunk].state = CHUNK_TODO;
+		}
+
+		return;
+	}
+
+	uint64_t bytes = (uint64_t) results[sourceIdx];
+
+	chunks[chunk].state = CHUNK_DONE;
+
+	statePtr->fails = 0;
+	statePtr->chunksDone++;
+	statePtr->bytesDone += bytes;
+
+	if(bytes < chunkBytes && chunk < lastChunk){
+		lastChunk = chunk;
+		fileEnd = chunk * chunkBytes + bytes;
+	}
+
+	// Any copy still racing this range has nothing left to add
+	for(uint32_t i = 0; i < numSources; i++){
+		if(states[i].pid != 0 && states[i].chunk == chunk){
+			kill(states[i].pid, SIGTERM);
+		}
+	}
+}
+
+int
+swarmRun(
+	const SwarmSource_t* sources,
+	uint32_t numSources,
+	uint64_t chunkBytes,
+	const char* toFileName,
+	SwarmFetch_t fetch
+){
+	SourceState_t states[SWARM_SOURCES_MAX];
+	int fd;
+
+	memset(states, 0, sizeof(states));
+
+	// Children fetch into this at their own offsets
+	if((fd = open(toFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0){
+		perror("Error opening file");
+		exit(1);
+	}
+
+	// One result slot per source, a source only ever has one child running
+	int64_t* results = (int64_t*) mmap(NULL, numSources * sizeof(int64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if(results == MAP_FAILED){
+		perror("swarmRun: mmap() error");
+		exit(1);
+	}
+
+	int running = 0;
+
+	while(!allChunksDone()){
+		for(uint32_t i = 0; i < numSources; i++){
+			uint64_t chunk;
+
+			if(states[i].pid == 0 && !states[i].dead && pickChunk(&chunk)){
+				startFetch(sources, states, results, i, chunk, chunkBytes, fetch);
+				running++;
+			}
+		}
+
+		if(running == 0){
+			break;
+		}
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+
+		if(pid < 0){
+			perror("swarmRun: waitpid() error");
+			exit(1);
+		}
+
+		for(uint32_t i = 0; i < numSources; i++){
+			if(states[i].pid == pid){
+				finishFetch(states, results, numSources, i, status, chunkBytes);
+				running--;
+				break;
+			}
+		}
+	}
+
+	bool done = allChunksDone();
+
+	// Ranges past the end of the file, or a lost endgame copy
+	for(uint32_t i = 0; i < numSources; i++){
+		if(states[i].pid != 0){
+			kill(states[i].pid, SIGTERM);
+			waitpid(states[i].pid, NULL, 0);
+		}
+	}
+
+	if(done && ftruncate(fd, fileEnd) < 0){
+		perror("swarmRun: ftruncate() error");
+		done = false;
+	}
+
+	close(fd);
+	munmap(results, numSources * sizeof(int64_t));
+
+	for(uint32_t i = 0; i < numSources; i++){
+		printf("Swarm: %s:%i ranges %llu bytes %llu%s\n",
+			sources[i].serverName,
+			sources[i].serverPort,
+			(unsigned long long) states[i].chunksDone,
+			(unsigned long long) states[i].bytesDone,
+			states[i].dead ? " (dropped)" : ""
+		);
+	}
+
+	if(!done){
+		fprintf(stderr, "Error: every source failed, %s is incomplete\n", toFileName);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,46 @@
+// Multi-source download of one file.
+//
+// The coordinator hands out fixed size byte ranges one at a time, each fetched
+// by a forked child, so fast sources keep coming back for more and slow or
+// lossy ones end up with less of the file. Failed ranges go back in the queue
+// for any source, and once nothing is left to hand out, idle sources duplicate
+// the ranges still in flight (endgame). The file size is never asked for, the
+// first range to come back short marks the end of the file.
+
+#ifndef SWARM_H
+#define SWARM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SWARM_SOURCES_MAX 16
+#define SWARM_NAME_MAX 1024
+#define SWARM_CHUNK_DEFAULT (1 << 20)
+// Consecutive failed ranges before a source is dropped
+#define SWARM_SOURCE_FAILS_MAX 3
+
+typedef struct {
+	char serverName[SWARM_NAME_MAX + 1];
+	uint16_t serverPort;
+} SwarmSource_t;
+
+// Runs in the forked child, writes [offset, offset + length) into the output
+// file at offset. Returns the bytes written, short at end of file, or -1.
+typedef int64_t (*SwarmFetch_t)(const SwarmSource_t* sourcePtr, uint64_t offset, uint64_t length);
+
+bool
+swarmParseSource(
+	const char* arg,
+	SwarmSource_t* sourcePtr
+);
+
+int
+swarmRun(
+	const SwarmSource_t* sources,
+	uint32_t numSources,
+	uint64_t chunkBytes,
+	const char* toFileName,
+	SwarmFetch_t fetch
+);
+
+#endif // SWARM_H
@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+#include "packet.h"
+#include "rtt.h"
+
+#define TELEMETRY_LINE_MAX 4096
+
+typedef struct {
+	const char* role;
+	char fileName[FILENAME_MAX_LEN + 1];
+	const char* const* stateNames;
+	uint32_t numStates;
+
+	bool active;
+	uint64_t startUs;
+	uint64_t lastReportUs;
+
+	uint32_t state;
+	uint64_t stateSinceUs;
+	uint64_t stateUs[TELEMETRY_STATES_MAX];
+
+	uint64_t counters[TELEMETRY_NUM_COUNTERS];
+
+	uint64_t rttSamples;
+	uint64_t rttSumUs;
+	uint64_t rttMinUs;
+	uint64_t rttMaxUs;
+	uint64_t rttBuckets[TELEMETRY_RTT_BUCKETS];
+
+	// NULL unless the server looked the file up in its cache
+	const char* cacheLookup;
+	FileCacheStats_t cacheStats;
+} Telemetry_t;
+
+static const char* counterNames[TELEMETRY_NUM_COUNTERS] = {
+	"packets_sent",
+	"bytes_sent",
+	"packets_received",
+	"bytes_received",
+	"data_packets",
+	"srej_resends",
+	"timeout_resends",
+	"rrs",
+	"srejs",
+	"file_bytes",
+};
+
+// Opened once before any fork, reports from every process append to the same file
+static int reportFd = -1;
+static bool reportPeriodic = false;
+
+static Telemetry_t telemetry;
+
+bool
+telemetryOpen(
+	const char* path,
+	bool periodic
+){
+	if(strcmp(path, "-") == 0){
+		reportFd = STDOUT_FILENO;
+	} else if((reportFd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0){
+		perror("telemetryOpen: open() error");
+		return false;
+	}
+
+	reportPeriodic = periodic;
+
+	return true;
+}
+
+void
+telemetryStart(
+	const char* role,
+	const char* fileName,
+	const char* const* stateNames,
+	uint32_t numStates,
+	uint32_t state
+){
+	if(reportFd < 0){
+		return;
+	}
+
+	memset(&telemetry, 0, sizeof(telemetry));
+
+	telemetry.role = role;
+	telemetry.stateNames = stateNames;
+	telemetry.numStates = (numStates > TELEMETRY_STATES_MAX) ? TELEMETRY_STATES_MAX : numStates;
+
+	strncpy(telemetry.fileName, fileName, FILENAME_MAX_LEN);
+
+	telemetry.active = true;
+	telemetry.startUs = rttNowUs();
+	telemetry.lastReportUs = telemetry.startUs;
+	telemetry.state = state;
+	telemetry.stateSinceUs = telemetry.startUs;
+	telemetry.rttMinUs = UINT64_MAX;
+}
+
+static void
+chargeState(
+	uint64_t nowUs
+){
+	if(telemetry.state < telemetry.numStates){
+		telemetry.stateUs[telemetry.state] += nowUs - telemetry.stateSinceUs;
+	}
+
+	telemetry.stateSinceUs = nowUs;
+}
+
+void
+telemetryState(
+	uint32_t state
+){
+	if(!telemetry.active || state == telemetry.state){
+		return;
+	}
+
+	chargeState(rttNowUs());
+	telemetry.state = state;
+}
+
+void
+telemetryCount(
+	TelemetryCounters_e counter,
+	uint64_t value
+){
+	if(telemetry.active){
+		telemetry.counters[counter] += value;
+	}
+}
+
+static void
+countFlag(
+	uint8_t flag
+){
+	switch(flag){
+	case FLAG_TYPE_DATA:
+	case FLAG_TYPE_EOF:
+		telemetry.counters[TELEMETRY_DATA_PACKETS]++;
+		break;
+	case FLAG_TYPE_SREJ_DATA:
+		telemetry.counters[TELEMETRY_DATA_PACKETS]++;
+		telemetry.counters[TELEMETRY_SREJ_RESENDS]++;
+		break;
+	case FLAG_TYPE_TIMEOUT_DATA:
+		telemetry.counters[TELEMETRY_DATA_PACKETS]++;
+		telemetry.counters[TELEMETRY_TIMEOUT_RESENDS]++;
+		break;
+	case FLAG_TYPE_RR:
+		telemetry.counters[TELEMETRY_RRS]++;
+		break;
+	case FLAG_TYPE_SREJ:
+		telemetry.counters[TELEMETRY_SREJS]++;
+		break;
+	default:
+		break;
+	}
+}
+
+void
+telemetrySent(
+	uint32_t bytes,
+	uint8_t flag
+){
+	if(!telemetry.active){
+		return;
+	}
+
+	telemetry.counters[TELEMETRY_PACKETS_SENT]++;
+	telemetry.counters[TELEMETRY_BYTES_SENT] += bytes;
+
+	countFlag(flag);
+}
+
+void
+telemetryReceived(
+	uint32_t bytes,
+	uint8_t flag
+){
+	if(!telemetry.active){
+		return;
+	}
+
+	telemetry.counters[TELEMETRY_PACKETS_RECEIVED]++;
+	telemetry.counters[TELEMETRY_BYTES_RECEIVED] += bytes;
+
+	countFlag(flag);
+}
+
+static uint32_t
+rttBucket(
+	uint64_t us
+){
+	if(us < 16){
+		return (uint32_t) us;
+	}
+
+	uint32_t exp = 63 - __builtin_clzll(us);
+	uint32_t sub = (us >> (exp - TELEMETRY_RTT_SUB_BITS)) & ((1 << TELEMETRY_RTT_SUB_BITS) - 1);
+	uint32_t bucket = 16 + (exp - 4) * (1 << TELEMETRY_RTT_SUB_BITS) + sub;
+
+	return (bucket < TELEMETRY_RTT_BUCKETS) ? bucket : TELEMETRY_RTT_BUCKETS - 1;
+}
+
+static uint64_t
+rttBucketMidUs(
+	uint32_t bucket
+){
+	if(bucket < 16){
+		return bucket;
+	}
+
+	uint32_t exp = (bucket - 16) / (1 << TELEMETRY_RTT_SUB_BITS) + 4;
+	uint32_t sub = (bucket - 16) % (1 << TELEMETRY_RTT_SUB_BITS);
+	uint64_t width = (uint64_t) 1 << (exp - TELEMETRY_RTT_SUB_BITS);
+
+	return (((uint64_t) (1 << TELEMETRY_RTT_SUB_BITS) + sub) << (exp - TELEMETRY_RTT_SUB_BITS)) + width / 2;
+}
+
+void
+telemetryFileCache(
+	const char* lookup,
+	const FileCacheStats_t* statsPtr
+){
+	if(telemetry.active){
+		telemetry.cacheLookup = lookup;
+		telemetry.cacheStats = *statsPtr;
+	}
+}
+
+void
+telemetryRtt(
+	uint64_t rttUs
+){
+	if(!telemetry.active){
+		return;
+	}
+
+	telemetry.rttSamples++;
+	telemetry.rttSumUs += rttUs;
+	telemetry.rttBuckets[rttBucket(rttUs)]++;
+
+	if(rttUs < telemetry.rttMinUs){
+		telemetry.rttMinUs = rttUs;
+	}
+
+	if(rttUs > telemetry.rttMaxUs){
+		telemetry.rttMaxUs = rttUs;
+	}
+}
+
+static uint64_t
+rttPercentileUs(
+	uint32_t percent
+){
+	uint64_t rank = (telemetry.rttSamples * percent + 99) / 100;
+	uint64_t seen = 0;
+
+	for(uint32_t i = 0; i < TELEMETRY_RTT_BUCKETS; i++){
+		seen += telemetry.rttBuckets[i];
+
+		if(seen >= rank){
+			uint64_t us = rttBucketMidUs(i);
+
+			// The bucket's middle can fall outside what was actually seen
+			if(us < telemetry.rttMinUs){
+				return telemetry.rttMinUs;
+			}
+
+			return (us > telemetry.rttMaxUs) ? telemetry.rttMaxUs : us;
+		}
+	}
+
+	return telemetry.rttMaxUs;
+}
+
+static void
+appendf(
+	char* line,
+	size_t* lenPtr,
+	const char* format,
+	...
+){
+	va_list args;
+
+	if(*lenPtr >= TELEMETRY_LINE_MAX){
+		return;
+	}
+
+	va_start(args, format);
+	int written = vsnprintf(line + *lenPtr, TELEMETRY_LINE_MAX - *lenPtr, format, args);
+	va_end(args);
+
+	if(written > 0){
+		*lenPtr += (size_t) written;
+	}
+}
+
+static void
+appendJsonString(
+	char* line,
+	size_t* lenPtr,
+	const char* value
+){
+	appendf(line, lenPtr, "\"");
+
+	for(const char* c = value; *c != '\0'; c++){
+		if(*c == '"' || *c == '\\'){
+			appendf(line, lenPtr, "\\%c", *c);
+		} else if((unsigned char) *c < 0x20){
+			appendf(line, lenPtr, "\\u%04x", (unsigned char) *c);
+		} else {
+			appendf(line, lenPtr, "%c", *c);
+		}
+	}
+
+	appendf(line, lenPtr, "\"");
+}
+
+static void
+report(
+	const char* event,
+	bool completed,
+	uint64_t nowUs
+){
+	char line[TELEMETRY_LINE_MAX];
+	size_t len = 0;
+
+	chargeState(nowUs);
+
+	uint64_t elapsedUs = nowUs - telemetry.startUs;
+	uint64_t goodputBps = (elapsedUs > 0) ? (uint64_t) (telemetry.counters[TELEMETRY_FILE_BYTES] * 8.0 * 1000000.0 / elapsedUs) : 0;
+
+	appendf(line, &len, "{\"role\":\"%s\",\"event\":\"%s\",\"pid\":%i,\"file\":", telemetry.role, event, getpid());
+	appendJsonString(line, &len, telemetry.fileName);
+
+	if(strcmp(event, "final") == 0){
+		appendf(line, &len, ",\"completed\":%s", completed ? "true" : "false");
+	}
+
+	appendf(line, &len, ",\"elapsed_us\":%llu,\"goodput_bps\":%llu", (unsigned long long) elapsedUs, (unsigned long long) goodputBps);
+
+	for(uint32_t i = 0; i < TELEMETRY_NUM_COUNTERS; i++){
+		appendf(line, &len, ",\"%s\":%llu", counterNames[i], (unsigned long long) telemetry.counters[i]);
+	}
+
+	appendf(line, &len, ",\"rtt_us\":{\"samples\":%llu", (unsigned long long) telemetry.rttSamples);
+
+	if(telemetry.rttSamples > 0){
+		appendf(line, &len, ",\"min\":%llu,\"avg\":%llu,\"p99\":%llu,\"max\":%llu",
+			(unsigned long long) telemetry.rttMinUs,
+			(unsigned long long) (telemetry.rttSumUs / telemetry.rttSamples),
+			(unsigned long long) rttPercentileUs(99),
+			(unsigned long long) telemetry.rttMaxUs
+		);
+	}
+
+	appendf(line, &len, "}");
+
+	if(telemetry.cacheLookup != NULL){
+		appendf(line, &len, ",\"file_cache\":{\"lookup\":\"%s\",\"hits\":%llu,\"misses\":%llu,\"bypassed\":%llu,\"evictions\":%llu,\"bytes\":%zu,\"capacity\":%zu}",
+			telemetry.cacheLookup,
+			(unsigned long long) telemetry.cacheStats.hits,
+			(unsigned long long) telemetry.cacheStats.misses,
+			(unsigned long long) telemetry.cacheStats.bypassed,
+			(unsigned long long) telemetry.cacheStats.evictions,
+			telemetry.cacheStats.bytesCached,
+			telemetry.cacheStats.capacity
+		);
+	}
+
+	appendf(line, &len, ",\"state_us\":{");
+
+	for(uint32_t i = 0; i < telemetry.numStates; i++){
+		appendf(line, &len, "%s\"%s\":%llu", (i > 0) ? "," : "", telemetry.stateNames[i], (unsigned long long) telemetry.stateUs[i]);
+	}
+
+	appendf(line, &len, "}}\n");
+
+	if(len >= TELEMETRY_LINE_MAX){
+		// Truncated, still end the line so the next report parses
+		len = TELEMETRY_LINE_MAX;
+		line[len - 1] = '\n';
+	}
+
+	// One write per line, O_APPEND keeps reports from concurrent sessions whole
+	if(write(reportFd, line, len) < 0){
+		perror("telemetry: write() error");
+	}
+}
+
+void
+telemetryTick(
+	void
+){
+	if(!telemetry.active || !reportPeriodic){
+		return;
+	}
+
+	uint64_t nowUs = rttNowUs();
+
+	if(nowUs - telemetry.lastReportUs >= (uint64_t) TELEMETRY_INTERVAL_MS * 1000){
+		telemetry.lastReportUs = nowUs;
+		report("interval", false, nowUs);
+	}
+}
+
+void
+telemetryFinish(
+	bool completed
+){
+	if(!telemetry.active){
+		return;
+	}
+
+	report("final", completed, rttNowUs());
+
+	telemetry.active = false;
+}
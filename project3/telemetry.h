@@ -0,0 +1,102 @@
+// Per-transfer counters, RTT distribution and time per state, reported as JSON.
+//
+// One transfer per process at a time, so the collector is a single static object.
+// Reports are single JSON lines appended to the file given to telemetryOpen(), one
+// when the transfer ends and optionally one per interval while it runs. Every call
+// is a no-op until telemetryOpen() succeeds.
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fileCache.h"
+
+#define TELEMETRY_INTERVAL_MS 1000
+#define TELEMETRY_STATES_MAX 16
+
+// RTT histogram, exact below 16 us then 8 buckets per power of two (within 12.5%)
+#define TELEMETRY_RTT_SUB_BITS 3
+#define TELEMETRY_RTT_BUCKETS (16 + 36 * 8)
+
+typedef enum TelemetryCounters {
+	TELEMETRY_PACKETS_SENT = 0,
+	TELEMETRY_BYTES_SENT,
+	TELEMETRY_PACKETS_RECEIVED,
+	TELEMETRY_BYTES_RECEIVED,
+	// Data packets sent (server) or received (rcopy), resends included
+	TELEMETRY_DATA_PACKETS,
+	TELEMETRY_SREJ_RESENDS,
+	TELEMETRY_TIMEOUT_RESENDS,
+	// Sent by rcopy, received by the server
+	TELEMETRY_RRS,
+	TELEMETRY_SREJS,
+	// File bytes read (server) or written (rcopy), before compression
+	TELEMETRY_FILE_BYTES,
+
+	TELEMETRY_NUM_COUNTERS
+} TelemetryCounters_e;
+
+bool
+telemetryOpen(
+	const char* path, // "-" for stdout
+	bool periodic
+);
+
+void
+telemetryStart(
+	const char* role,
+	const char* fileName,
+	const char* const* stateNames,
+	uint32_t numStates,
+	uint32_t state
+);
+
+void
+telemetryState(
+	uint32_t state
+);
+
+void
+telemetryCount(
+	TelemetryCounters_e counter,
+	uint64_t value
+);
+
+// Both count the packet by its flag, so each side classifies what it sees the same way
+void
+telemetrySent(
+	uint32_t bytes,
+	uint8_t flag
+);
+
+void
+telemetryReceived(
+	uint32_t bytes,
+	uint8_t flag
+);
+
+// The server's cache counts as the transfer started, lookup is how its own file was found
+void
+telemetryFileCache(
+	const char* lookup,
+	const FileCacheStats_t* statsPtr
+);
+
+void
+telemetryRtt(
+	uint64_t rttUs
+);
+
+void
+telemetryTick(
+	void
+);
+
+void
+telemetryFinish(
+	bool completed
+);
+
+#endif // TELEMETRY_H
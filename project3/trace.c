@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+#include "rtt.h"
+
+#define TRACE_FORMAT(name, format) format,
+#define TRACE_FILE_SSIZE (sizeof(TraceHeader_t) + (size_t) TRACE_RECORDS * sizeof(TraceRecord_t))
+
+const char* const traceFormats[TRACE_NUM_EVENTS] = {
+	TRACE_EVENTS(TRACE_FORMAT)
+};
+
+TraceRecord_t* traceRing = NULL;
+
+static TraceHeader_t* traceHeader = NULL;
+static char traceDir[PATH_MAX];
+static char traceRole[TRACE_ROLE_MAX];
+
+static bool
+mapTraceFile(
+	void
+){
+	char path[PATH_MAX];
+	int fd;
+
+	if(snprintf(path, sizeof(path), "%s/%s.%i.trace", traceDir, traceRole, getpid()) >= (int) sizeof(path)){
+		fprintf(stderr, "traceOpen: trace directory name too long\n");
+		return false;
+	}
+
+	if((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0){
+		perror("traceOpen: open() error");
+		return false;
+	}
+
+	if(ftruncate(fd, TRACE_FILE_SSIZE) < 0){
+		perror("traceOpen: ftruncate() error");
+		close(fd);
+		return false;
+	}
+
+	void* map = mmap(NULL, TRACE_FILE_SSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(map == MAP_FAILED){
+		perror("traceOpen: mmap() error");
+		return false;
+	}
+
+	traceHeader = (TraceHeader_t*) map;
+	traceRing = (TraceRecord_t*) ((uint8_t*) map + sizeof(TraceHeader_t));
+
+	memcpy(traceHeader->magic, TRACE_MAGIC, sizeof(traceHeader->magic));
+	traceHeader->version = TRACE_VERSION;
+	traceHeader->recordSize = sizeof(TraceRecord_t);
+	traceHeader->capacity = TRACE_RECORDS;
+	traceHeader->head = 0;
+	traceHeader->pid = (uint32_t) getpid();
+	memcpy(traceHeader->role, traceRole, sizeof(traceHeader->role));
+
+	return true;
+}
+
+static void
+traceAfterFork(
+	void
+){
+	if(traceHeader == NULL){
+		return;
+	}
+
+	// Still the parent's file, the child starts its own
+	munmap(traceHeader, TRACE_FILE_SSIZE);
+	traceHeader = NULL;
+	traceRing = NULL;
+
+	mapTraceFile();
+}
+
+bool
+traceOpen(
+	const char* dir,
+	const char* role
+){
+	snprintf(traceDir, sizeof(traceDir), "%s", dir);
+	snprintf(traceRole, sizeof(traceRole), "%s", role);
+
+	if(!mapTraceFile()){
+		return false;
+	}
+
+	pthread_atfork(NULL, NULL, traceAfterFork);
+
+	return true;
+}
+
+void
+traceEmit(
+	uint32_t event,
+	SeqNum_t seqNum,
+	uint64_t arg0,
+	uint64_t arg1,
+	uint64_t arg2
+){
+	// One writer per file, so the ring needs no lock, only the head published last
+	uint64_t head = traceHeader->head;
+	TraceRecord_t* recordPtr = &traceRing[head & (TRACE_RECORDS - 1)];
+
+	recordPtr->tsUs = rttNowUs();
+	recordPtr->event = event;
+	recordPtr->seqNum = seqNum;
+	recordPtr->args[0] = arg0;
+	recordPtr->args[1] = arg1;
+	recordPtr->args[2] = arg2;
+
+	__atomic_store_n(&traceHeader->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void
+traceDebug(
+	uint32_t event,
+	SeqNum_t seqNum,
+	uint64_t arg0,
+	uint64_t arg1,
+	uint64_t arg2
+){
+	TraceRecord_t record = {0, event, seqNum, {arg0, arg1, arg2}};
+
+	tracePrint(stdout, &record);
+
+	if(traceRing != NULL){
+		traceEmit(event, seqNum, arg0, arg1, arg2);
+	}
+}
+
+void
+tracePrint(
+	FILE* stream,
+	const TraceRecord_t* recordPtr
+){
+	if(recordPtr->event >= TRACE_NUM_EVENTS){
+		fprintf(stream, "Unknown trace event %u (seq %u)\n", recordPtr->event, recordPtr->seqNum);
+		return;
+	}
+
+	fprintf(stream, traceFormats[recordPtr->event],
+		(unsigned long long) recordPtr->args[0],
+		(unsigned long long) recordPtr->args[1],
+		(unsigned long long) recordPtr->args[2]
+	);
+}
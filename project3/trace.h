@@ -0,0 +1,188 @@
+// Binary event trace, cheap enough to leave on.
+//
+// TRACE() stores a fixed-size record (timestamp, event, sequence number, up to three
+// integer arguments) in a ring mapped from <dir>/<role>.<pid>.trace. A forked child
+// gets its own file. tracedump prints the records with the same messages the debug
+// printfs used to, from the format table below. With __DEBUG_ON every TRACE() is also
+// printed as it happens.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet.h"
+
+#define TRACE_MAGIC "TRACE464"
+#define TRACE_VERSION 1
+// Power of two, 40 bytes each
+#define TRACE_RECORDS 65536
+#define TRACE_ROLE_MAX 16
+
+// X(name, format), the format takes the record's three arguments in order
+#define TRACE_EVENTS(X) \
+	X(MALFORMED_PACKET, "Error: Malformed packet receieved!\n") \
+	X(LAST_DATA_BANNER, "\nInfo: ------------------------------------\nInfo: Entering last data teardown state...\nInfo: ------------------------------------\n\n") \
+	\
+	X(WINDOW_ADD, "Info: addPacket(): Window state (%llu, %llu, %llu)\n") \
+	X(WINDOW_REPLACE, "Info: replacePacket(): Window state (%llu, %llu, %llu)\n") \
+	X(WINDOW_REMOVE, "Info: removePacket(): Window state (%llu, %llu, %llu)\n") \
+	X(WINDOW_CREDIT, "Info: setWindowCredit(): Window state (%llu, %llu, %llu)\n") \
+	\
+	X(SRV_PID, "Server PID: %llu\n") \
+	X(SRV_WORKER_START, "Info: Worker %llu PID: %llu listening on port %llu\n") \
+	X(SRV_WORKER_RESPAWN, "Info: Worker %llu (PID %llu) exited, respawning...\n") \
+	X(SRV_SHORT_PACKET, "Error: Less bytes received than expected!\n") \
+	X(SRV_BAD_FILENAME_PACKET, "Error: Bad filename packet received! Throwing out...\n") \
+	X(SRV_STALE_FILENAME, "Info: Filename queued past the client's retry timeout! Throwing out...\n") \
+	X(SRV_FILENAME_RECEIVED, "Info: Filename received! Processing filename...\n") \
+	X(SRV_DATA_ON_MAIN_SOCKET, "Error: Data recieved on not main socket while waiting for filename! (This shouldn't happen)\n") \
+	X(SRV_BYTE_RANGE, "Info: Sending byte range %llu to %llu of %llu\n") \
+	X(SRV_FILE_CACHE, "Info: File cache hits %llu misses %llu evictions %llu\n") \
+	X(SRV_CACHE_TRUNCATED, "Error: Cached file shrank at offset %llu! Reading the rest from disk...\n") \
+	X(SRV_BAD_SIZES, "Error: Bad window size (%llu) or buffer size (%llu) received! Sending response...\n") \
+	X(SRV_BAD_FILENAME, "Error: Bad filename received! Sending response...\n") \
+	X(SRV_CLIENT_SETTINGS, "Info: Client window size received as: %llu buffer size received as: %llu options: 0x%02llx\n") \
+	X(SRV_INVALID_RR_SREJ, "Error: Invalid RR/SREJ packet recieved! Throwing out...\n") \
+	X(SRV_SHORT_RR_SREJ, "Error: Short RR/SREJ packet recieved! Throwing out...\n") \
+	X(SRV_RR, "Info: Received RR# %llu credit %llu. Removing from window...\n") \
+	X(SRV_NOT_RR_SREJ, "Error: Recieved packet not SREJ or RR Type! Throwing out...\n") \
+	X(SRV_EOF_REACHED, "Info: End of file reached! Sending last bit of data...\n") \
+	X(SRV_BLOCK_ENCODING, "Info: Block encoding %llu carries %llu raw bytes in %llu bytes\n") \
+	X(SRV_DIGEST, "Info: File digest fnv1a64 %016llx\n") \
+	X(SRV_SEND_DATA, "Info: Sending data %llu\n") \
+	X(SRV_WINDOW_OPEN, "\nInfo: -------------------\nInfo: --- Window Open ---\nInfo: -------------------\n\n") \
+	X(SRV_STREAM_TIMEOUT, "Timeout: Client stopped answering while the stream was idle! Ending session...\n") \
+	X(SRV_CHECK_RR_SREJ, "Info: Checking for RR's or SREJ's\n") \
+	X(SRV_WINDOW_CLOSED, "\nInfo: --------------------\nInfo: --- Window Closed ---\nInfo: ---------------------\n\n") \
+	X(SRV_WAIT_RR_SREJ, "Info: Waiting on RR/SREJs...\n") \
+	X(SRV_CLIENT_TIMEOUT, "Timeout: Timed out waiting for client response! Ending session...\n") \
+	X(SRV_RESEND_LOWEST, "Timeout: Timeout waiting for RR/SREJs. Sending lowest packet...\n") \
+	X(SRV_SEND_FAILED, "Error: Sending data failed!\n") \
+	X(SRV_TAIL_PROBE, "Timeout: No RR/SREJs after %llums. Sending lowest packet as a probe...\n") \
+	X(SRV_EOF_ACK, "Info: EOF ack recievied! Closing file...\n") \
+	X(SRV_EOF_ACK_TIMEOUT, "Timeout: Timed out while waiting for EOF ack! Closing file...\n") \
+	X(SRV_SESSION_ENDED, "Info: Session ended, waiting for the next filename...\n") \
+	X(SRV_EXIT, "Info: Exiting Gracefully...\n") \
+	\
+	X(SCHED_SHRINK_WINDOW, "Info: %llu sessions running, admitting with window %llu instead of %llu\n") \
+	X(SCHED_SLOT, "Info: Scheduler slot %llu weight %llu\n") \
+	\
+	X(RC_SEND_FILENAME, "Info: Sending filename (%llu bytes)\n") \
+	X(RC_FILENAME_TIMEOUT, "Timeout: Filename response timed out! Resending filename...\n") \
+	X(RC_BAD_DATA_WAITING, "Error: Bad data received! Still waiting on the server...\n") \
+	X(RC_FIRST_DATA_OK, "Info: First data received, filename ok (options 0x%02llx)! Processing data...\n") \
+	X(RC_NO_FILENAME_RESP, "Error: Didn't recieve a filename response packet! Resending filename...\n") \
+	X(RC_BAD_FILENAME, "Error: Bad filename! Gracefully Exiting...\n") \
+	X(RC_FILENAME_OK, "Info: Received filename ok (options 0x%02llx)! Waiting for first data...\n") \
+	X(RC_SEND_RR, "Info: Sending RR: %llu credit %llu...\n") \
+	X(RC_EXPECTED, "Info: Expected SeqNum: %llu\n") \
+	X(RC_FIRST_DATA_TIMEOUT, "Timeout: Timeout receiving first file data! Resending filename...\n") \
+	X(RC_DATA_TIMEOUT, "Timeout: Timeout receiving data!\n") \
+	X(RC_GOOD_DATA, "Info: Good data received! Processing data...\n") \
+	X(RC_SEND_SREJ, "Info: Sending SREJ: %llu\n") \
+	X(RC_WRITE_DATA, "Info: Writing data %llu to disk.\n") \
+	X(RC_FLUSH_WINDOW, "Info: %llu valid in-order packets in window! Flushing window...\n") \
+	X(RC_OUT_OF_ORDER_BUFFERED, "Info: Out of order data still in buffer.\n") \
+	X(RC_NOT_DATA, "Error: Packet isn't a data packet! Throwing out...\n") \
+	X(RC_KEEPALIVE, "Info: Repeated filename response, the stream has no data yet. Sending RR...\n") \
+	X(RC_REPLACEMENT, "Info: Replacement data received (SeqNum %llu)! Replacing in window...\n") \
+	X(RC_EXIT_BUFFER, "\nInfo: ---------------------------\nInfo: --- Exiting buffer mode ---\nInfo: ---------------------------\n\n") \
+	X(RC_BUFFER_AHEAD, "Error: Greater than expected (%llu) data packet received (%llu)! Buffering data...\n") \
+	X(RC_BUFFER_ADD_FAILED, "Error: Failure to add packet to buffer! Shouldn't happen. Exiting...\n") \
+	X(RC_BUFFER_LOWER, "Info: Received lower (%llu) than expected (%llu) when buffering! Sending lowest SREJ and RR\n") \
+	X(RC_DUPLICATE, "Info: Duplicate data (SeqNum: %llu) received! Throwing out...\n") \
+	X(RC_REGULAR_DATA, "Info: Regular data packet recieved! Writing to disk...\n") \
+	X(RC_GOOD_PACKET, "Info: Good packet received! Moving up window...\n") \
+	X(RC_SREJ_AHEAD, "Error: Greater than expected data packet received! Sending SREJ for current RR...\n") \
+	X(RC_ENTER_BUFFER, "\nInfo: ----------------------------\nInfo: --- Entering buffer mode ---\nInfo: ----------------------------\n\n") \
+	X(RC_LOWER_DATA, "Error: Lower than expected data packet received! Sending current RR...\n") \
+	X(RC_EOF_ACK_PROBE, "Info: Server probed after EOF ack! Resending EOF ack...\n") \
+	X(RC_ALL_WRITTEN, "Info: All data written to disk! Sending Ack and closing file...\n") \
+	X(RC_LAST_DATA_TIMEOUT, "Timeout: Timedout while receiving last data packets! Asking again...\n") \
+	X(RC_LAST_BAD_DATA, "Error: Bad data received! Sending SREJ...\n") \
+	X(RC_LAST_DATA_TIMEOUT_MAX, "Timeout: Timeout maximum (%llu) reached while receiving last data packets!\n") \
+	X(RC_TIMEOUT_MAX, "Timeout: Timeout maximum (%llu) reached! Gracefully Exiting...\n") \
+	X(RC_INVALID_STATE, "Error: Invalid state reached! Exiting...\n") \
+	X(RC_PATH_MTU, "Info: Path MTU %llu allows payloads of %llu bytes\n") \
+	\
+	X(SWARM_RANGE, "Info: Swarm range %llu to source %llu (pid %llu)\n")
+
+#define TRACE_ENUM(name, format) TRACE_##name,
+
+typedef enum TraceEvents {
+	TRACE_EVENTS(TRACE_ENUM)
+
+	TRACE_NUM_EVENTS
+} TraceEvents_e;
+
+#pragma pack(push, 1)
+
+typedef struct {
+	uint64_t tsUs;
+	uint32_t event;
+	SeqNum_t seqNum;
+	uint64_t args[3];
+} TraceRecord_t;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	uint64_t capacity;
+	// Records ever written, the ring holds the last capacity of them
+	uint64_t head;
+	uint32_t pid;
+	char role[TRACE_ROLE_MAX];
+	uint8_t pad[12];
+} TraceHeader_t;
+
+#pragma pack(pop)
+
+extern const char* const traceFormats[TRACE_NUM_EVENTS];
+
+// NULL until traceOpen(), the only check TRACE() makes when tracing is off
+extern TraceRecord_t* traceRing;
+
+#define TRACE_ARGS(seq, a0, a1, a2, ...) (SeqNum_t) (seq), (uint64_t) (a0), (uint64_t) (a1), (uint64_t) (a2)
+
+// TRACE(event, seqNum[, arg0[, arg1[, arg2]]])
+#ifdef __DEBUG_ON
+#define TRACE(event, ...) traceDebug(TRACE_##event, TRACE_ARGS(__VA_ARGS__, 0, 0, 0, 0))
+#else
+#define TRACE(event, ...) do{ if(traceRing != NULL){ traceEmit(TRACE_##event, TRACE_ARGS(__VA_ARGS__, 0, 0, 0, 0)); } }while(0)
+#endif // __DEBUG_ON
+
+bool
+traceOpen(
+	const char* dir,
+	const char* role
+);
+
+void
+traceEmit(
+	uint32_t event,
+	SeqNum_t seqNum,
+	uint64_t arg0,
+	uint64_t arg1,
+	uint64_t arg2
+);
+
+void
+traceDebug(
+	uint32_t event,
+	SeqNum_t seqNum,
+	uint64_t arg0,
+	uint64_t arg1,
+	uint64_t arg2
+);
+
+void
+tracePrint(
+	FILE* stream,
+	const TraceRecord_t* recordPtr
+);
+
+#endif // TRACE_H
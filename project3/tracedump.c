@@ -0,0 +1,199 @@
+// Prints the binary traces server and rcopy write with -E, oldest record first.
+//
+// tracedump [-m] [-s seq-num] trace-file...
+//   -m  merge every file into one timeline, each line tagged with its pid
+//   -s  only records for this sequence number
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+typedef struct {
+	TraceRecord_t record;
+	uint32_t pid;
+	uint64_t order;
+} DumpRecord_t;
+
+static DumpRecord_t* records = NULL;
+static size_t numRecords = 0;
+static size_t recordsMax = 0;
+
+static bool
+loadTrace(
+	const char* path,
+	bool filterSeq,
+	SeqNum_t seqNum
+){
+	FILE* file;
+	TraceHeader_t header;
+
+	if((file = fopen(path, "rb")) == NULL){
+		perror(path);
+		return false;
+	}
+
+	if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0){
+		fprintf(stderr, "%s: not a trace file\n", path);
+		fclose(file);
+		return false;
+	}
+
+	if(header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord_t) || header.capacity == 0){
+		fprintf(stderr, "%s: unsupported trace version %u\n", path, header.version);
+		fclose(file);
+		return false;
+	}
+
+	uint64_t first = (header.head > header.capacity) ? header.head - header.capacity : 0;
+
+	header.role[TRACE_ROLE_MAX - 1] = '\0';
+	fprintf(stderr, "== %s: %s pid %u, %llu events (%llu overwritten)\n", path, header.role, header.pid,
+		(unsigned long long) header.head,
+		(unsigned long long) first
+	);
+
+	for(uint64_t i = first; i < header.head; i++){
+		TraceRecord_t record;
+
+		if(fseeko(file, sizeof(header) + (i % header.capacity) * sizeof(TraceRecord_t), SEEK_SET) < 0 || fread(&record, sizeof(record), 1, file) != 1){
+			fprintf(stderr, "%s: truncated at record %llu\n", path, (unsigned long long) i);
+			break;
+		}
+
+		if(filterSeq && record.seqNum != seqNum){
+			continue;
+		}
+
+		if(numRecords == recordsMax){
+			recordsMax = (recordsMax == 0) ? 4096 : recordsMax * 2;
+
+			if((records = (DumpRecord_t*) realloc(records, recordsMax * sizeof(DumpRecord_t))) == NULL){
+				perror("loadTrace: realloc() error");
+				exit(1);
+			}
+		}
+
+		records[numRecords].record = record;
+		records[numRecords].pid = header.pid;
+		records[numRecords].order = numRecords;
+		numRecords++;
+	}
+
+	fclose(file);
+
+	return true;
+}
+
+static int
+compareTime(
+	const void* a,
+	const void* b
+){
+	const DumpRecord_t* recordA = (const DumpRecord_t*) a;
+	const DumpRecord_t* recordB = (const DumpRecord_t*) b;
+
+	if(recordA->record.tsUs != recordB->record.tsUs){
+		return (recordA->record.tsUs < recordB->record.tsUs) ? -1 : 1;
+	}
+
+	// Keeps each process's own order for records in the same microsecond
+	return (recordA->order < recordB->order) ? -1 : 1;
+}
+
+static void
+printRecords(
+	bool showPid
+){
+	uint64_t startUs = (numRecords > 0) ? records[0].record.tsUs : 0;
+
+	for(size_t i = 0; i < numRecords; i++){
+		const TraceRecord_t* recordPtr = &records[i].record;
+		const char* format = (recordPtr->event < TRACE_NUM_EVENTS) ? traceFormats[recordPtr->event] : "";
+
+		// Banners open with blank lines, keep those ahead of the timestamp
+		while(*format == '\n'){
+			putchar('\n');
+			format++;
+		}
+
+		printf("%10.6f ", (recordPtr->tsUs - startUs) / 1000000.0);
+
+		if(showPid){
+			printf("[%u] ", records[i].pid);
+		}
+
+		if(recordPtr->event < TRACE_NUM_EVENTS){
+			printf(format,
+				(unsigned long long) recordPtr->args[0],
+				(unsigned long long) recordPtr->args[1],
+				(unsigned long long) recordPtr->args[2]
+			);
+		} else {
+			tracePrint(stdout, recordPtr);
+		}
+	}
+}
+
+int
+main(
+	int argc,
+	char* argv[]
+){
+	bool merge = false;
+	bool filterSeq = false;
+	SeqNum_t seqNum = 0;
+	int opt;
+	char* endptr;
+
+	while((opt = getopt(argc, argv, "ms:")) != -1){
+		switch(opt){
+		case 'm':
+			merge = true;
+			break;
+		case 's':
+			seqNum = (SeqNum_t) strtoul(optarg, &endptr, 10);
+			if(*endptr != '\0'){
+				fprintf(stderr, "Invalid sequence number: %s\n", optarg);
+				return 1;
+			}
+			filterSeq = true;
+			break;
+		default:
+			argc = 0;
+			break;
+		}
+	}
+
+	if(argc - optind < 1){
+		fprintf(stderr, "Usage: %s [-m] [-s seq-num] trace-file...\n", argv[0]);
+		fprintf(stderr, "  -m  merge the files into one timeline, tagged by pid\n");
+		fprintf(stderr, "  -s  only show records for this sequence number\n");
+		return 1;
+	}
+
+	int status = 0;
+
+	for(int i = optind; i < argc; i++){
+		if(!loadTrace(argv[i], filterSeq, seqNum)){
+			status = 1;
+			continue;
+		}
+
+		if(!merge){
+			printRecords(false);
+			numRecords = 0;
+		}
+	}
+
+	if(merge){
+		qsort(records, numRecords, sizeof(DumpRecord_t), compareTime);
+		printRecords(true);
+	}
+
+	free(records);
+
+	return status;
+}
@@ -4,6 +4,7 @@
 
 #include "window.h"
 #include "packet.h"
+#include "trace.h"
 
 Window_t window;
 
@@ -34,10 +35,18 @@ void
 windowDestroy(
 	void
 ){
+	if(window.elements == NULL){
+		return;
+	}
+
 	for(uint32_t i = 0; i < window.windowSize; i++){
 		free(window.elements[i].packet);
 	}
 	free(window.elements);
+
+	// Leave the window safe to destroy again, a server worker reuses it across sessions
+	window.elements = NULL;
+	window.windowSize = 0;
 }
 
 uint32_t
@@ -58,7 +67,8 @@ bool
 isWindowOpen(
 	void
 ){
-	return (window.windowState.current != window.windowState.upper);
+	// Less than, a shrinking credit can pull upper below what's already been sent
+	return (window.windowState.current < window.windowState.upper);
 }
 
 bool
@@ -73,7 +83,8 @@ addPacket(
 	Packet_t* packetPtr,
 	uint16_t dataSize
 ){
-	if(!isWindowOpen()){
+	// Below current fills a hole a reordered or lost packet left, the window has room for it
+	if(ntohl(packetPtr->header.seqNum) >= window.windowState.current && !isWindowOpen()){
 		return false;
 	}
 
@@ -81,6 +92,9 @@ addPacket(
 
 	window.elements[WINDOW_INDEX(packetPtr, window)].dataSize = dataSize;
 
+	window.elements[WINDOW_INDEX(packetPtr, window)].sentUs = 0;
+	window.elements[WINDOW_INDEX(packetPtr, window)].resent = false;
+
 	memcpy(WINDOW_ELEMENT_PACKET(window, WINDOW_INDEX(packetPtr, window)), packetPtr, WINDOW_ELEMENT_PACKET_SSIZE(window));
 
 	
@@ -95,9 +109,7 @@ addPacket(
 		window.windowState.current = ntohl(packetPtr->header.seqNum) + 1;
 	}
 
-#ifdef __DEBUG_ON
-	printf("Info: addPacket(): Window state (%i, %i, %i)\n", window.windowState.lower, window.windowState.current, window.windowState.upper);
-#endif // __DEBUG_ON
+	TRACE(WINDOW_ADD, window.windowState.current, window.windowState.lower, window.windowState.current, window.windowState.upper);
 
 	return true;
 }
@@ -113,9 +125,7 @@ replacePacket(
 
 	memcpy(WINDOW_ELEMENT_PACKET(window, WINDOW_INDEX(packetPtr, window)), packetPtr, WINDOW_ELEMENT_PACKET_SSIZE(window));
 
-#ifdef __DEBUG_ON
-	printf("Info: replacePacket(): Window state (%i, %i, %i)\n", window.windowState.lower, window.windowState.current, window.windowState.upper);
-#endif // __DEBUG_ON
+	TRACE(WINDOW_REPLACE, window.windowState.current, window.windowState.lower, window.windowState.current, window.windowState.upper);
 }
 
 Packet_t*
@@ -145,6 +155,11 @@ void
 removePacket(
 	SeqNum_t seqNum
 ){
+	if(seqNum < window.windowState.lower){
+		// Stale cumulative ack, a later one already moved the window past it
+		return;
+	}
+
 	for(uint32_t i = window.windowState.lower; i < seqNum; i++){
 		window.elements[i % window.windowSize].valid = false;
 	}
@@ -152,9 +167,72 @@ removePacket(
 	window.windowState.lower = seqNum;
 	window.windowState.upper = seqNum + window.windowSize;
 
-#ifdef __DEBUG_ON
-	printf("Info: removePacket(): Window state (%i, %i, %i)\n", window.windowState.lower, window.windowState.current, window.windowState.upper);
-#endif // __DEBUG_ON
+	TRACE(WINDOW_REMOVE, window.windowState.current, window.windowState.lower, window.windowState.current, window.windowState.upper);
+}
+
+void
+stampPacket(
+	SeqNum_t seqNum,
+	uint64_t sentUs
+){
+	window.elements[seqNum % window.windowSize].sentUs = sentUs;
+}
+
+void
+markPacketResent(
+	SeqNum_t seqNum
+){
+	window.elements[seqNum % window.windowSize].resent = true;
+}
+
+bool
+packetRttSample(
+	SeqNum_t seqNum,
+	uint64_t nowUs,
+	uint64_t* rttUsPtr
+){
+	if(seqNum < window.windowState.lower || seqNum >= window.windowState.current){
+		return false;
+	}
+
+	WindowElement_t* elementPtr = &window.elements[seqNum % window.windowSize];
+
+	if(!elementPtr->valid || elementPtr->resent || elementPtr->sentUs == 0 || nowUs < elementPtr->sentUs){
+		return false;
+	}
+
+	// An ack that also covers a resent packet waited on that hole, its delay isn't the path's
+	for(uint32_t i = window.windowState.lower; i < seqNum; i++){
+		if(window.elements[i % window.windowSize].resent){
+			return false;
+		}
+	}
+
+	*rttUsPtr = nowUs - elementPtr->sentUs;
+
+	return true;
+}
+
+void
+setWindowCredit(
+	SeqNum_t seqNum,
+	uint32_t credit
+){
+	if(seqNum != window.windowState.lower){
+		// Credit from a stale ack
+		return;
+	}
+
+	window.windowState.upper = window.windowState.lower + ((credit < window.windowSize) ? credit : window.windowSize);
+
+	TRACE(WINDOW_CREDIT, window.windowState.current, window.windowState.lower, window.windowState.current, window.windowState.upper);
+}
+
+uint32_t
+packetsInFlight(
+	void
+){
+	return window.windowState.current - window.windowState.lower;
 }
 
 void
@@ -18,6 +18,10 @@ typedef struct {
 	bool valid;
 	uint16_t dataSize;
 	Packet_t* packet;
+
+	// First send time, only packets never resent give RTT samples (Karn)
+	uint64_t sentUs;
+	bool resent;
 } WindowElement_t;
 
 typedef struct {
@@ -106,6 +110,35 @@ removePacket(
     SeqNum_t seqNum
 );
 
+void
+stampPacket(
+    SeqNum_t seqNum,
+    uint64_t sentUs
+);
+
+void
+markPacketResent(
+    SeqNum_t seqNum
+);
+
+bool
+packetRttSample(
+    SeqNum_t seqNum,
+    uint64_t nowUs,
+    uint64_t* rttUsPtr
+);
+
+void
+setWindowCredit(
+    SeqNum_t seqNum,
+    uint32_t credit
+);
+
+uint32_t
+packetsInFlight(
+	void
+);
+
 void
 inorderValidPackets(
 	PacketState_t** validPacketArray,
@@ -34,7 +34,7 @@ int main(void) {
 
     // --- Build and test a RR Packet ---
     Packet_t rrPkt;
-    buildRrPacket(&rrPkt, 1, 0);
+    buildRrPacket(&rrPkt, 1, 0, 0);
     if(isValidPacket(&rrPkt, RR_PACKET_SSIZE)) {
         printf("RR packet built and is valid.\n");
     } else {